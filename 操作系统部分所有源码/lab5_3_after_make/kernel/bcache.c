@@ -0,0 +1,219 @@
+/*
+ * buffer cache of RAM disk blocks, shared by the data, inode and bitmap blocks of rfs.
+ *
+ * cached blocks are found through a hash of (device, block number). a buffer that
+ * nobody holds stays cached on an LRU list, and the least recently released one is
+ * reused when the cache is full. writes only mark a buffer dirty: the block goes to
+ * the device when its buffer is reused, or on bcache_sync().
+ *
+ * runs of whole blocks (large file reads and writes) bypass the cache where they can,
+ * so streaming a big file neither copies it twice nor evicts the metadata blocks.
+ * such runs go straight between the device and the (user) pages of the I/O buffer.
+ */
+
+#include "bcache.h"
+#include "pmm.h"
+#include "slab.h"
+#include "util/string.h"
+#include "spike_interface/spike_utils.h"
+
+static struct buf *bcache_hash[BCACHE_HASH_SIZE];
+static int bcache_nbuf = 0;  // buffers allocated so far, they are never freed
+
+// unheld buffers, from the least to the most recently released
+static struct buf *lru_head = NULL, *lru_tail = NULL;
+
+static struct buf **bcache_bucket(struct rfs_device *dev, int blkno) {
+  return &bcache_hash[(((uint64)dev >> 4) + blkno) & (BCACHE_HASH_SIZE - 1)];
+}
+
+static void lru_remove(struct buf *b) {
+  if (b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+  else lru_head = b->lru_next;
+  if (b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+  else lru_tail = b->lru_prev;
+  b->lru_prev = b->lru_next = NULL;
+}
+
+static void lru_append(struct buf *b) {
+  b->lru_next = NULL;
+  b->lru_prev = lru_tail;
+  if (lru_tail) lru_tail->lru_next = b;
+  else lru_head = b;
+  lru_tail = b;
+}
+
+//
+// write a dirty buffer to its device
+//
+static int bcache_flush(struct buf *b) {
+  if (!b->dirty) return 0;
+  if (dop_write(b->dev, b->blkno, 1, b->data) != 0) return -1;
+  b->dirty = 0;
+  return 0;
+}
+
+//
+// the buffer of a block if it is cached, NULL otherwise. the buffer is not held.
+//
+static struct buf *bcache_find(struct rfs_device *dev, int blkno) {
+  for (struct buf *b = *bcache_bucket(dev, blkno); b; b = b->hash_next)
+    if (b->dev == dev && b->blkno == blkno) return b;
+  return NULL;
+}
+
+//
+// find the buffer of a block, or take one for it. the second case sets *fresh, and
+// the caller must fill the data. returns the buffer held.
+//
+static struct buf *bcache_lookup(struct rfs_device *dev, int blkno, int *fresh) {
+  struct buf **bucket = bcache_bucket(dev, blkno);
+  struct buf *b;
+
+  *fresh = 0;
+  if ((b = bcache_find(dev, blkno)) != NULL) {
+    if (b->refcnt++ == 0) lru_remove(b);
+    return b;
+  }
+
+  *fresh = 1;
+  if (bcache_nbuf < BCACHE_NBUF) {
+    // the cache is still growing
+    b = kmalloc(sizeof(struct buf));
+    b->data = alloc_page();
+    if (b->data == NULL) panic("bcache: no memory for block buffers!\n");
+    bcache_nbuf++;
+  } else {
+    // reuse the least recently released buffer
+    b = lru_head;
+    if (b == NULL) panic("bcache: all %d buffers are held!\n", BCACHE_NBUF);
+    lru_remove(b);
+    if (bcache_flush(b) != 0) panic("bcache: failed to write back block %d!\n", b->blkno);
+
+    struct buf **pp = bcache_bucket(b->dev, b->blkno);
+    while (*pp != b) pp = &(*pp)->hash_next;
+    *pp = b->hash_next;
+  }
+
+  b->dev = dev;
+  b->blkno = blkno;
+  b->dirty = 0;
+  b->refcnt = 1;
+  b->lru_prev = b->lru_next = NULL;
+  b->hash_next = *bucket;
+  *bucket = b;
+  return b;
+}
+
+//
+// get the buffer of block "blkno" of dev, with the content of the block.
+//
+struct buf *bcache_read(struct rfs_device *dev, int blkno) {
+  int fresh;
+  struct buf *b = bcache_lookup(dev, blkno, &fresh);
+  if (fresh && dop_read(dev, blkno, 1, b->data) != 0)
+    panic("bcache: failed to read block %d!\n", blkno);
+  return b;
+}
+
+//
+// get the buffer of block "blkno" of dev without reading the device, for a caller that
+// overwrites the whole block. the data is undefined unless the block was cached.
+//
+struct buf *bcache_get(struct rfs_device *dev, int blkno) {
+  int fresh;
+  return bcache_lookup(dev, blkno, &fresh);
+}
+
+//
+// the data of b was modified, write it back to the device later
+//
+void bcache_dirty(struct buf *b) {
+  b->dirty = 1;
+}
+
+//
+// drop a hold of b. the block stays cached until its buffer is reused.
+//
+void bcache_release(struct buf *b) {
+  if (b->refcnt <= 0) panic("bcache_release: block %d is not held!\n", b->blkno);
+  if (--b->refcnt == 0) lru_append(b);
+}
+
+//
+// write every dirty block of dev back to the device
+//
+int bcache_sync(struct rfs_device *dev) {
+  for (int i = 0; i < BCACHE_HASH_SIZE; i++)
+    for (struct buf *b = bcache_hash[i]; b; b = b->hash_next)
+      if (b->dev == dev && bcache_flush(b) != 0) return -1;
+  return 0;
+}
+
+//
+// copy "len" bytes of the device, from byte "off" of block blkno on, to or from "iov"
+// at its byte "pos", one segment piece at a time.
+//
+static void bcache_dev_copy(struct rfs_device *dev, int blkno, uint64 off, uint64 len,
+                            const struct io_vec *iov, uint64 pos, int write) {
+  while (len > 0) {
+    uint64 avail;
+    char *p = io_vec_at(iov, pos, &avail);
+    if (p == NULL) panic("bcache: run past the end of the I/O buffer!\n");
+    uint64 part = avail < len ? avail : len;
+    int b = blkno + off / RAMDISK_BLOCK_SIZE, o = off % RAMDISK_BLOCK_SIZE;
+    if ((write ? dop_write_at(dev, b, o, part, p) : dop_read_at(dev, b, o, part, p)) != 0)
+      panic("bcache: failed to %s block %d!\n", write ? "write" : "read", b);
+    off += part;
+    pos += part;
+    len -= part;
+  }
+}
+
+//
+// copy the "count" blocks from blkno on into "iov", from its byte "pos" on. cached
+// blocks come from their buffers (which may be newer than the device), each stretch
+// of uncached blocks is copied from the device straight into the segments of iov,
+// without going through the cache.
+//
+void bcache_read_run(struct rfs_device *dev, int blkno, int count,
+                     const struct io_vec *iov, uint64 pos) {
+  int i = 0;
+  while (i < count) {
+    struct buf *b = bcache_find(dev, blkno + i);
+    if (b) {
+      io_vec_copy_to(iov, pos + (uint64)i * RAMDISK_BLOCK_SIZE, b->data, RAMDISK_BLOCK_SIZE);
+      i++;
+      continue;
+    }
+    int n = 1;
+    while (i + n < count && bcache_find(dev, blkno + i + n) == NULL) n++;
+    bcache_dev_copy(dev, blkno + i, 0, (uint64)n * RAMDISK_BLOCK_SIZE, iov,
+                    pos + (uint64)i * RAMDISK_BLOCK_SIZE, 0);
+    i += n;
+  }
+}
+
+//
+// overwrite the "count" blocks from blkno on with "iov", from its byte "pos" on.
+// cached blocks are updated in their buffers, each stretch of uncached blocks is
+// copied from the segments of iov straight to the device.
+//
+void bcache_write_run(struct rfs_device *dev, int blkno, int count,
+                      const struct io_vec *iov, uint64 pos) {
+  int i = 0;
+  while (i < count) {
+    struct buf *b = bcache_find(dev, blkno + i);
+    if (b) {
+      io_vec_copy_from(iov, pos + (uint64)i * RAMDISK_BLOCK_SIZE, b->data, RAMDISK_BLOCK_SIZE);
+      b->dirty = 1;
+      i++;
+      continue;
+    }
+    int n = 1;
+    while (i + n < count && bcache_find(dev, blkno + i + n) == NULL) n++;
+    bcache_dev_copy(dev, blkno + i, 0, (uint64)n * RAMDISK_BLOCK_SIZE, iov,
+                    pos + (uint64)i * RAMDISK_BLOCK_SIZE, 1);
+    i += n;
+  }
+}
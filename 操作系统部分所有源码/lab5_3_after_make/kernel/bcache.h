@@ -0,0 +1,32 @@
+#ifndef _BCACHE_H_
+#define _BCACHE_H_
+
+#include "ramdev.h"
+#include "vfs.h"
+#include "util/types.h"
+
+#define BCACHE_NBUF 16       // the maximum number of cached blocks
+#define BCACHE_HASH_SIZE 16  // number of hash buckets, must be a power of two
+
+// a cached block of a RAM disk
+struct buf {
+  struct rfs_device *dev;
+  int blkno;
+  int dirty;    // data is newer than the block on the device
+  int refcnt;   // number of holders, an unheld buffer sits on the LRU list
+  char *data;   // the content of the block, one page
+  struct buf *hash_next;
+  struct buf *lru_prev, *lru_next;
+};
+
+struct buf *bcache_read(struct rfs_device *dev, int blkno);
+struct buf *bcache_get(struct rfs_device *dev, int blkno);
+void bcache_dirty(struct buf *b);
+void bcache_release(struct buf *b);
+int bcache_sync(struct rfs_device *dev);
+void bcache_read_run(struct rfs_device *dev, int blkno, int count,
+                     const struct io_vec *iov, uint64 pos);
+void bcache_write_run(struct rfs_device *dev, int blkno, int count,
+                      const struct io_vec *iov, uint64 pos);
+
+#endif
@@ -7,6 +7,7 @@
 #include "string.h"
 #include "riscv.h"
 #include "vmm.h"
+#include "vma.h"
 #include "pmm.h"
 #include "spike_interface/spike_utils.h"
 #include "util/functions.h"
@@ -92,30 +93,30 @@ elf_status elf_load(elf_ctx *ctx) {
         return EL_EIO;
     }
 
-    // record the vm region in proc->mapped_info. added @lab3_1
-    int j;
-    for( j=0; j<PGSIZE/sizeof(mapped_region); j++ ) //seek the last mapped region
-      if( (process*)(((elf_info*)(ctx->info))->p)->mapped_info[j].va == 0x0 ) break;
-
-    ((process*)(((elf_info*)(ctx->info))->p))->mapped_info[j].va = ph_addr.vaddr;
-    ((process*)(((elf_info*)(ctx->info))->p))->mapped_info[j].npages = npage;
+    // record the vm region of the segment. added @lab3_1
+    process *p = ((elf_info*)(ctx->info))->p;
+    int seg_type, prot;
 
     // SEGMENT_READABLE, SEGMENT_EXECUTABLE, SEGMENT_WRITABLE are defined in kernel/elf.h
     if( ph_addr.flags == (SEGMENT_READABLE|SEGMENT_EXECUTABLE) ){
-      ((process*)(((elf_info*)(ctx->info))->p))->mapped_info[j].seg_type = CODE_SEGMENT;
-      sprint( "CODE_SEGMENT added at mapped info offset:%d\n", j );
+      seg_type = CODE_SEGMENT;
+      prot = PROT_READ | PROT_EXEC;
+      sprint( "CODE_SEGMENT added at va:0x%lx\n", ph_addr.vaddr );
     }else if ( ph_addr.flags == (SEGMENT_READABLE|SEGMENT_WRITABLE) ){
-      ((process*)(((elf_info*)(ctx->info))->p))->mapped_info[j].seg_type = DATA_SEGMENT;
-      sprint( "DATA_SEGMENT added at mapped info offset:%d\n", j );
+      seg_type = DATA_SEGMENT;
+      prot = PROT_READ | PROT_WRITE;
+      sprint( "DATA_SEGMENT added at va:0x%lx\n", ph_addr.vaddr );
     }else if ( (ph_addr.flags & SEGMENT_WRITABLE) &&
                (ph_addr.flags & SEGMENT_READABLE) &&
                (ph_addr.flags & SEGMENT_EXECUTABLE) ){
-      ((process*)(((elf_info*)(ctx->info))->p))->mapped_info[j].seg_type = WRE_SEGMENT;
-      sprint( "WRE_SEGMENT added at mapped info offset:%d\n", j );
+      seg_type = WRE_SEGMENT;
+      prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+      sprint( "WRE_SEGMENT added at va:0x%lx\n", ph_addr.vaddr );
     }else
       panic( "unknown program segment encountered, segment flag:%d.\n", ph_addr.flags );
 
-    ((process*)(((elf_info*)(ctx->info))->p))->total_mapped_region ++;
+    if( vma_add(p, ph_addr.vaddr, ph_addr.vaddr + ph_addr.memsz, seg_type, prot) == NULL )
+      panic( "program segment at 0x%lx overlaps another one.\n", ph_addr.vaddr );
   }
 
   return EL_OK;
@@ -0,0 +1,121 @@
+/*
+ * futex-style wait/wake on a 32-bit word of user memory.
+ *
+ * waiters are kept in a hash of FIFO queues keyed by the physical address of the word,
+ * so processes that map the same page (e.g., a share page inherited over fork) wait
+ * on the same key whatever their virtual addresses are.
+ */
+
+#include "futex.h"
+#include "process.h"
+#include "sched.h"
+#include "timer.h"
+#include "config.h"
+#include "util/functions.h"
+
+// a process blocked in futex_wait()
+struct futex_waiter {
+  process *proc;
+  uint64 pa;        // the word waited on
+  uint64 deadline;  // mtime at which the wait gives up, TIMER_NO_DEADLINE if never
+  struct futex_waiter *next;
+};
+
+static struct futex_waiter *futex_hash[FUTEX_HASH_SIZE];
+
+// a process waits on at most one word, so its waiter record is indexed by pid
+static struct futex_waiter waiter_pool[NPROC];
+
+static struct futex_waiter **futex_bucket(uint64 pa) {
+  return &futex_hash[(pa >> 2) & (FUTEX_HASH_SIZE - 1)];
+}
+
+//
+// make the process of waiter w runnable again, its futex_wait() returns "ret"
+//
+static void futex_complete(struct futex_waiter *w, long ret) {
+  process *proc = w->proc;
+  proc->trapframe->regs.a0 = ret;
+  w->proc = NULL;
+  insert_to_ready_queue(proc);
+}
+
+//
+// sleep until futex_wake() is called on the word at pa, if it still holds "expected".
+// the comparison and going to sleep happen in one syscall, so a wake-up issued after
+// the value changed cannot be missed. waits at most "timeout" ticks (forever if
+// negative, not at all if 0).
+// return: 0 if woken up, 1 if the word did not hold "expected" or the timeout expired.
+//
+long futex_wait(uint64 pa, uint32 expected, int64 timeout) {
+  if (*(volatile uint32 *)pa != expected || timeout == 0) return 1;
+
+  struct futex_waiter *w = &waiter_pool[current->pid];
+  w->proc = current;
+  w->pa = pa;
+  w->deadline = timeout < 0 ? TIMER_NO_DEADLINE : timer_mtime() + timeout * TIMER_INTERVAL;
+  w->next = NULL;
+
+  struct futex_waiter **pp = futex_bucket(pa);
+  while (*pp) pp = &(*pp)->next;
+  *pp = w;
+
+  // like serial_wait, this never returns: the result is set by futex_complete()
+  do_sleep(NULL, NULL);
+  return 0;
+}
+
+//
+// wake up at most n processes waiting on the word at pa, in the order they went to
+// sleep. return: the number of processes woken up.
+//
+long futex_wake(uint64 pa, int n) {
+  long woken = 0;
+  struct futex_waiter **pp = futex_bucket(pa);
+  while (*pp && woken < n) {
+    struct futex_waiter *w = *pp;
+    if (w->pa == pa) {
+      *pp = w->next;
+      futex_complete(w, 0);
+      woken++;
+    } else {
+      pp = &w->next;
+    }
+  }
+
+  // a woken process of a higher priority class runs right away. the result goes
+  // into the trapframe first, since preempt_current() does not return then.
+  current->trapframe->regs.a0 = woken;
+  if (woken) preempt_current();
+  return woken;
+}
+
+//
+// called on timer interrupts: expire the timeouts of futex_wait() callers.
+//
+void futex_tick(void) {
+  uint64 now = timer_mtime();
+  for (int i = 0; i < FUTEX_HASH_SIZE; i++) {
+    struct futex_waiter **pp = &futex_hash[i];
+    while (*pp) {
+      struct futex_waiter *w = *pp;
+      if (w->deadline <= now) {
+        *pp = w->next;
+        futex_complete(w, 1);
+      } else {
+        pp = &w->next;
+      }
+    }
+  }
+}
+
+//
+// the earliest futex_wait() timeout, or TIMER_NO_DEADLINE.
+//
+uint64 futex_next_deadline(void) {
+  uint64 deadline = TIMER_NO_DEADLINE;
+  for (int i = 0; i < FUTEX_HASH_SIZE; i++)
+    for (struct futex_waiter *w = futex_hash[i]; w; w = w->next)
+      deadline = MIN(deadline, w->deadline);
+  return deadline;
+}
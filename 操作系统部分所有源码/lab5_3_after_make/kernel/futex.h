@@ -0,0 +1,14 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+#include "util/types.h"
+
+// number of wait-queue buckets, must be a power of two
+#define FUTEX_HASH_SIZE 64
+
+long futex_wait(uint64 pa, uint32 expected, int64 timeout);
+long futex_wake(uint64 pa, int n);
+void futex_tick(void);
+uint64 futex_next_deadline(void);
+
+#endif
@@ -3,9 +3,14 @@
  */
 #include "hostfs.h"
 
+#include <errno.h>
+
 #include "pmm.h"
+#include "riscv.h"
+#include "slab.h"
 #include "spike_interface/spike_file.h"
 #include "spike_interface/spike_utils.h"
+#include "util/functions.h"
 #include "util/string.h"
 #include "util/types.h"
 #include "vfs.h"
@@ -24,8 +29,10 @@ const struct vinode_ops hostfs_i_ops = {
 
     .viop_hook_open = hostfs_hook_open,
     .viop_hook_close = hostfs_hook_close,
+    .viop_hook_free = hostfs_hook_free,
 
     .viop_write_back_vinode = hostfs_write_back_vinode,
+    .viop_fsync = hostfs_fsync,
 
     // not implemented
     .viop_link = hostfs_link,
@@ -39,7 +46,7 @@ const struct vinode_ops hostfs_i_ops = {
 // append hostfs to the fs list.
 //
 int register_hostfs() {
-  struct file_system_type *fs_type = (struct file_system_type *)alloc_page();
+  struct file_system_type *fs_type = kmalloc(sizeof(struct file_system_type));
   fs_type->type_num = HOSTFS_TYPE;
   fs_type->get_superblock = hostfs_get_superblock;
 
@@ -71,7 +78,7 @@ struct device *init_host_device(char *name, char *hostfs_root) {
     panic("init_host_device: No HOSTFS file system found!\n");
 
   // allocate a vfs device
-  struct device *device = (struct device *)alloc_page();
+  struct device *device = kmalloc(sizeof(struct device));
   // set the device name and index
   strcpy(device->dev_name, name);
 
@@ -130,13 +137,22 @@ struct vinode *hostfs_alloc_vinode(struct super_block *sb) {
 int hostfs_write_back_vinode(struct vinode *vinode) { return 0; }
 
 //
-// populate the vfs inode of an hostfs file, according to its stats.
+// the host file of an opened hostfs file, NULL if it is not open.
+//
+static spike_file_t *hostfs_host_file(struct vinode *vinode) {
+  struct hostfs_file *hf = vinode->i_fs_info;
+  return hf ? hf->f : NULL;
+}
+
+//
+// populate the vfs inode of an hostfs file, according to the stats of the host
+// file "f". a directory cannot be opened for writing, and comes with the error
+// of that as "f".
 //
-int hostfs_update_vinode(struct vinode *vinode) {
-  spike_file_t *f = vinode->i_fs_info;
+int hostfs_update_vinode(struct vinode *vinode, spike_file_t *f) {
   if ((int64)f < 0) {  // is a direntry
     vinode->type = H_DIR;
-    return -1;
+    return 0;
   }
 
   struct stat stat;
@@ -151,6 +167,7 @@ int hostfs_update_vinode(struct vinode *vinode) {
     vinode->type = H_FILE;
   } else if (S_ISDIR(stat.st_mode)) {
     vinode->type = H_DIR;
+    return 0;
   } else if (S_ISREG(stat.st_mode)) {
     vinode->type = H_FILE;
   } else {
@@ -158,74 +175,274 @@ int hostfs_update_vinode(struct vinode *vinode) {
     return -1;
   }
 
+  if (vinode->i_fs_info == NULL) {
+    struct hostfs_file *hf = kmalloc(sizeof(struct hostfs_file));
+    memset(hf, 0, sizeof(struct hostfs_file));
+    vinode->i_fs_info = hf;
+  }
+  ((struct hostfs_file *)vinode->i_fs_info)->regular = S_ISREG(stat.st_mode);
   return 0;
 }
 
+//
+// write the dirty part of the buffer of "hf" to the host.
+// return: 0 on success, -1 on a host error.
+//
+static int hostfs_flush(struct hostfs_file *hf) {
+  while (hf->dirty_lo < hf->dirty_hi) {
+    ssize_t r = spike_file_pwrite(hf->f, hf->buf + hf->dirty_lo, hf->dirty_hi - hf->dirty_lo,
+                                  hf->buf_off + hf->dirty_lo);
+    if (r <= 0) return -1;
+    hf->dirty_lo += r;
+  }
+  hf->dirty_lo = hf->dirty_hi = 0;
+  return 0;
+}
+
+//
+// read (or write) "len" bytes of the file at "off" straight from (to) "iov", from its
+// byte "pos" on. the host accesses each segment in place.
+// return: the number of bytes transferred, -1 if the host failed at once.
+//
+static ssize_t hostfs_direct(struct hostfs_file *hf, const struct io_vec *iov, uint64 pos,
+                             uint64 len, int64 off, int write) {
+  uint64 done = 0;
+  while (done < len) {
+    uint64 avail;
+    char *p = io_vec_at(iov, pos + done, &avail);
+    uint64 part = MIN(avail, len - done);
+    ssize_t r = write ? spike_file_pwrite(hf->f, p, part, off + done)
+                      : spike_file_pread(hf->f, p, part, off + done);
+    if (r < 0) return done > 0 ? done : -1;
+    done += r;
+    if (r < part) break;
+  }
+  return done;
+}
+
+//
+// read a regular hostfs file through its buffer. a read that goes on where the last
+// one stopped fetches a whole page ahead, whole pages of a large read go straight to
+// the destination.
+//
+static ssize_t hostfs_buffered_read(struct hostfs_file *hf, const struct io_vec *iov,
+                                    int *offset) {
+  int64 off = *offset;
+  uint64 done = 0;
+  int sequential = (off == hf->ra_next), eof = 0, failed = 0;
+
+  while (done < iov->len) {
+    int64 pos = off + done;
+    if (pos >= hf->buf_off && pos < hf->buf_off + hf->buf_len) {
+      uint64 part = MIN(hf->buf_off + hf->buf_len - pos, iov->len - done);
+      io_vec_copy_to(iov, done, hf->buf + (pos - hf->buf_off), part);
+      done += part;
+      continue;
+    }
+    if (eof) break;
+
+    // the host has to see the buffered writes before it is asked
+    if (hostfs_flush(hf) != 0) {
+      failed = 1;
+      break;
+    }
+    if (iov->len - done >= PGSIZE) {
+      uint64 n = ROUNDDOWN(iov->len - done, PGSIZE);
+      ssize_t r = hostfs_direct(hf, iov, done, n, pos, 0);
+      if (r < 0) failed = 1;
+      if (r <= 0) break;
+      done += r;
+      eof = (r < n);
+      continue;
+    }
+    uint64 want = sequential ? PGSIZE : iov->len - done;
+    ssize_t r = spike_file_pread(hf->f, hf->buf, want, pos);
+    hf->buf_off = pos;
+    hf->buf_len = r > 0 ? r : 0;
+    if (r < 0) failed = 1;
+    if (r <= 0) break;
+    eof = (r < want);
+  }
+
+  if (failed && done == 0) return -1;
+  hf->ra_next = off + done;
+  *offset = off + done;
+  return done;
+}
+
+//
+// write a regular hostfs file through its buffer. writes that continue or overwrite
+// the data in the buffer gather there, and go to the host in one piece when the
+// buffer is needed for another part of the file, or on close and fsync. whole pages
+// of a large write go straight to the host.
+//
+static ssize_t hostfs_buffered_write(struct vinode *f_inode, struct hostfs_file *hf,
+                                     const struct io_vec *iov, int *offset) {
+  int64 off = *offset;
+  uint64 done = 0;
+  int failed = 0;
+
+  while (done < iov->len) {
+    int64 pos = off + done;
+    if (pos >= hf->buf_off && pos <= hf->buf_off + hf->buf_len &&
+        pos < hf->buf_off + PGSIZE) {
+      int at = pos - hf->buf_off;
+      int part = MIN(PGSIZE - at, iov->len - done);
+      io_vec_copy_from(iov, done, hf->buf + at, part);
+      if (hf->dirty_lo == hf->dirty_hi) {
+        hf->dirty_lo = at;
+        hf->dirty_hi = at + part;
+      } else {
+        hf->dirty_lo = MIN(hf->dirty_lo, at);
+        hf->dirty_hi = MAX(hf->dirty_hi, at + part);
+      }
+      hf->buf_len = MAX(hf->buf_len, at + part);
+      done += part;
+      continue;
+    }
+
+    if (hostfs_flush(hf) != 0) {
+      failed = 1;
+      break;
+    }
+    if (iov->len - done >= PGSIZE) {
+      // the buffer may hold the old data of these pages
+      uint64 n = ROUNDDOWN(iov->len - done, PGSIZE);
+      hf->buf_len = 0;
+      ssize_t r = hostfs_direct(hf, iov, done, n, pos, 1);
+      if (r < 0) failed = 1;
+      if (r <= 0) break;
+      done += r;
+      if (r < n) break;
+      continue;
+    }
+    // start gathering at pos
+    hf->buf_off = pos;
+    hf->buf_len = 0;
+  }
+
+  if (failed && done == 0) return -1;
+  f_inode->size = MAX(f_inode->size, off + done);
+  *offset = off + done;
+  return done;
+}
+
 /**** vfs-host-fs interface functions ****/
 //
-// read a hostfs file.
+// read a hostfs file. device files (e.g., the camera) are read straight from the
+// host, at the offset of the host file.
 //
-ssize_t hostfs_read(struct vinode *f_inode, char *r_buf, ssize_t len,
-                    int *offset) {
-  spike_file_t *pf = (spike_file_t *)f_inode->i_fs_info;
-  if (pf < 0) {
+ssize_t hostfs_read(struct vinode *f_inode, const struct io_vec *iov, int *offset) {
+  struct hostfs_file *hf = f_inode->i_fs_info;
+  if (hf == NULL || hf->f == NULL) {
     sprint("hostfs_read: invalid file handle!\n");
     return -1;
   }
-  int read_len = spike_file_read(pf, r_buf, len);
-  // obtain current offset
-  *offset = spike_file_lseek(pf, 0, 1);
+  if (hf->regular) {
+    if (hf->buf == NULL && (hf->buf = alloc_page()) == NULL) return -1;
+    return hostfs_buffered_read(hf, iov, offset);
+  }
+
+  // the host writes each segment in place, stop at the end of the data
+  ssize_t read_len = 0;
+  for (int i = 0; i < iov->nsegs; i++) {
+    ssize_t r = spike_file_read(hf->f, iov->segs[i].base, iov->segs[i].len);
+    if (r < 0) return read_len > 0 ? read_len : r;
+    read_len += r;
+    if (r < iov->segs[i].len) break;
+  }
+  *offset += read_len;
   return read_len;
 }
 
 //
-// write a hostfs file.
+// write a hostfs file. device files are written straight to the host.
 //
-ssize_t hostfs_write(struct vinode *f_inode, const char *w_buf, ssize_t len,
-                     int *offset) {
-  spike_file_t *pf = (spike_file_t *)f_inode->i_fs_info;
-  if (pf < 0) {
+ssize_t hostfs_write(struct vinode *f_inode, const struct io_vec *iov, int *offset) {
+  struct hostfs_file *hf = f_inode->i_fs_info;
+  if (hf == NULL || hf->f == NULL) {
     sprint("hostfs_write: invalid file handle!\n");
     return -1;
   }
-  int write_len = spike_file_write(pf, w_buf, len);
-  // obtain current offset
-  *offset = spike_file_lseek(pf, 0, 1);
+  if (hf->regular) {
+    if (hf->buf == NULL && (hf->buf = alloc_page()) == NULL) return -1;
+    return hostfs_buffered_write(f_inode, hf, iov, offset);
+  }
+
+  // the host reads each segment in place
+  ssize_t write_len = 0;
+  for (int i = 0; i < iov->nsegs; i++) {
+    ssize_t r = spike_file_write(hf->f, iov->segs[i].base, iov->segs[i].len);
+    if (r < 0) return write_len > 0 ? write_len : r;
+    write_len += r;
+    if (r < iov->segs[i].len) break;
+  }
+  *offset += write_len;
   return write_len;
 }
 
 //
-// lookup a hostfs file, and establish its vfs inode in PKE vfs.
+// push the buffered writes of a hostfs file to the host.
+//
+int hostfs_fsync(struct vinode *f_inode) {
+  struct hostfs_file *hf = f_inode->i_fs_info;
+  if (hf == NULL || hf->f == NULL || !hf->regular) return 0;
+  return hostfs_flush(hf);
+}
+
+//
+// lookup a hostfs file, and establish its vfs inode in PKE vfs. the host file is
+// only opened to learn its type and size, hostfs_hook_open opens it for real.
+// return: NULL if the host has no such file or directory.
 //
 struct vinode *hostfs_lookup(struct vinode *parent, struct dentry *sub_dentry) {
   // get complete path string
   char path[MAX_PATH_LEN];
   get_path_string(path, sub_dentry);
 
+  // directories cannot be opened for writing, they keep the error as handle
   spike_file_t *f = spike_file_open(path, O_RDWR, 0);
+  if ((int64)f < 0 && PTR_ERR(f) != -EISDIR) return NULL;
 
   struct vinode *child_inode = hostfs_alloc_vinode(parent->sb);
-  child_inode->i_fs_info = f;
-  hostfs_update_vinode(child_inode);
+  int ret = hostfs_update_vinode(child_inode, f);
+  if ((int64)f >= 0) spike_file_close(f);
+  if (ret != 0) {
+    free_vfs_vinode(child_inode);
+    return NULL;
+  }
 
   child_inode->ref = 0;
   return child_inode;
 }
 
 int hostfs_ioctl(struct vinode *f_inode, uint64 request, char *data) {
-  spike_file_t *pf = (spike_file_t *)f_inode->i_fs_info;
-  if (pf < 0) {
-    sprint("hostfs_write: invalid file handle!\n");
+  spike_file_t *pf = hostfs_host_file(f_inode);
+  if (pf == NULL) {
+    sprint("hostfs_ioctl: invalid file handle!\n");
     return -1;
   }
   return frontend_syscall(HTIFSYS_ioctl, pf->kfd, request, (uint64)data, 0, 0, 0, 0);
   //panic( "You need to call host's ioctl by frontend_syscall in lab5_3.\n" );
 }
 
+//
+// queue an ioctl into the htif batch taken by the caller, instead of making it now.
+// return: the batch slot of the call, -1 on error or if the batch is full.
+//
+int hostfs_batch_ioctl(struct vinode *f_inode, uint64 request, char *data) {
+  spike_file_t *pf = hostfs_host_file(f_inode);
+  if (pf == NULL) {
+    sprint("hostfs_batch_ioctl: invalid file handle!\n");
+    return -1;
+  }
+  return htif_batch_add(HTIFSYS_ioctl, pf->kfd, request, (uint64)data, 0, 0, 0, 0);
+}
+
 int64 hostfs_mmap(struct vinode *f_node, char *addr, uint64 length, int prot,
                     int flags, int64 offset) {
-  spike_file_t *pf = (spike_file_t *)f_node->i_fs_info;
-  if (pf < 0) {
+  spike_file_t *pf = hostfs_host_file(f_node);
+  if (pf == NULL) {
     sprint("hostfs_mmap: invalid file handle!\n");
     return -1;
   }
@@ -239,10 +456,40 @@ int hostfs_read_mmap(struct vinode *node, uint64 num, char *base_addr, char *rea
                     (uint64)buf, 0, 0, 0);
 }
 
+//
+// queue a readmmap into the htif batch taken by the caller, see hostfs_batch_ioctl.
+//
+int hostfs_batch_read_mmap(uint64 num, char *base_addr, char *read_addr, uint64 length,
+                           char *buf) {
+  return htif_batch_add(HTIFSYS_readmmap, num, (uint64)read_addr - (uint64)base_addr,
+                        length, (uint64)buf, 0, 0, 0);
+}
+
 int hostfs_munmap(struct vinode *node, uint64 num, uint64 length) {
   return frontend_syscall(HTIFSYS_munmap, num, length, 0, 0, 0, 0, 0);
 }
 
+// fcntl commands and flags as understood by the host
+#define HOST_F_GETFL 3
+#define HOST_F_SETFL 4
+#define HOST_O_NONBLOCK 04000
+
+//
+// switch a host file between blocking and non-blocking mode. the capture ring uses
+// it to poll the camera driver instead of stalling the machine inside the host call.
+//
+int hostfs_set_nonblock(struct vinode *f_inode, int nonblock) {
+  spike_file_t *pf = hostfs_host_file(f_inode);
+  if (pf == NULL) {
+    sprint("hostfs_set_nonblock: invalid file handle!\n");
+    return -1;
+  }
+  long flags = frontend_syscall(HTIFSYS_fcntl, pf->kfd, HOST_F_GETFL, 0, 0, 0, 0, 0);
+  if (flags < 0) return -1;
+  flags = nonblock ? (flags | HOST_O_NONBLOCK) : (flags & ~HOST_O_NONBLOCK);
+  return frontend_syscall(HTIFSYS_fcntl, pf->kfd, HOST_F_SETFL, flags, 0, 0, 0, 0);
+}
+
 //
 // creates a hostfs file, and establish its vfs inode. 
 //
@@ -257,9 +504,13 @@ struct vinode *hostfs_create(struct vinode *parent, struct dentry *sub_dentry) {
   }
 
   struct vinode *new_inode = hostfs_alloc_vinode(parent->sb);
-  new_inode->i_fs_info = f;
-
-  if (hostfs_update_vinode(new_inode) != 0) return NULL;
+  if (hostfs_update_vinode(new_inode, f) != 0 || new_inode->i_fs_info == NULL) {
+    spike_file_close(f);
+    free_vfs_vinode(new_inode);
+    return NULL;
+  }
+  // the file stays open for vfs_open
+  ((struct hostfs_file *)new_inode->i_fs_info)->f = f;
 
   new_inode->ref = 0;
   return new_inode;
@@ -270,13 +521,21 @@ struct vinode *hostfs_create(struct vinode *parent, struct dentry *sub_dentry) {
 //
 int hostfs_lseek(struct vinode *f_inode, ssize_t new_offset, int whence,
                   int *offset) {
-  spike_file_t *f = (spike_file_t *)f_inode->i_fs_info;
-  if (f < 0) {
+  struct hostfs_file *hf = f_inode->i_fs_info;
+  if (hf == NULL || hf->f == NULL) {
     sprint("hostfs_lseek: invalid file handle!\n");
     return -1;
   }
 
-  *offset = spike_file_lseek(f, new_offset, whence);
+  // the kernel keeps the offsets of regular files, only their end is asked for
+  if (hf->regular && whence == LSEEK_SET) {
+    *offset = new_offset;
+  } else if (hf->regular && whence == LSEEK_CUR) {
+    *offset += new_offset;
+  } else {
+    if (hf->regular && hostfs_flush(hf) != 0) return -1;
+    *offset = spike_file_lseek(hf->f, new_offset, whence);
+  }
   if (*offset >= 0)
     return 0;
   return -1;
@@ -308,7 +567,9 @@ struct vinode *hostfs_mkdir(struct vinode *parent, struct dentry *sub_dentry) {
 // open a hostfs file (after having its vfs inode).
 //
 int hostfs_hook_open(struct vinode *f_inode, struct dentry *f_dentry) {
-  if (f_inode->i_fs_info != NULL) return 0;
+  struct hostfs_file *hf = f_inode->i_fs_info;
+  if (hf == NULL) return -1;
+  if (hf->f != NULL) return 0;
 
   char path[MAX_PATH_LEN];
   get_path_string(path, f_dentry);
@@ -318,7 +579,8 @@ int hostfs_hook_open(struct vinode *f_inode, struct dentry *f_dentry) {
     return -1;
   }
 
-  f_inode->i_fs_info = f;
+  hf->f = f;
+  hf->ra_next = 0;
   return 0;
 }
 
@@ -326,15 +588,38 @@ int hostfs_hook_open(struct vinode *f_inode, struct dentry *f_dentry) {
 // close a hostfs file.
 //
 int hostfs_hook_close(struct vinode *f_inode, struct dentry *dentry) {
-  spike_file_t *f = (spike_file_t *)f_inode->i_fs_info;
-  spike_file_close(f);
-  return 0;
+  // the file stays open for the other files on it
+  if (dentry->d_ref > 1) return 0;
+
+  // the buffered writes go to the host before the file is closed
+  struct hostfs_file *hf = f_inode->i_fs_info;
+  int ret = hf->regular ? hostfs_flush(hf) : 0;
+  spike_file_close(hf->f);
+  // the vinode may stay cached, the next open gets a new handle
+  hf->f = NULL;
+  if (hf->buf) {
+    free_page(hf->buf);
+    hf->buf = NULL;
+  }
+  hf->buf_len = 0;
+  return ret;
+}
+
+//
+// drop the hostfs state of a vinode that is being freed.
+//
+void hostfs_hook_free(struct vinode *f_inode) {
+  struct hostfs_file *hf = f_inode->i_fs_info;
+  if (hf == NULL) return;
+  if (hf->buf) free_page(hf->buf);
+  kfree(hf);
+  f_inode->i_fs_info = NULL;
 }
 
 /**** vfs-hostfs file system type interface functions ****/
 struct super_block *hostfs_get_superblock(struct device *dev) {
   // set the data for the vfs super block
-  struct super_block *sb = alloc_page();
+  struct super_block *sb = kmalloc(sizeof(struct super_block));
   sb->s_dev = dev;
 
   struct vinode *root_inode = hostfs_alloc_vinode(sb);
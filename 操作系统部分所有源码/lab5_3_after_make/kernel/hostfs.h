@@ -1,6 +1,7 @@
 #ifndef _HOSTFS_H_
 #define _HOSTFS_H_
 #include "vfs.h"
+#include "spike_interface/spike_file.h"
 
 #define HOSTFS_TYPE 1
 
@@ -10,19 +11,46 @@
 
 #define MAX_HOSTFS_NUM 4
 
+// V4L2 ioctl requests are encoded as _IOWR('V', nr, size). the size field depends on
+// how the user app packs its structures, so the kernel only matches type and number.
+#define V4L2_IOC_MATCH(request, nr) (((request) & 0xffff) == (('V' << 8) | (nr)))
+#define V4L2_IOC_WITH_NR(request, nr) (((request) & ~0xffUL) | (nr))
+#define V4L2_IOC_SIZE(request) (((request) >> 16) & 0x3fff)
+#define V4L2_IOC_NR_QUERYBUF 9
+#define V4L2_IOC_NR_QBUF 15
+#define V4L2_IOC_NR_DQBUF 17
+#define V4L2_IOC_NR_STREAMON 18
+#define V4L2_IOC_NR_STREAMOFF 19
+
+// a v4l2_buffer ends with m, length, reserved2 and request_fd (4 bytes each): m.offset
+// is this many bytes before its end, however the fields in front of it are packed
+#define V4L2_BUFFER_OFFSET_END 16
+
+// the hostfs state of a file, in i_fs_info of its vinode (directories have none).
+// regular files are read and written through a one-page buffer, at offsets kept by
+// the kernel (pread/pwrite on the host). device files go straight to the host.
+struct hostfs_file {
+  spike_file_t *f;   // the host file, NULL while the file is not open
+  int regular;       // a regular file, accessed through the buffer
+  char *buf;         // one page of the file, allocated on the first access
+  int64 buf_off;     // file offset of buf[0]
+  int buf_len;       // bytes of buf that hold file data
+  int dirty_lo;      // buf[dirty_lo, dirty_hi) is not on the host yet
+  int dirty_hi;
+  int64 ra_next;     // where a read that goes on sequentially starts
+};
+
 // hostfs utility functin declarations
 int register_hostfs();
 struct device *init_host_device(char *name, char *hostfs_root);
 void get_path_string(char *path, struct dentry *dentry);
 struct vinode *hostfs_alloc_vinode(struct super_block *sb);
 int hostfs_write_back_vinode(struct vinode *vinode);
-int hostfs_update_vinode(struct vinode *vinode);
+int hostfs_update_vinode(struct vinode *vinode, spike_file_t *f);
 
 // hostfs interface function declarations
-ssize_t hostfs_read(struct vinode *f_inode, char *r_buf, ssize_t len,
-                    int *offset);
-ssize_t hostfs_write(struct vinode *f_inode, const char *w_buf, ssize_t len,
-                     int *offset);
+ssize_t hostfs_read(struct vinode *f_inode, const struct io_vec *iov, int *offset);
+ssize_t hostfs_write(struct vinode *f_inode, const struct io_vec *iov, int *offset);
 struct vinode *hostfs_lookup(struct vinode *parent, struct dentry *sub_dentry);
 struct vinode *hostfs_create(struct vinode *parent, struct dentry *sub_dentry);
 int hostfs_lseek(struct vinode *f_inode, ssize_t new_offset, int whence,
@@ -35,9 +63,15 @@ int64 hostfs_mmap(struct vinode *f_node, char *addr, uint64 length, int prot,
 int hostfs_read_mmap(struct vinode *node, uint64 num, char *base_addr, char *read_addr,
                 uint64 length, char *buf);
 int hostfs_munmap(struct vinode *node, uint64 num, uint64 length);
+int hostfs_set_nonblock(struct vinode *f_inode, int nonblock);
+int hostfs_batch_ioctl(struct vinode *f_inode, uint64 request, char *data);
+int hostfs_batch_read_mmap(uint64 num, char *base_addr, char *read_addr, uint64 length,
+                           char *buf);
+int hostfs_fsync(struct vinode *f_inode);
 
 int hostfs_hook_open(struct vinode *f_inode, struct dentry *f_dentry);
 int hostfs_hook_close(struct vinode *f_inode, struct dentry *dentry);
+void hostfs_hook_free(struct vinode *f_inode);
 int hostfs_readdir(struct vinode *dir_vinode, struct dir *dir, int *offset);
 struct vinode *hostfs_mkdir(struct vinode *parent, struct dentry *sub_dentry);
 struct super_block *hostfs_get_superblock(struct device *dev);
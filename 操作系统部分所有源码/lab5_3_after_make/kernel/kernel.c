@@ -15,6 +15,7 @@
 #include "vfs.h"
 #include "rfs.h"
 #include "ramdev.h"
+#include "serial.h"
 
 //
 // trap_sec_start points to the beginning of S-mode trap segment (i.e., the entry point of
@@ -74,6 +75,9 @@ int s_start(void) {
   // init file system, added @lab4_1
   fs_init();
 
+  // start the interrupt-driven uart transmitter
+  serial_init();
+
   sprint("Switch to user mode...\n");
   // the application code (elf) is first loaded into memory, and then put into execution
   // added @lab3_1
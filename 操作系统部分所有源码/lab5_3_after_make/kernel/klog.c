@@ -0,0 +1,155 @@
+/*
+ * the kernel log: a ring of formatted messages in memory.
+ *
+ * logging a message only formats it into the ring, it costs no host round trip. the
+ * messages not yet shown reach the console when the kernel idles, when an app asks
+ * for it (klog syscall), or right away for errors. the ring keeps the latest
+ * KLOG_SIZE bytes, which can also be written to a file.
+ */
+
+#include <stdarg.h>
+
+#include "klog.h"
+#include "timer.h"
+#include "vfs.h"
+#include "util/snprintf.h"
+#include "util/string.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+static char klog_ring[KLOG_SIZE];
+static uint64 klog_head;     // bytes ever logged, the next one goes to head % KLOG_SIZE
+static uint64 klog_shown;    // bytes ever logged that reached the console
+
+// the highest level kept for each subsystem
+static int klog_levels[KLOG_NSUBSYS] = {
+  [KLOG_SCHED] = KLOG_INFO,
+  [KLOG_TRAP] = KLOG_INFO,
+  [KLOG_PROC] = KLOG_INFO,
+  [KLOG_MM] = KLOG_INFO,
+  [KLOG_FS] = KLOG_INFO,
+};
+
+static const char *klog_subsys_names[KLOG_NSUBSYS] = {
+  [KLOG_SCHED] = "sched",
+  [KLOG_TRAP] = "trap",
+  [KLOG_PROC] = "proc",
+  [KLOG_MM] = "mm",
+  [KLOG_FS] = "fs",
+};
+
+static const char klog_level_marks[] = "EWID";
+
+//
+// append n bytes to the ring, over the oldest ones once it is full
+//
+static void klog_append(const char *s, uint64 n) {
+  for (uint64 i = 0; i < n; i++) klog_ring[(klog_head + i) & (KLOG_SIZE - 1)] = s[i];
+  klog_head += n;
+}
+
+//
+// the start of the oldest message still whole in the ring
+//
+static uint64 klog_tail(void) {
+  if (klog_head <= KLOG_SIZE) return 0;
+  uint64 tail = klog_head - KLOG_SIZE;
+  while (tail < klog_head && klog_ring[tail & (KLOG_SIZE - 1)] != '\n') tail++;
+  return tail + 1;
+}
+
+//
+// describe the ring bytes [from, klog_head) as at most two segments
+//
+static int klog_segments(uint64 from, struct io_seg segs[2]) {
+  uint64 start = from & (KLOG_SIZE - 1);
+  uint64 len = klog_head - from;
+  if (len == 0) return 0;
+
+  uint64 first = MIN(len, KLOG_SIZE - start);
+  segs[0].base = klog_ring + start;
+  segs[0].len = first;
+  if (first == len) return 1;
+  segs[1].base = klog_ring;
+  segs[1].len = len - first;
+  return 2;
+}
+
+//
+// returns non-zero if messages of "level" from "subsys" are kept, so callers can skip
+// gathering the arguments of a message that would be dropped anyway.
+//
+int klog_enabled(int subsys, int level) {
+  return subsys >= 0 && subsys < KLOG_NSUBSYS && level <= klog_levels[subsys];
+}
+
+//
+// log a message of "subsys" at "level". a line break is added if the message has none.
+//
+void klog(int subsys, int level, const char *fmt, ...) {
+  if (!klog_enabled(subsys, level)) return;
+
+  char line[KLOG_LINE_LEN];
+  int n = snprintf(line, sizeof(line), "[%ld %c %s] ", timer_mtime(),
+                   klog_level_marks[level], klog_subsys_names[subsys]);
+
+  va_list vl;
+  va_start(vl, fmt);
+  n += vsnprintf(line + n, sizeof(line) - n, fmt, vl);
+  va_end(vl);
+
+  // a cut message still gets its line break
+  if (n > KLOG_LINE_LEN - 2) n = KLOG_LINE_LEN - 2;
+  if (line[n - 1] != '\n') line[n++] = '\n';
+  klog_append(line, n);
+
+  if (level <= KLOG_ERR) klog_flush();
+}
+
+//
+// keep the messages of "subsys" up to "level" from now on.
+// return: 0 on success, -1 if subsys or level is not valid.
+//
+int klog_set_level(int subsys, int level) {
+  if (subsys < 0 || subsys >= KLOG_NSUBSYS || level < KLOG_ERR || level > KLOG_DEBUG)
+    return -1;
+  klog_levels[subsys] = level;
+  return 0;
+}
+
+//
+// write the messages not shown yet to the console, in one or two host calls.
+//
+void klog_flush(void) {
+  if (klog_shown == klog_head) return;
+
+  uint64 tail = klog_tail();
+  if (klog_shown < tail) {
+    char note[64];
+    int n = snprintf(note, sizeof(note), "klog: %ld bytes lost\n", tail - klog_shown);
+    spike_file_write(stderr, note, n);
+    klog_shown = tail;
+  }
+
+  struct io_seg segs[2];
+  int nsegs = klog_segments(klog_shown, segs);
+  for (int i = 0; i < nsegs; i++) spike_file_write(stderr, segs[i].base, segs[i].len);
+  klog_shown = klog_head;
+}
+
+//
+// write all the messages in the ring to the file at "path", creating it if needed.
+// return: the number of bytes written, -1 on error.
+//
+int klog_dump(const char *path) {
+  struct file *file = vfs_open(path, O_WRONLY | O_CREAT);
+  if (file == NULL) return -1;
+
+  uint64 tail = klog_tail();
+  struct io_seg segs[2];
+  struct io_vec iov = {segs, klog_segments(tail, segs), klog_head - tail};
+  ssize_t r = vfs_write(file, &iov);
+  vfs_close(file);
+  free_vfs_file(file);
+  return r;
+}
@@ -0,0 +1,36 @@
+#ifndef _KLOG_H_
+#define _KLOG_H_
+
+#include "util/types.h"
+
+// bytes kept by the log ring, a power of two
+#define KLOG_SIZE 16384
+// the longest message, longer ones are cut
+#define KLOG_LINE_LEN 160
+
+// log levels, a lower level is more important
+#define KLOG_ERR   0  // also flushed to the console right away
+#define KLOG_WARN  1
+#define KLOG_INFO  2
+#define KLOG_DEBUG 3
+
+// subsystems, each keeps the messages up to its own level
+#define KLOG_SCHED 0
+#define KLOG_TRAP  1
+#define KLOG_PROC  2
+#define KLOG_MM    3
+#define KLOG_FS    4
+#define KLOG_NSUBSYS 5
+
+// commands of the klog syscall
+#define KLOG_CMD_FLUSH     0  // write the messages not yet shown to the console
+#define KLOG_CMD_DUMP      1  // write the whole ring to the file at path arg0
+#define KLOG_CMD_SET_LEVEL 2  // keep the messages of subsystem arg0 up to level arg1
+
+void klog(int subsys, int level, const char *fmt, ...);
+int klog_enabled(int subsys, int level);
+int klog_set_level(int subsys, int level);
+void klog_flush(void);
+int klog_dump(const char *path);
+
+#endif
@@ -183,6 +183,10 @@ void m_start(uintptr_t hartid, uintptr_t dtb) {
   // init timing. added @lab1_3
   timerinit(hartid);
 
+  // the kernel may read all counters, apps only the time CSR (see kernel/vdso.h)
+  write_csr(mcounteren, COUNTEREN_CY | COUNTEREN_TM | COUNTEREN_IR);
+  write_csr(scounteren, COUNTEREN_TM);
+
   // switch to supervisor mode (S mode) and jump to s_start(), i.e., set pc to mepc
   asm volatile("mret");
 }
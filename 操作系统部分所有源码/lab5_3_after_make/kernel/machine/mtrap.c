@@ -17,8 +17,9 @@ static void handle_misaligned_store() { panic("Misaligned AMO!"); }
 // added @lab1_3
 static void handle_timer() {
   int cpuid = 0;
-  // setup the timer fired at next time (TIMER_INTERVAL from now)
-  *(uint64*)CLINT_MTIMECMP(cpuid) = *(uint64*)CLINT_MTIMECMP(cpuid) + TIMER_INTERVAL;
+  // turn the timer off, the S-mode handler programs the next interrupt (the next tick,
+  // or an earlier timer of kernel/timer.c)
+  *(uint64*)CLINT_MTIMECMP(cpuid) = (uint64)-1;
 
   // setup a soft interrupt in sip (S-mode Interrupt Pending) to be handled in S-mode
   write_csr(sip, SIP_SSIP);
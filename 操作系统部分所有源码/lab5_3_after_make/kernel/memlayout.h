@@ -14,6 +14,9 @@
 // virtual address of stack top of user process
 #define USER_STACK_TOP 0x7ffff000
 
+// maximum size of the user stack. the page below it is kept unmapped as a guard.
+#define USER_STACK_PAGES 16
+
 // start virtual address (4MB) of our simple heap. added @lab2_2
 #define USER_FREE_ADDRESS_START 0x00000000 + PGSIZE * 1024
 
@@ -1,3 +1,16 @@
+/*
+ * physical memory manager: a binary buddy allocator.
+ *
+ * free memory is kept as blocks of 2^order pages, aligned to their size, on one free
+ * list per order. an allocation splits the smallest block that is large enough, and
+ * a freed block is merged with its buddy as long as the buddy is free as well. both
+ * take O(PMM_MAX_ORDER) steps.
+ *
+ * allocated blocks carry a reference count, so that a page can be mapped by several
+ * processes (e.g., after a copy-on-write fork). freeing a block drops one reference,
+ * and the block goes back to the free lists with the last one.
+ */
+
 #include "pmm.h"
 #include "util/functions.h"
 #include "riscv.h"
@@ -15,50 +28,189 @@ extern uint64 g_mem_size;
 static uint64 free_mem_start_addr;  //beginning address of free memory
 static uint64 free_mem_end_addr;    //end address of free memory (not included)
 
+// a free block, linked into the free list of its order. it lives in the block itself.
 typedef struct node {
   struct node *next;
+  struct node *prev;
 } list_node;
 
-// g_free_mem_list is the head of the list of free physical memory pages
-static list_node g_free_mem_list;
+// free_area[k] is the (circular) list of free blocks of 2^k pages
+static list_node free_area[PMM_MAX_ORDER + 1];
+static uint64 free_blocks[PMM_MAX_ORDER + 1];
+
+// state of each physical page frame, indexed by its page number from DRAM_BASE.
+// the fields are only meaningful for the first page of a block.
+#define PMM_NPAGES (PKE_MAX_ALLOWABLE_RAM / PGSIZE)
+static struct {
+  uint8 order;
+  uint8 free;
+  uint16 ref;  // references to an allocated block
+} page_info[PMM_NPAGES];
+
+#define PA2PFN(pa) (((uint64)(pa) - DRAM_BASE) >> PGSHIFT)
+#define PFN2PA(pfn) ((void *)(DRAM_BASE + ((uint64)(pfn) << PGSHIFT)))
+
+static void list_insert(list_node *head, list_node *n) {
+  n->next = head->next;
+  n->prev = head;
+  head->next->prev = n;
+  head->next = n;
+}
+
+static void list_remove(list_node *n) {
+  n->prev->next = n->next;
+  n->next->prev = n->prev;
+}
 
 //
-// actually creates the freepage list. each page occupies 4KB (PGSIZE), i.e., small page.
-// PGSIZE is defined in kernel/riscv.h, ROUNDUP is defined in util/functions.h.
+// drop a reference to the block of 2^order pages at *pa. when it was the last one,
+// free the block, merging it with its free buddies.
 //
-static void create_freepage_list(uint64 start, uint64 end) {
-  g_free_mem_list.next = 0;
-  for (uint64 p = ROUNDUP(start, PGSIZE); p + PGSIZE < end; p += PGSIZE)
-    free_page( (void *)p );
+void free_pages(void *pa, int order) {
+  if (((uint64)pa % (PGSIZE << order)) != 0 || (uint64)pa < free_mem_start_addr ||
+      (uint64)pa + (PGSIZE << order) > free_mem_end_addr || order > PMM_MAX_ORDER)
+    panic("free_pages 0x%lx order %d \n", pa, order);
+
+  uint64 pfn = PA2PFN(pa);
+  if (page_info[pfn].free) panic("free_pages: double free of 0x%lx \n", pa);
+  if (page_info[pfn].ref > 1) {
+    page_info[pfn].ref--;
+    return;
+  }
+  page_info[pfn].ref = 0;
+
+  while (order < PMM_MAX_ORDER) {
+    uint64 buddy = pfn ^ (1UL << order);
+    if (buddy >= PMM_NPAGES || !page_info[buddy].free || page_info[buddy].order != order)
+      break;
+    // the buddy is free as a whole, take it off its list and merge
+    list_remove((list_node *)PFN2PA(buddy));
+    free_blocks[order]--;
+    page_info[buddy].free = 0;
+    pfn = MIN(pfn, buddy);
+    order++;
+  }
+
+  page_info[pfn].free = 1;
+  page_info[pfn].order = order;
+  list_insert(&free_area[order], (list_node *)PFN2PA(pfn));
+  free_blocks[order]++;
 }
 
 //
-// place a physical page at *pa to the free list of g_free_mem_list (to reclaim the page)
+// allocate a block of 2^order physically contiguous pages. returns NULL if no block
+// is large enough.
 //
-void free_page(void *pa) {
-  if (((uint64)pa % PGSIZE) != 0 || (uint64)pa < free_mem_start_addr || (uint64)pa >= free_mem_end_addr)
-    panic("free_page 0x%lx \n", pa);
+void *alloc_pages(int order) {
+  int k = order;
+  while (k <= PMM_MAX_ORDER && free_blocks[k] == 0) k++;
+  if (k > PMM_MAX_ORDER) return NULL;
 
-  // insert a physical page to g_free_mem_list
-  list_node *n = (list_node *)pa;
-  n->next = g_free_mem_list.next;
-  g_free_mem_list.next = n;
+  list_node *n = free_area[k].next;
+  list_remove(n);
+  free_blocks[k]--;
+  uint64 pfn = PA2PFN(n);
+  page_info[pfn].free = 0;
+
+  // split the block, giving back the upper halves until it has the requested size
+  while (k > order) {
+    k--;
+    uint64 half = pfn + (1UL << k);
+    page_info[half].free = 1;
+    page_info[half].order = k;
+    list_insert(&free_area[k], (list_node *)PFN2PA(half));
+    free_blocks[k]++;
+  }
+
+  page_info[pfn].order = order;
+  page_info[pfn].ref = 1;
+  return PFN2PA(pfn);
 }
 
 //
-// takes the first free page from g_free_mem_list, and returns (allocates) it.
-// Allocates only ONE page!
+// place a physical page at *pa to the free lists (to reclaim the page)
+//
+void free_page(void *pa) {
+  free_pages(pa, 0);
+}
+
+//
+// allocates ONE page.
 //
 void *alloc_page(void) {
-  list_node *n = g_free_mem_list.next;
-  if (n) g_free_mem_list.next = n->next;
+  return alloc_pages(0);
+}
+
+//
+// the smallest order whose block holds npages pages
+//
+int pages_to_order(uint64 npages) {
+  int order = 0;
+  while ((1UL << order) < npages) order++;
+  return order;
+}
+
+//
+// allocate npages physically contiguous pages. the pages that round the block up to
+// a power of two are given back right away, and the caller frees the pages it keeps
+// one by one with free_page.
+//
+void *alloc_pages_exact(uint64 npages) {
+  int order = pages_to_order(npages);
+  if (order > PMM_MAX_ORDER) return NULL;
+
+  char *block = alloc_pages(order);
+  if (block == NULL) return NULL;
+
+  for (uint64 i = 0; i < (1UL << order); i++) {
+    page_info[PA2PFN(block + i * PGSIZE)].order = 0;
+    page_info[PA2PFN(block + i * PGSIZE)].ref = 1;
+    if (i >= npages) free_page(block + i * PGSIZE);
+  }
+  return block;
+}
+
+//
+// take another reference to the allocated page (or block) at *pa. pages outside of
+// the managed memory, e.g., the kernel image, are not counted.
+//
+void page_ref_inc(void *pa) {
+  if ((uint64)pa < free_mem_start_addr || (uint64)pa >= free_mem_end_addr) return;
+  uint64 pfn = PA2PFN(ROUNDDOWN((uint64)pa, PGSIZE));
+  if (page_info[pfn].free) panic("page_ref_inc: 0x%lx is free \n", pa);
+  page_info[pfn].ref++;
+}
 
-  return (void *)n;
+//
+// the number of references to the allocated page (or block) at *pa
+//
+int page_ref_count(void *pa) {
+  if ((uint64)pa < free_mem_start_addr || (uint64)pa >= free_mem_end_addr) return 1;
+  return page_info[PA2PFN(ROUNDDOWN((uint64)pa, PGSIZE))].ref;
+}
+
+//
+// number of free blocks of the given order
+//
+uint64 pmm_free_blocks(int order) {
+  return free_blocks[order];
 }
 
 //
-// pmm_init() establishes the list of free physical pages according to available
-// physical memory space.
+// print the free block counts of all orders
+//
+void pmm_dump(void) {
+  uint64 total = 0;
+  sprint("free blocks per order:");
+  for (int k = 0; k <= PMM_MAX_ORDER; k++) {
+    sprint(" %ld", free_blocks[k]);
+    total += free_blocks[k] << k;
+  }
+  sprint(" (%ld free pages)\n", total);
+}
+
+//
+// pmm_init() establishes the free lists according to available physical memory space.
 //
 void pmm_init() {
   // start of kernel program segment
@@ -83,6 +235,13 @@ void pmm_init() {
     free_mem_end_addr - 1);
 
   sprint("kernel memory manager is initializing ...\n");
-  // create the list of free pages
-  create_freepage_list(free_mem_start_addr, free_mem_end_addr);
+  for (int k = 0; k <= PMM_MAX_ORDER; k++) {
+    free_area[k].next = free_area[k].prev = &free_area[k];
+    free_blocks[k] = 0;
+  }
+
+  // freeing every page lets the buddies merge into the largest aligned blocks
+  for (uint64 p = free_mem_start_addr; p + PGSIZE <= free_mem_end_addr; p += PGSIZE)
+    free_page((void *)p);
+  pmm_dump();
 }
@@ -1,11 +1,32 @@
 #ifndef _PMM_H_
 #define _PMM_H_
 
+#include "util/types.h"
+
+// largest block the buddy allocator manages: 2^PMM_MAX_ORDER pages
+#define PMM_MAX_ORDER 10
+
 // Initialize phisical memeory manager
 void pmm_init();
 // Allocate a free phisical page
 void* alloc_page();
-// Free an allocated page
+// Free an allocated page (drop a reference to it)
 void free_page(void* pa);
 
-#endif
\ No newline at end of file
+// Allocate 2^order physically contiguous pages, aligned to their size
+void *alloc_pages(int order);
+// Free a block obtained from alloc_pages with the same order (drop a reference to it)
+void free_pages(void *pa, int order);
+// take another reference to an allocated page, and count them
+void page_ref_inc(void *pa);
+int page_ref_count(void *pa);
+// Allocate npages physically contiguous pages, each of them freed with free_page
+void *alloc_pages_exact(uint64 npages);
+// the smallest order whose block holds npages pages
+int pages_to_order(uint64 npages);
+// number of free blocks of the given order
+uint64 pmm_free_blocks(int order);
+// print the free block counts of all orders
+void pmm_dump(void);
+
+#endif
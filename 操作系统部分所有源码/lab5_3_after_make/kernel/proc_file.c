@@ -5,15 +5,24 @@
 #include "proc_file.h"
 
 #include "hostfs.h"
+#include "klog.h"
 #include "pmm.h"
 #include "process.h"
 #include "ramdev.h"
 #include "rfs.h"
 #include "riscv.h"
+#include "sched.h"
+#include "slab.h"
+#include "timer.h"
+#include "vdso.h"
+#include "trace.h"
 #include "spike_interface/spike_file.h"
 #include "spike_interface/spike_utils.h"
 #include "util/functions.h"
 #include "util/string.h"
+#include "vmm.h"
+#include "vma.h"
+#include "memlayout.h"
 
 //
 // initialize file system
@@ -40,17 +49,17 @@ void fs_init(void) {
 
 //
 // initialize a proc_file_management data structure for a process.
-// return the pointer to the page containing the data structure.
+// return the pointer to the data structure.
 //
 proc_file_management *init_proc_file_management(void) {
-  proc_file_management *pfiles = (proc_file_management *)alloc_page();
+  proc_file_management *pfiles = kmalloc(sizeof(proc_file_management));
   pfiles->cwd = vfs_root_dentry; // by default, cwd is the root
   pfiles->nfiles = 0;
 
   for (int fd = 0; fd < MAX_FILES; ++fd)
     pfiles->opened_files[fd].status = FD_NONE;
 
-  sprint("FS: created a file management struct for a process.\n");
+  klog(KLOG_FS, KLOG_INFO, "FS: created a file management struct for a process.");
   return pfiles;
 }
 
@@ -59,7 +68,7 @@ proc_file_management *init_proc_file_management(void) {
 // note: this function is not used as PKE does not actually reclaim a process.
 //
 void reclaim_proc_file_management(proc_file_management *pfiles) {
-  free_page(pfiles);
+  kfree(pfiles);
   return;
 }
 
@@ -99,38 +108,42 @@ int do_open(char *pathname, int flags) {
 
   // initialize this file structure
   memcpy(pfile, opened_file, sizeof(struct file));
+  free_vfs_file(opened_file);
 
   ++current->pfiles->nfiles;
   return fd;
 }
 
 //
-// read content of a file ("fd") into "buf" for "count".
+// read content of a file ("fd") into the segments of "iov", for at most iov->len bytes.
 // return: actual length of data read from the file.
 //
-int do_read(int fd, char *buf, uint64 count) {
+int do_read(int fd, const struct io_vec *iov) {
   struct file *pfile = get_opened_file(fd);
 
   if (pfile->readable == 0) panic("do_read: no readable file!\n");
 
-  char buffer[count + 1];
-  int len = vfs_read(pfile, buffer, count);
-  buffer[count] = '\0';
-  strcpy(buf, buffer);
-  return len;
+  return vfs_read(pfile, iov);
 }
 
 //
-// write content ("buf") whose length is "count" to a file "fd".
+// write the content of the segments of "iov" to a file "fd".
 // return: actual length of data written to the file.
 //
-int do_write(int fd, char *buf, uint64 count) {
+int do_write(int fd, const struct io_vec *iov) {
   struct file *pfile = get_opened_file(fd);
 
   if (pfile->writable == 0) panic("do_write: cannot write file!\n");
 
-  int len = vfs_write(pfile, buf, count);
-  return len;
+  return vfs_write(pfile, iov);
+}
+
+//
+// push the buffered writes of file "fd" to its storage
+//
+int do_fsync(int fd) {
+  struct file *pfile = get_opened_file(fd);
+  return vfs_fsync(pfile);
 }
 
 //
@@ -158,64 +171,294 @@ int do_disk_stat(int fd, struct istat *istat) {
 }
 
 //
-// call ioctl
+// pull the current content of device buffer "index" of "fd" into the pages backing its
+// mapping in "proc". physically contiguous pages are filled by a single host call, and
+// the calls of all runs go to the host as one batch, so a frame normally costs one
+// round trip instead of one per page.
+//
+static int mmap_sync(process *proc, int fd, int index) {
+  vm_area *m = NULL;
+  for (vm_area *vma = proc->vmas; vma; vma = vma->next)
+    if (vma->seg_type == MMAP_SEGMENT && vma->fd == fd && vma->index == index) m = vma;
+  if (m == NULL) return 0;  // the buffer is not mapped, nothing to refresh
+
+  // the whole buffer is about to be written, give it memory now
+  if (vma_prepare(proc, m->start, m->length, 0) != 0) return -1;
+
+  uint64 size = ROUNDUP(m->length, PGSIZE);
+  uint64 off = 0;
+  int ret = 0;
+
+  while (off < size && ret == 0) {
+    htif_batch_begin();
+    int queued = 0;
+    while (off < size) {
+      uint64 run_pa = lookup_pa((pagetable_t)proc->pagetable, m->start + off);
+      uint64 run_len = PGSIZE;
+      while (off + run_len < size &&
+             lookup_pa((pagetable_t)proc->pagetable, m->start + off + run_len) ==
+                 run_pa + run_len)
+        run_len += PGSIZE;
+
+      // a full batch is sent off, the run goes into the next one
+      uint64 len = MIN(run_len, m->length - off);
+      if (hostfs_batch_read_mmap(m->num, (char *)m->start, (char *)m->start + off, len,
+                                 (char *)run_pa) < 0)
+        break;
+      queued++;
+      off += run_len;
+    }
+    htif_batch_submit();
+    for (int i = 0; i < queued; i++)
+      if (htif_batch_result(i) < 0) ret = -1;
+    htif_batch_end();
+  }
+  return ret;
+}
+
+// errno reported by the host when a non-blocking DQBUF finds no filled buffer
+#define HOST_EAGAIN 11
+
+//
+// requeue the buffer in "held_buf" with ioctl "requeue" (skipped if 0), then issue
+// ioctl "request" on "file", both in one host round trip.
+// returns the result of "request".
+//
+static int capture_ioctl(struct file *file, uint64 requeue, char *held_buf,
+                         uint64 request, char *data) {
+  struct vinode *node = file->f_dentry->dentry_inode;
+
+  htif_batch_begin();
+  if (requeue) hostfs_batch_ioctl(node, requeue, held_buf);
+  int slot = hostfs_batch_ioctl(node, request, data);
+  htif_batch_submit();
+  int r = slot < 0 ? -1 : htif_batch_result(slot);
+  htif_batch_end();
+  return r;
+}
+
+//
+// try to take a filled buffer from the driver of proc's capture ring, after requeueing
+// the buffer the app held with "requeue" (if not 0). on success the frame is pulled
+// into the mapped pages and the buffer is remembered as held by the app. returns the
+// ioctl result, i.e., -HOST_EAGAIN if no frame is ready yet.
+//
+static int capture_try_dequeue(process *proc, uint64 requeue) {
+  capture_ring *ring = &proc->capture;
+  struct file *pfile = &proc->pfiles->opened_files[ring->fd];
+
+  int r = capture_ioctl(pfile, requeue, ring->held_buf, ring->request, ring->data);
+  if (r < 0) return r;
+
+  // a v4l2_buffer starts with the index of the buffer
+  uint32 index = *(uint32 *)ring->data;
+  if (mmap_sync(proc, ring->fd, index) < 0) return -1;
+  memcpy(ring->held_buf, ring->data, V4L2_IOC_SIZE(ring->request));
+  ring->held = index;
+  vdso_frame_dequeued();
+  trace_event(TRACE_FRAME, index, 0);
+  return r;
+}
+
+//
+// DQBUF on a streaming device: requeue the buffer the app is done with, then take the
+// next filled one, sleeping until the driver has it.
+//
+static int capture_dequeue(uint64 request, char *data) {
+  capture_ring *ring = &current->capture;
+
+  if (V4L2_IOC_SIZE(request) > V4L2_BUFFER_MAX_SIZE) {
+    sprint("capture_dequeue: v4l2_buffer is too large!\n");
+    return -1;
+  }
+
+  uint64 requeue = 0;
+  if (ring->held >= 0) {
+    requeue = V4L2_IOC_WITH_NR(ring->request, V4L2_IOC_NR_QBUF);
+    ring->held = -1;
+  }
+
+  ring->request = request;
+  ring->data = data;
+  int r = capture_try_dequeue(current, requeue);
+  if (r != -HOST_EAGAIN) return r;
+
+  // capture_poll() completes the DQBUF and wakes us up. do_sleep never returns.
+  ring->waiting = 1;
+  do_sleep(NULL, NULL);
+  return 0;
+}
+
+//
+// called on timer ticks: complete the DQBUF of a process sleeping on its capture ring.
+// the woken process is only made READY, rrsched() lets it preempt current.
+//
+void capture_poll(void) {
+  for (int i = 0; i < NPROC; i++) {
+    capture_ring *ring = &procs[i].capture;
+    if (procs[i].status != BLOCKED || !ring->waiting) continue;
+
+    int r = capture_try_dequeue(&procs[i], 0);
+    if (r == -HOST_EAGAIN) continue;
+
+    ring->waiting = 0;
+    procs[i].trapframe->regs.a0 = r;
+    insert_to_ready_queue(&procs[i]);
+  }
+}
+
+//
+// when the driver should be polled next, or TIMER_NO_DEADLINE if nobody waits for a frame.
+//
+uint64 capture_next_deadline(void) {
+  for (int i = 0; i < NPROC; i++)
+    if (procs[i].status == BLOCKED && procs[i].capture.waiting)
+      return timer_mtime() + CAPTURE_POLL_INTERVAL;
+  return TIMER_NO_DEADLINE;
+}
+
+//
+// remember the mmap offset of the device buffer a VIDIOC_QUERYBUF described
+//
+static void capture_note_buffer(capture_ring *ring, int fd, uint64 request, char *data) {
+  uint32 index = *(uint32 *)data;
+  uint64 size = V4L2_IOC_SIZE(request);
+  if (index >= CAPTURE_MAX_BUFFERS || size < V4L2_BUFFER_OFFSET_END) return;
+
+  if (ring->buf_fd != fd) {
+    ring->buf_fd = fd;
+    ring->buf_known = 0;
+  }
+  ring->buf_offsets[index] = *(uint32 *)(data + size - V4L2_BUFFER_OFFSET_END);
+  ring->buf_known |= 1U << index;
+}
+
+//
+// the device buffer that a mapping of fd at "offset" is for, -1 if none
+//
+static int capture_buffer_at(capture_ring *ring, int fd, int64 offset) {
+  if (ring->buf_fd != fd) return -1;
+  for (int i = 0; i < CAPTURE_MAX_BUFFERS; i++)
+    if ((ring->buf_known & (1U << i)) && ring->buf_offsets[i] == offset) return i;
+  return -1;
+}
+
+//
+// end the capture ring of the streaming device "pfile": the app gets its buffers back
+// from the driver itself, which blocks again.
+//
+static void capture_stop(capture_ring *ring, struct file *pfile) {
+  if (ring->nonblock) hostfs_set_nonblock(pfile->f_dentry->dentry_inode, 0);
+  ring->fd = -1;
+  ring->held = -1;
+  ring->waiting = 0;
+  ring->nonblock = 0;
+}
+
+//
+// call ioctl. VIDIOC_QUERYBUF tells the kernel the mmap offset of each buffer,
+// VIDIOC_STREAMON switches the device to a kernel-managed capture ring, and a
+// successful VIDIOC_DQBUF refreshes the mapped frame pages, so the app reads the
+// dequeued frame in place.
 //
 int do_ioctl(int fd, uint64 request, char *data) {
   struct file *pfile = get_opened_file(fd);
-  return vfs_ioctl(pfile, request, data);
+  capture_ring *ring = &current->capture;
+
+  if (ring->fd == fd && ring->nonblock && V4L2_IOC_MATCH(request, V4L2_IOC_NR_DQBUF))
+    return capture_dequeue(request, data);
+
+  int r;
+  if (ring->fd == fd && V4L2_IOC_MATCH(request, V4L2_IOC_NR_DQBUF) && ring->held >= 0) {
+    // blocking driver: still requeue the held buffer, then wait inside the host
+    r = capture_ioctl(pfile, V4L2_IOC_WITH_NR(ring->request, V4L2_IOC_NR_QBUF),
+                      ring->held_buf, request, data);
+    ring->held = -1;
+  } else {
+    r = vfs_ioctl(pfile, request, data);
+  }
+  if (r < 0) return r;
+
+  if (V4L2_IOC_MATCH(request, V4L2_IOC_NR_QUERYBUF)) {
+    capture_note_buffer(ring, fd, request, data);
+  } else if (V4L2_IOC_MATCH(request, V4L2_IOC_NR_DQBUF)) {
+    if (mmap_sync(current, fd, *(uint32 *)data) < 0) return -1;
+    vdso_frame_dequeued();
+    trace_event(TRACE_FRAME, *(uint32 *)data, 0);
+    if (ring->fd == fd && V4L2_IOC_SIZE(request) <= V4L2_BUFFER_MAX_SIZE) {
+      ring->request = request;
+      memcpy(ring->held_buf, data, V4L2_IOC_SIZE(request));
+      ring->held = *(uint32 *)data;
+    }
+  } else if (V4L2_IOC_MATCH(request, V4L2_IOC_NR_STREAMON)) {
+    ring->fd = fd;
+    ring->held = -1;
+    ring->waiting = 0;
+    ring->nonblock = hostfs_set_nonblock(pfile->f_dentry->dentry_inode, 1) >= 0;
+  } else if (V4L2_IOC_MATCH(request, V4L2_IOC_NR_STREAMOFF) && ring->fd == fd) {
+    capture_stop(ring, pfile);
+  }
+  return r;
 }
 
 //
-// mmap file or device into memory
+// mmap file or device into memory. the region gets pages on the first access, or when
+// a frame is dequeued into it, so the app can access it with plain loads and stores.
 //
 char *do_mmap(char *addr, uint64 length, int prot, int flags, int fd, int64 offset) {
   struct file *pfile = get_opened_file(fd);
-  for (int i = 0; i < MMAP_MEM_SIZE; i++) {
-    if (current->mmap_mem[i].length == 0) {
-      int64 r = vfs_mmap(pfile, addr, length, prot, flags, offset);
-      if (r >= 0) {
-        current->mmap_mem[i].addr = current->mmap_memory_top;
-        current->mmap_memory_top += ROUNDUP(length, PGSIZE);
-        current->mmap_mem[i].length = length;
-        current->mmap_mem[i].num = r;
-        current->mmap_mem[i].fd = fd;
-        return (char *)current->mmap_mem[i].addr;
-      } else return (char *)-1;
-    }
-  }
-  return (char *)-1;
+  int64 r = vfs_mmap(pfile, addr, length, prot, flags, offset);
+  if (r < 0) return (char *)-1;
+
+  // the buffer is found by the offset VIDIOC_QUERYBUF gave for it
+  int index = capture_buffer_at(&current->capture, fd, offset);
+
+  uint64 va = vma_find_gap(current, USER_MMAP_MEMORY_START, length);
+  vm_area *vma = vma_add(current, va, va + length, MMAP_SEGMENT, prot);
+  if (vma == NULL) return (char *)-1;
+  vma->fd = fd;
+  vma->index = index;
+  vma->length = length;
+  vma->num = r;
+  return (char *)va;
 }
 
 //
-// read from mmaped memory
+// read from mmaped memory. the mapped pages already hold the latest dequeued frame,
+// so this is a plain copy kept for apps that still want a private buffer.
 //
 int do_read_mmap(char *addr, int length, char *buf) {
-  for (int i = 0; i < MMAP_MEM_SIZE; i++) {
-    if ((uint64)addr >= current->mmap_mem[i].addr
-      && (uint64)addr + length <= 
-      current->mmap_mem[i].addr + current->mmap_mem[i].length) {
-      struct file *pfile = get_opened_file(current->mmap_mem[i].fd);
-      return vfs_read_mmap(pfile, current->mmap_mem[i].num, (char *)current->mmap_mem[i].addr,
-              addr, length, buf);
-    }
+  vm_area *vma = vma_find(current, (uint64)addr);
+  if (vma == NULL || vma->seg_type != MMAP_SEGMENT ||
+      (uint64)addr + length > vma->start + vma->length)
+    return -1;
+  if (vma_prepare(current, (uint64)addr, length, 0) != 0) return -1;
+
+  int copied = 0;
+  while (copied < length) {
+    uint64 va = (uint64)addr + copied;
+    uint64 off = va - ROUNDDOWN(va, PGSIZE);
+    int len = MIN(length - copied, PGSIZE - off);
+    char *pa = (char *)lookup_pa((pagetable_t)current->pagetable, va);
+    memcpy(buf + copied, pa + off, len);
+    copied += len;
   }
-  return -1;
+  return length;
 }
 
 //
 // unmap file or device into memory
 //
 int do_munmap(char *addr, uint64 length) {
-  for (int i = 0; i < MMAP_MEM_SIZE; i++) {
-    if (current->mmap_mem[i].addr == (uint64)addr && 
-        current->mmap_mem[i].length == length) {
-      struct file *pfile = get_opened_file(current->mmap_mem[i].fd);
-      int r = vfs_munmap(pfile, current->mmap_mem[i].num, length);
-      if (r >= 0) current->mmap_mem[i].length = 0;
-      return r;
-    }
-  }
-return -1;
+  vm_area *vma = vma_find(current, (uint64)addr);
+  if (vma == NULL || vma->seg_type != MMAP_SEGMENT || vma->start != (uint64)addr ||
+      vma->length != length)
+    return -1;
+
+  // the device let go of the mapping when its fd was closed
+  int r = vma->fd < 0 ? 0 : vfs_munmap(get_opened_file(vma->fd), vma->num, length);
+  if (r >= 0) vma_remove(current, vma->start, vma->end);
+  return r;
 }
 
 //
@@ -223,6 +466,20 @@ return -1;
 //
 int do_close(int fd) {
   struct file *pfile = get_opened_file(fd);
+
+  // nothing may stay bound to fd, the next file opened gets the same slot. a device
+  // closed while streaming ends its capture ring, its mappings keep the last frame
+  // but are no longer refreshed.
+  capture_ring *ring = &current->capture;
+  if (ring->fd == fd) capture_stop(ring, pfile);
+  if (ring->buf_fd == fd) ring->buf_fd = -1;
+  for (vm_area *vma = current->vmas; vma; vma = vma->next)
+    if (vma->seg_type == MMAP_SEGMENT && vma->fd == fd) {
+      vfs_munmap(pfile, vma->num, vma->length);
+      vma->fd = -1;
+      vma->index = -1;
+    }
+
   return vfs_close(pfile);
 }
 
@@ -245,6 +502,7 @@ int do_opendir(char *pathname) {
 
   // initialize this file structure
   memcpy(pfile, opened_file, sizeof(struct file));
+  free_vfs_file(opened_file);
 
   ++current->pfiles->nfiles;
   return fd;
@@ -1,6 +1,7 @@
 #ifndef _PROC_FILE_H_
 #define _PROC_FILE_H_
 
+#include "config.h"
 #include "spike_interface/spike_file.h"
 #include "util/types.h"
 #include "vfs.h"
@@ -9,9 +10,10 @@
 // file operations
 //
 int do_open(char *pathname, int flags);
-int do_read(int fd, char *buf, uint64 count);
-int do_write(int fd, char *buf, uint64 count);
+int do_read(int fd, const struct io_vec *iov);
+int do_write(int fd, const struct io_vec *iov);
 int do_lseek(int fd, int offset, int whence);
+int do_fsync(int fd);
 int do_stat(int fd, struct istat *istat);
 int do_disk_stat(int fd, struct istat *istat);
 int do_ioctl(int fd, uint64 request, char *data);
@@ -39,6 +41,37 @@ typedef struct proc_file_management_t {
 
 proc_file_management *init_proc_file_management(void);
 
+// the largest v4l2_buffer the capture ring keeps a copy of
+#define V4L2_BUFFER_MAX_SIZE 128
+// device buffers whose mmap offset the capture ring keeps
+#define CAPTURE_MAX_BUFFERS 32
+
+// kernel-side state of a streaming capture device. once streaming is on, the kernel
+// hands the previously dequeued buffer back to the driver on every DQBUF, so all other
+// buffers stay queued and the next frame is captured while the app works on this one.
+typedef struct capture_ring_t {
+  int fd;          // streaming device, -1 if none
+  int nonblock;    // the driver is polled, so the process can sleep while it waits
+  int held;        // index of the buffer owned by the app, -1 if none
+  int waiting;     // the process sleeps until a buffer is filled
+  uint64 request;  // the app's DQBUF request, reused to requeue buffers
+  char *data;      // (physical address of) the v4l2_buffer the app dequeues into
+  char held_buf[V4L2_BUFFER_MAX_SIZE];  // v4l2_buffer of the held buffer
+
+  // the buffers of device buf_fd (-1 if none) described by VIDIOC_QUERYBUF, so that
+  // a mapping of the device can be told which buffer it is for
+  int buf_fd;
+  uint32 buf_known;  // bit i: buffer i was described
+  uint32 buf_offsets[CAPTURE_MAX_BUFFERS];  // the mmap offset of each buffer
+} capture_ring;
+
+// how often (in mtime units) the driver is polled while a process waits for a frame
+// and the kernel idles; busy, it is polled on every tick.
+#define CAPTURE_POLL_INTERVAL (TIMER_INTERVAL / 10)
+
+void capture_poll(void);
+uint64 capture_next_deadline(void);
+
 void reclaim_proc_file_management(proc_file_management *pfiles);
 
 #endif
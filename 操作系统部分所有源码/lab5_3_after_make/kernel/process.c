@@ -13,9 +13,14 @@
 #include "elf.h"
 #include "string.h"
 #include "vmm.h"
+#include "vma.h"
 #include "pmm.h"
 #include "memlayout.h"
 #include "sched.h"
+#include "timer.h"
+#include "vdso.h"
+#include "trace.h"
+#include "klog.h"
 #include "spike_interface/spike_utils.h"
 
 //Two functions defined in kernel/usertrap.S
@@ -65,6 +70,8 @@ void switch_to(process* proc) {
   // make user page table. macro MAKE_SATP is defined in kernel/riscv.h. added @lab2_1
   uint64 user_satp = MAKE_SATP(proc->pagetable);
 
+  trace_event(TRACE_TRAP_EXIT, 0, 0);
+
   // return_to_user() is defined in kernel/strap_vector.S. switch to user mode with sret.
   // note, return_to_user takes two parameters @ and after lab2_1.
   return_to_user(proc->trapframe, user_satp);
@@ -107,65 +114,46 @@ process* alloc_process() {
   memset((void *)procs[i].pagetable, 0, PGSIZE);
 
   procs[i].kstack = (uint64)alloc_page() + PGSIZE;   //user kernel stack top
-  uint64 user_stack = (uint64)alloc_page();       //phisical address of user stack bottom
   procs[i].trapframe->regs.sp = USER_STACK_TOP;  //virtual address of user stack top
 
-  // allocates a page to record memory regions (segments)
-  procs[i].mapped_info = (mapped_region*)alloc_page();
-  memset( procs[i].mapped_info, 0, PGSIZE );
-
-  // map user stack in userspace
-  user_vm_map((pagetable_t)procs[i].pagetable, USER_STACK_TOP - PGSIZE, PGSIZE,
-    user_stack, prot_to_type(PROT_WRITE | PROT_READ, 1));
-  procs[i].mapped_info[STACK_SEGMENT].va = USER_STACK_TOP - PGSIZE;
-  procs[i].mapped_info[STACK_SEGMENT].npages = 1;
-  procs[i].mapped_info[STACK_SEGMENT].seg_type = STACK_SEGMENT;
-
   // map trapframe in user space (direct mapping as in kernel space).
   user_vm_map((pagetable_t)procs[i].pagetable, (uint64)procs[i].trapframe, PGSIZE,
     (uint64)procs[i].trapframe, prot_to_type(PROT_WRITE | PROT_READ, 0));
-  procs[i].mapped_info[CONTEXT_SEGMENT].va = (uint64)procs[i].trapframe;
-  procs[i].mapped_info[CONTEXT_SEGMENT].npages = 1;
-  procs[i].mapped_info[CONTEXT_SEGMENT].seg_type = CONTEXT_SEGMENT;
 
   // map S-mode trap vector section in user space (direct mapping as in kernel space)
   // we assume that the size of usertrap.S is smaller than a page.
   user_vm_map((pagetable_t)procs[i].pagetable, (uint64)trap_sec_start, PGSIZE,
     (uint64)trap_sec_start, prot_to_type(PROT_READ | PROT_EXEC, 0));
-  procs[i].mapped_info[SYSTEM_SEGMENT].va = (uint64)trap_sec_start;
-  procs[i].mapped_info[SYSTEM_SEGMENT].npages = 1;
-  procs[i].mapped_info[SYSTEM_SEGMENT].seg_type = SYSTEM_SEGMENT;
 
-  sprint("in alloc_proc. user frame 0x%lx, user stack 0x%lx, user kstack 0x%lx \n",
+  // the kernel status page, read-only for the app
+  vdso_map(&procs[i]);
+
+  klog(KLOG_PROC, KLOG_INFO,
+    "in alloc_proc. user frame 0x%lx, user stack 0x%lx, user kstack 0x%lx",
     procs[i].trapframe, procs[i].trapframe->regs.sp, procs[i].kstack);
 
-  // initialize the process's heap manager
+  // the user stack and the guard page below it. stack pages are mapped on demand.
+  procs[i].vmas = NULL;
+  uint64 stack_bottom = USER_STACK_TOP - USER_STACK_PAGES * PGSIZE;
+  vma_add(&procs[i], stack_bottom, USER_STACK_TOP, STACK_SEGMENT, PROT_READ | PROT_WRITE);
+  vma_add(&procs[i], stack_bottom - PGSIZE, stack_bottom, GUARD_SEGMENT, PROT_NONE);
+
+  // initialize the process's heap manager. heap regions are added as the heap grows.
   procs[i].user_heap.heap_top = USER_FREE_ADDRESS_START;
   procs[i].user_heap.heap_bottom = USER_FREE_ADDRESS_START;
-  procs[i].user_heap.free_pages_count = 0;
-
-  // map user heap in userspace
-  procs[i].mapped_info[HEAP_SEGMENT].va = USER_FREE_ADDRESS_START;
-  procs[i].mapped_info[HEAP_SEGMENT].npages = 0;  // no pages are mapped to heap yet.
-  procs[i].mapped_info[HEAP_SEGMENT].seg_type = HEAP_SEGMENT;
-
-  // initialize the process's shared memory starting address
-  procs[i].share_memory_top = USER_SHARE_MEMORY_START;
 
-  // map user share memory in userspace
-  procs[i].mapped_info[SHARE_SEGMENT].va = USER_SHARE_MEMORY_START;
-  procs[i].mapped_info[SHARE_SEGMENT].npages = 0;
-  procs[i].mapped_info[SHARE_SEGMENT].seg_type = SHARE_SEGMENT;
+  memset(&procs[i].capture, 0, sizeof(capture_ring));
+  procs[i].capture.fd = -1;
+  procs[i].capture.held = -1;
+  procs[i].capture.buf_fd = -1;
 
-  procs[i].total_mapped_region = 5;
-
-  // initialize the process's mmap memory starting address
-  procs[i].mmap_memory_top = USER_MMAP_MEMORY_START;
-  memset(procs[i].mmap_mem, 0, MMAP_MEM_SIZE * sizeof(mmap_t));
+  // a new process starts in the normal priority class
+  procs[i].priority = SCHED_PRIO_NORMAL;
+  procs[i].on_ready_queue = 0;
 
   // initialize files_struct
   procs[i].pfiles = init_proc_file_management();
-  sprint("in alloc_proc. build proc_file_management successfully.\n");
+  klog(KLOG_PROC, KLOG_INFO, "in alloc_proc. build proc_file_management successfully.");
 
   // return after initialization.
   return &procs[i];
@@ -180,6 +168,7 @@ int free_process( process* proc ) {
   // but for proxy kernel, it (memory leaking) may NOT be a really serious issue,
   // as it is different from regular OS, which needs to run 7x24.
   proc->status = ZOMBIE;
+  timer_release(proc->pid);
 
   return 0;
 }
@@ -187,129 +176,24 @@ int free_process( process* proc ) {
 //
 // implements fork syscal in kernel. added @lab3_1
 // basic idea here is to first allocate an empty process (child), then duplicate the
-// context and data segments of parent process to the child, and lastly, map other
-// segments (code, system) of the parent to child. the stack segment remains unchanged
-// for the child.
+// context of parent process to the child, and lastly, give the regions of the parent
+// to the child. writable pages (stack, heap, data) are shared copy-on-write, so a
+// page is only copied when one of the two processes writes to it.
 //
 int do_fork( process* parent)
 {
-  sprint( "will fork a child from parent %d.\n", parent->pid );
+  klog( KLOG_PROC, KLOG_INFO, "will fork a child from parent %d.", parent->pid );
   process* child = alloc_process();
 
-  for( int i=0; i<parent->total_mapped_region; i++ ){
-    // browse parent's vm space, and copy its trapframe and data segments,
-    // map its code segment.
-    switch( parent->mapped_info[i].seg_type ){
-      case CONTEXT_SEGMENT:
-        *child->trapframe = *parent->trapframe;
-        break;
-      case STACK_SEGMENT:
-        memcpy( (void*)lookup_pa(child->pagetable, child->mapped_info[STACK_SEGMENT].va),
-          (void*)lookup_pa(parent->pagetable, parent->mapped_info[i].va), PGSIZE );
-        break;
-      case HEAP_SEGMENT:{
-        // build a same heap for child process.
-
-        // convert free_pages_address into a filter to skip reclaimed blocks in the heap
-        // when mapping the heap blocks
-        int free_block_filter[MAX_HEAP_PAGES];
-        memset(free_block_filter, 0, MAX_HEAP_PAGES);
-        uint64 heap_bottom = parent->user_heap.heap_bottom;
-        for (int i = 0; i < parent->user_heap.free_pages_count; i++) {
-          int index = (parent->user_heap.free_pages_address[i] - heap_bottom) / PGSIZE;
-          free_block_filter[index] = 1;
-        }
-
-        // copy and map the heap blocks
-        for (uint64 heap_block = current->user_heap.heap_bottom;
-             heap_block < current->user_heap.heap_top; heap_block += PGSIZE) {
-          if (free_block_filter[(heap_block - heap_bottom) / PGSIZE])  // skip free blocks
-            continue;
-
-          void* child_pa = alloc_page();
-          memcpy(child_pa, (void*)lookup_pa(parent->pagetable, heap_block), PGSIZE);
-          user_vm_map((pagetable_t)child->pagetable, heap_block, PGSIZE, (uint64)child_pa,
-                      prot_to_type(PROT_WRITE | PROT_READ, 1));
-        }
-
-        child->mapped_info[HEAP_SEGMENT].npages = parent->mapped_info[HEAP_SEGMENT].npages;
-
-        // copy the heap manager from parent to child
-        memcpy((void*)&child->user_heap, (void*)&parent->user_heap, sizeof(parent->user_heap));
-        break;
-      }
-      case CODE_SEGMENT:{
-        // TODO (lab3_1): implment the mapping of child code segment to parent's
-        // code segment.
-        // hint: the virtual address mapping of code segment is tracked in mapped_info
-        // page of parent's process structure. use the information in mapped_info to
-        // retrieve the virtual to physical mapping of code segment.
-        // after having the mapping information, just map the corresponding virtual
-        // address region of child to the physical pages that actually store the code
-        // segment of parent process.
-        // DO NOT COPY THE PHYSICAL PAGES, JUST MAP THEM.
-        //找到父页进程code段的物理地址
-        uint64 pa = lookup_pa(parent->pagetable,parent->mapped_info[i].va);
-        pa = pa + ((parent->mapped_info[i].va) & ((1<<PGSHIFT) -1));
-        //子进程中对应的逻辑地址空间映射到其父进程中装载代码段的物理页面
-        user_vm_map(child->pagetable, parent->mapped_info[i].va,PGSIZE, pa, prot_to_type(PROT_EXEC | PROT_READ, 1));
-        // panic( "You need to implement the code segment mapping of child in lab3_1.\n" );
-      }
-
-        // after mapping, register the vm region (do not delete codes below!)
-        child->mapped_info[child->total_mapped_region].va = parent->mapped_info[i].va;
-        child->mapped_info[child->total_mapped_region].npages =
-          parent->mapped_info[i].npages;
-        child->mapped_info[child->total_mapped_region].seg_type = CODE_SEGMENT;
-        child->total_mapped_region++;
-        break;
-      case DATA_SEGMENT:
-        for( int j=0; j<parent->mapped_info[i].npages; j++ ){
-            uint64 addr = lookup_pa(parent->pagetable, parent->mapped_info[i].va+j*PGSIZE);
-            char *newaddr = alloc_page(); memcpy(newaddr, (void *)addr, PGSIZE);
-            map_pages(child->pagetable, parent->mapped_info[i].va+j*PGSIZE, PGSIZE,
-                    (uint64)newaddr, prot_to_type(PROT_WRITE | PROT_READ, 1));
-        }
-
-        // after mapping, register the vm region (do not delete codes below!)
-        child->mapped_info[child->total_mapped_region].va = parent->mapped_info[i].va;
-        child->mapped_info[child->total_mapped_region].npages = 
-            parent->mapped_info[i].npages;
-        child->mapped_info[child->total_mapped_region].seg_type = DATA_SEGMENT;
-        child->total_mapped_region++;
-        break;
-      case WRE_SEGMENT:
-        for( int j=0; j<parent->mapped_info[i].npages; j++ ){
-            uint64 addr = lookup_pa(parent->pagetable, parent->mapped_info[i].va+j*PGSIZE);
-            char *newaddr = alloc_page(); memcpy(newaddr, (void *)addr, PGSIZE);
-            map_pages(child->pagetable, parent->mapped_info[i].va+j*PGSIZE, PGSIZE,
-                    (uint64)newaddr, prot_to_type(PROT_WRITE | PROT_READ | PROT_EXEC, 1));
-        }
-
-        // after mapping, register the vm region (do not delete codes below!)
-        child->mapped_info[child->total_mapped_region].va = parent->mapped_info[i].va;
-        child->mapped_info[child->total_mapped_region].npages = 
-            parent->mapped_info[i].npages;
-        child->mapped_info[child->total_mapped_region].seg_type = WRE_SEGMENT;
-        child->total_mapped_region++;
-        break;
-      case SHARE_SEGMENT:
-        for (uint64 share_block = parent->mapped_info[SHARE_SEGMENT].va;
-              share_block < parent->share_memory_top; share_block += PGSIZE) {
-          uint64 pa = lookup_pa(parent->pagetable, share_block);
-          map_pages(child->pagetable, share_block, PGSIZE,
-            pa, prot_to_type(PROT_WRITE | PROT_READ, 1));
-        }
-
-        child->mapped_info[SHARE_SEGMENT].npages = parent->mapped_info[i].npages;
-        child->share_memory_top = parent->share_memory_top;
-        break;
-    }
-  }
+  // copy the context, and share the memory regions
+  *child->trapframe = *parent->trapframe;
+  if (vma_fork(parent, child) != 0) panic("do_fork: cannot duplicate the vm space.\n");
+  child->user_heap = parent->user_heap;
 
   child->status = READY;
   child->trapframe->regs.a0 = 0;
   child->parent = parent;
+  child->priority = parent->priority;
   insert_to_ready_queue( child );
 
   return child->pid;
@@ -322,18 +206,17 @@ void do_sleep(void wake_cb(void*), void* wake_cb_arg){
   schedule();
 }
 
-extern process* ready_queue_head;
-
+//
+// make process pid READY. the caller keeps running unless the woken process has a
+// higher priority; current may also be BLOCKED here, when the kernel is idle.
+//
 void do_wake(uint64 pid){
-  procs[pid].status = READY;
-  current->status = READY;
   insert_to_ready_queue(&procs[pid]);
-  insert_to_ready_queue( current );
 
   if (procs[pid].wake_callback)
     procs[pid].wake_callback(procs[pid].wake_callback_arg);
 
-  schedule();
+  preempt_current();
 }
 
 void set_wake_callback(uint64 pid, void (*wake_cb)(void *), void *wake_cb_arg) {
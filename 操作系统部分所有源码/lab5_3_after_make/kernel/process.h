@@ -21,10 +21,6 @@ typedef struct trapframe_t {
 
 // riscv-pke kernel supports at most 32 processes
 #define NPROC 32
-// maximum number of pages in a process's heap
-#define MAX_HEAP_PAGES 32
-// maximum number of memory map regions in a process
-#define MMAP_MEM_SIZE 2
 
 // possible status of a process
 enum proc_status {
@@ -45,32 +41,35 @@ enum segment_type {
   CODE_SEGMENT,    // ELF segment
   DATA_SEGMENT,    // ELF segment
   WRE_SEGMENT,     // ELF segment
+  MMAP_SEGMENT,    // file or device mapped by mmap
+  GUARD_SEGMENT,   // inaccessible page below the stack
 };
 
-// the VM regions mapped to a user process
-typedef struct mapped_region {
-  uint64 va;       // mapped virtual address
-  uint32 npages;   // mapping_info is unused if npages == 0
-  uint32 seg_type; // segment type, one of the segment_types
-} mapped_region;
+// a region [start, end) of the user address space. its pages are allocated and
+// mapped on the first access (see kernel/vma.c).
+typedef struct vm_area_t {
+  uint64 start;
+  uint64 end;
+  uint32 seg_type;  // segment type, one of the segment_types
+  int prot;         // PROT_READ, PROT_WRITE and PROT_EXEC allowed to user accesses
+
+  // file or device mapped by mmap (MMAP_SEGMENT only), fd is -1 once it is closed
+  int fd;
+  int index;        // the device buffer it maps, -1 if none (see capture_buffer_at)
+  uint64 length, num;
+
+  // next region, in ascending address order
+  struct vm_area_t *next;
+} vm_area;
 
 typedef struct process_heap_manager {
-  // points to the last free page in our simple heap.
+  // points to the end of our simple heap. pages freed below it are holes in the
+  // heap regions, reused before the heap grows.
   uint64 heap_top;
   // points to the bottom of our simple heap.
   uint64 heap_bottom;
-
-  // the address of free pages in the heap
-  uint64 free_pages_address[MAX_HEAP_PAGES];
-  // the number of free pages in the heap
-  uint32 free_pages_count;
 }process_heap_manager;
 
-typedef struct mmap_t{
-  uint64 addr, length, num;
-  int fd;
-}mmap_t;
-
 // the extremely simple definition of process, used for begining labs of PKE
 typedef struct process_t {
   // pointing to the stack used in trap handling.
@@ -80,10 +79,8 @@ typedef struct process_t {
   // trapframe storing the context of a (User mode) process.
   trapframe* trapframe;
 
-  // points to a page that contains mapped_regions. below are added @lab3_1
-  mapped_region *mapped_info;
-  // next free mapped region in mapped_info
-  int total_mapped_region;
+  // regions of the user address space, sorted by address. added @lab3_1
+  vm_area *vmas;
 
   // heap management
   process_heap_manager user_heap;
@@ -96,6 +93,10 @@ typedef struct process_t {
   struct process_t *parent;
   // next queue element
   struct process_t *queue_next;
+  // priority class, one of sched_priority (see kernel/sched.h)
+  int priority;
+  // non-zero while the process is linked in a ready queue
+  int on_ready_queue;
 
   // accounting. added @lab3_3
   int tick_count;
@@ -108,12 +109,8 @@ typedef struct process_t {
   void (*wake_callback)(void *);
   void *wake_callback_arg;
 
-  // shared memory. added @lab5_3
-  uint64 share_memory_top;
-
-  // mmap memory. added @lab5_3
-  uint64 mmap_memory_top;
-  mmap_t mmap_mem[MMAP_MEM_SIZE];
+  // kernel-managed capture buffers of a streaming device
+  capture_ring capture;
 }process;
 
 // switch to run user app
@@ -140,9 +137,4 @@ void do_wake(uint64 pid);
 void set_wake_callback(uint64 pid, void (*wake_cb)(void *), void *wake_cb_arg);
 
 extern process procs[NPROC];
-
-struct update_uartvalue_ctx {
-  char uartvalue;
-  uint64 pid;
-};
 #endif
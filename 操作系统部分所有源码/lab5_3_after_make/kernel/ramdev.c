@@ -5,6 +5,7 @@
 #include "ramdev.h"
 #include "vfs.h"
 #include "pmm.h"
+#include "slab.h"
 #include "riscv.h"
 #include "util/types.h"
 #include "util/string.h"
@@ -14,24 +15,25 @@
 struct rfs_device *rfs_device_list[MAX_RAMDISK_COUNT];
 
 //
-// write the content stored in "buff" to the "blkno"^th block of disk.
+// write "len" bytes stored in "buf" to the disk, from byte "off" of the "blkno"^th block on.
 //
-int ramdisk_write(struct rfs_device *rfs_device, int blkno){
-  if ( blkno < 0 || blkno >= RAMDISK_BLOCK_COUNT )
+int ramdisk_write(struct rfs_device *rfs_device, int blkno, int off, uint64 len,
+                  const void *buf){
+  uint64 start = (uint64)blkno * RAMDISK_BLOCK_SIZE + off;
+  if ( blkno < 0 || off < 0 || start + len > (uint64)RAMDISK_BLOCK_COUNT * RAMDISK_BLOCK_SIZE )
     panic("ramdisk_write: write block No %d out of range!\n", blkno);
-  void * dst = (void *)((uint64)rfs_device->d_address + blkno * RAMDISK_BLOCK_SIZE);
-  memcpy(dst, rfs_device->iobuffer, RAMDISK_BLOCK_SIZE);
+  memcpy((char *)rfs_device->d_address + start, buf, len);
   return 0;
 }
 
 //
-// read the "blkno"^th block from the RAM disk and store its content into buffer.
+// read "len" bytes from the RAM disk, from byte "off" of the "blkno"^th block on, into "buf".
 //
-int ramdisk_read(struct rfs_device *rfs_device, int blkno){
-  if ( blkno < 0 || blkno >= RAMDISK_BLOCK_COUNT )
+int ramdisk_read(struct rfs_device *rfs_device, int blkno, int off, uint64 len, void *buf){
+  uint64 start = (uint64)blkno * RAMDISK_BLOCK_SIZE + off;
+  if ( blkno < 0 || off < 0 || start + len > (uint64)RAMDISK_BLOCK_COUNT * RAMDISK_BLOCK_SIZE )
     panic("ramdisk_read: read block No out of range!\n");
-  void * src = (void *)((uint64)rfs_device->d_address + blkno * RAMDISK_BLOCK_SIZE);
-  memcpy(rfs_device->iobuffer, src, RAMDISK_BLOCK_SIZE);
+  memcpy(buf, (char *)rfs_device->d_address + start, len);
   return 0;
 }
 
@@ -52,18 +54,11 @@ struct device *init_rfs_device(const char *dev_name) {
     panic("No RFS file system found!\n");
   }
 
-  // alloc blocks for the RAM Disk
-  void *curr_addr = NULL;
-  void *last_addr = NULL;
-  void *ramdisk_addr = NULL;
-  for ( int i = 0; i < RAMDISK_BLOCK_COUNT; ++ i ){
-    last_addr = curr_addr;
-    curr_addr = alloc_page();
-    if ( last_addr != NULL && last_addr - curr_addr != PGSIZE ){
-      panic("RAM Disk0: address is discontinuous!\n");
-    }
+  // alloc blocks for the RAM Disk, in one physically contiguous run
+  void *ramdisk_addr = alloc_pages_exact(RAMDISK_BLOCK_COUNT);
+  if (ramdisk_addr == NULL) {
+    panic("RAM Disk0: no contiguous memory for %d blocks!\n", RAMDISK_BLOCK_COUNT);
   }
-  ramdisk_addr = curr_addr;
 
   // find a free rfs device
   struct rfs_device **rfs_device = NULL;
@@ -79,16 +74,15 @@ struct device *init_rfs_device(const char *dev_name) {
     panic("RAM Disk0: no free device!\n");
   }
   
-  *rfs_device = (struct rfs_device *)alloc_page();
+  *rfs_device = kmalloc(sizeof(struct rfs_device));
   (*rfs_device)->d_blocks = RAMDISK_BLOCK_COUNT;
   (*rfs_device)->d_blocksize = RAMDISK_BLOCK_SIZE;
   (*rfs_device)->d_write = ramdisk_write;
   (*rfs_device)->d_read = ramdisk_read;
   (*rfs_device)->d_address = ramdisk_addr;
-  (*rfs_device)->iobuffer = alloc_page();
 
   // allocate a vfs device
-  struct device * device = (struct device *)alloc_page();
+  struct device * device = kmalloc(sizeof(struct device));
   // set the device name and index
   strcpy(device->dev_name, dev_name);
   device->dev_id = device_id;
@@ -16,13 +16,21 @@ struct rfs_device {
   void *d_address;  // the ramdisk base address
   int d_blocks;     // the number of blocks of the device
   int d_blocksize;  // the blocksize (bytes) per block
-  void *iobuffer;   // iobuffer for write/read
-  int (*d_write)(struct rfs_device *rdev, int blkno);  // device write funtion
-  int (*d_read)(struct rfs_device *rdev, int blkno); // device read funtion
+  // device write/read funtions, for "len" bytes from byte "off" of block blkno on.
+  // the range may run into the following blocks.
+  int (*d_write)(struct rfs_device *rdev, int blkno, int off, uint64 len, const void *buf);
+  int (*d_read)(struct rfs_device *rdev, int blkno, int off, uint64 len, void *buf);
 };
 
-#define dop_write(rdev, blkno) ((rdev)->d_write(rdev, blkno))
-#define dop_read(rdev, blkno)  ((rdev)->d_read(rdev, blkno))
+// whole blocks are copied between the device and the block cache (bcache.c). runs of
+// blocks that bypass the cache are copied piecewise, straight to or from the segments
+// of the I/O buffer.
+#define dop_write(rdev, blkno, count, buf) \
+  ((rdev)->d_write(rdev, blkno, 0, (uint64)(count) * (rdev)->d_blocksize, buf))
+#define dop_read(rdev, blkno, count, buf) \
+  ((rdev)->d_read(rdev, blkno, 0, (uint64)(count) * (rdev)->d_blocksize, buf))
+#define dop_write_at(rdev, blkno, off, len, buf) ((rdev)->d_write(rdev, blkno, off, len, buf))
+#define dop_read_at(rdev, blkno, off, len, buf)  ((rdev)->d_read(rdev, blkno, off, len, buf))
 
 struct device *init_rfs_device(const char *dev_name);
 struct rfs_device *alloc_rfs_device(void);
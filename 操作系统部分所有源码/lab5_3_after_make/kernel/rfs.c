@@ -3,18 +3,21 @@
  * RAM disk. added @lab4_1.
  * Layout of the file system:
  *
- * ******** RFS MEM LAYOUT (112 BLOCKS) ****************
+ * ******** RFS MEM LAYOUT (128 BLOCKS) ****************
  *   superblock  |  disk inodes  |  bitmap  |  free blocks  *
- *     1 block   |   10 blocks   |     1    |     100       *
+ *     1 block   |   10 blocks   |     1    |  the rest     *
  * *****************************************************
  *
  * The disk layout of rfs is similar to the fs in xv6.
  */
 #include "rfs.h"
 
+#include "bcache.h"
 #include "pmm.h"
 #include "ramdev.h"
+#include "slab.h"
 #include "spike_interface/spike_utils.h"
+#include "util/functions.h"
 #include "util/string.h"
 #include "vfs.h"
 
@@ -37,7 +40,9 @@ const struct vinode_ops rfs_i_ops = {
     .viop_mkdir = rfs_mkdir,
 
     .viop_write_back_vinode = rfs_write_back_vinode,
+    .viop_fsync = rfs_fsync,
 
+    .viop_hook_close = rfs_hook_close,
     .viop_hook_opendir = rfs_hook_opendir,
     .viop_hook_closedir = rfs_hook_closedir,
 };
@@ -47,7 +52,7 @@ const struct vinode_ops rfs_i_ops = {
 // register rfs to the fs list supported by PKE.
 //
 int register_rfs() {
-  struct file_system_type *fs_type = (struct file_system_type *)alloc_page();
+  struct file_system_type *fs_type = kmalloc(sizeof(struct file_system_type));
   fs_type->type_num = RFS_TYPE;
   fs_type->get_superblock = rfs_get_superblock;
 
@@ -68,34 +73,34 @@ int rfs_format_dev(struct device *dev) {
 
   // ** first, format the superblock
   // build a new superblock
-  struct super_block *super = (struct super_block *)rdev->iobuffer;
+  struct buf *b = bcache_get(rdev, RFS_BLK_OFFSET_SUPER);
+  memset(b->data, 0, RFS_BLKSIZE);
+  struct rfs_superblock *super = (struct rfs_superblock *)b->data;
   super->magic = RFS_MAGIC;
-  super->size =
-      1 + RFS_MAX_INODE_BLKNUM + 1 + RFS_MAX_INODE_BLKNUM * RFS_DIRECT_BLKNUM;
-  // only direct index blocks
-  super->nblocks = RFS_MAX_INODE_BLKNUM * RFS_DIRECT_BLKNUM;
+  // every block after the bitmap is a data block, as many as one bitmap block covers
+  super->nblocks = MIN(rdev->d_blocks - RFS_BLK_OFFSET_FREE, RFS_BLKSIZE * 8);
+  super->size = RFS_BLK_OFFSET_FREE + super->nblocks;
   super->ninodes = RFS_BLKSIZE / RFS_INODESIZE * RFS_MAX_INODE_BLKNUM;
 
-  // write the superblock to RAM Disk0
-  if (rfs_w1block(rdev, RFS_BLK_OFFSET_SUPER) != 0)  // write to device
-    panic("RFS: failed to write superblock!\n");
+  // the superblock goes to RAM Disk0 with the next sync (or when its buffer is reused)
+  bcache_dirty(b);
+  bcache_release(b);
 
   // ** second, set up the inodes and write them to RAM disk
-  // build an empty inode disk block which has RFS_BLKSIZE/RFS_INODESIZE(=32)
-  // disk inodes
-  struct rfs_dinode *p_dinode = (struct rfs_dinode *)rdev->iobuffer;
-  for (int i = 0; i < RFS_BLKSIZE / RFS_INODESIZE; ++i) {
-    p_dinode->size = 0;
-    p_dinode->type = R_FREE;
-    p_dinode->nlinks = 0;
-    p_dinode->blocks = 0;
-    p_dinode = (struct rfs_dinode *)((char *)p_dinode + RFS_INODESIZE);
-  }
-
-  // write RFS_MAX_INODE_BLKNUM(=10) empty inode disk blocks to RAM Disk0
+  // build RFS_MAX_INODE_BLKNUM(=10) empty inode disk blocks, each of which has
+  // RFS_BLKSIZE/RFS_INODESIZE(=32) disk inodes
   for (int inode_block = 0; inode_block < RFS_MAX_INODE_BLKNUM; ++inode_block) {
-    if (rfs_w1block(rdev, RFS_BLK_OFFSET_INODE + inode_block) != 0)
-      panic("RFS: failed to initialize empty inodes!\n");
+    b = bcache_get(rdev, RFS_BLK_OFFSET_INODE + inode_block);
+    struct rfs_dinode *p_dinode = (struct rfs_dinode *)b->data;
+    for (int i = 0; i < RFS_BLKSIZE / RFS_INODESIZE; ++i) {
+      p_dinode->size = 0;
+      p_dinode->type = R_FREE;
+      p_dinode->nlinks = 0;
+      p_dinode->blocks = 0;
+      p_dinode = (struct rfs_dinode *)((char *)p_dinode + RFS_INODESIZE);
+    }
+    bcache_dirty(b);
+    bcache_release(b);
   }
 
   // build root directory inode (ino = 0)
@@ -113,39 +118,17 @@ int rfs_format_dev(struct device *dev) {
   }
 
   // ** third, write freemap to disk
-  int *freemap = (int *)rdev->iobuffer;
+  b = bcache_get(rdev, RFS_BLK_OFFSET_BITMAP);
+  uint64 *freemap = (uint64 *)b->data;
   memset(freemap, 0, RFS_BLKSIZE);
   freemap[0] = 1;  // the first data block is used for root directory
-
-  // write the bitmap to RAM Disk0
-  if (rfs_w1block(rdev, RFS_BLK_OFFSET_BITMAP) != 0) {  // write to device
-    sprint("RFS: failed to write bitmap!\n");
-    return -1;
-  }
+  bcache_dirty(b);
+  bcache_release(b);
 
   sprint("RFS: format %s done!\n", dev->dev_name);
   return 0;
 }
 
-// ** Note: If you use the following four functions interchangeably,
-// ** be sure to watch out for IOBUFFER BEING OVERWRITTEN !!!
-
-//
-// call ramdisk_read via the device structure.
-// read the "n_block"^th block from RAM disk to the iobuffer of rfs_dev.
-//
-int rfs_r1block(struct rfs_device *rfs_dev, int n_block) {
-  return dop_read(rfs_dev, n_block);
-}
-
-//
-// call ramdisk_write via the device structure.
-// write iobuffer of rfs_dev to RAM disk at the "n_block"^th block.
-//
-int rfs_w1block(struct rfs_device *rfs_dev, int n_block) {
-  return dop_write(rfs_dev, n_block);
-}
-
 //
 // read disk inode from RAM disk
 //
@@ -153,61 +136,246 @@ struct rfs_dinode *rfs_read_dinode(struct rfs_device *rdev, int n_inode) {
   int n_block = n_inode / (RFS_BLKSIZE / RFS_INODESIZE) + RFS_BLK_OFFSET_INODE;
   int offset = n_inode % (RFS_BLKSIZE / RFS_INODESIZE);
 
-  // call ramdisk_read defined in dev.c
-  if (dop_read(rdev, n_block) != 0) return NULL;
-  struct rfs_dinode *dinode = (struct rfs_dinode *)alloc_page();
-  memcpy(dinode, (char *)rdev->iobuffer + offset * RFS_INODESIZE,
-         sizeof(struct rfs_dinode));
+  struct buf *b = bcache_read(rdev, n_block);
+  struct rfs_dinode *dinode = kmalloc(sizeof(struct rfs_dinode));
+  memcpy(dinode, b->data + offset * RFS_INODESIZE, sizeof(struct rfs_dinode));
+  bcache_release(b);
   return dinode;
 }
 
 //
 // write disk inode to RAM disk.
-// note: we need first read the "disk" block containing the "n_inode"^th inode,
-// modify it, and write the block back to "disk" eventually.
+// the inode is updated in the cached inode block, which is written back to the
+// "disk" later, together with the other updates of the block.
 //
 int rfs_write_dinode(struct rfs_device *rdev, const struct rfs_dinode *dinode,
                      int n_inode) {
   int n_block = n_inode / (RFS_BLKSIZE / RFS_INODESIZE) + RFS_BLK_OFFSET_INODE;
   int offset = n_inode % (RFS_BLKSIZE / RFS_INODESIZE);
 
-  // call ramdisk_read defined in dev.c
-  dop_read(rdev, n_block);
-  memcpy(rdev->iobuffer + offset * RFS_INODESIZE, dinode,
-         sizeof(struct rfs_dinode));
-  // call ramdisk_write defined in dev.c
-  int ret = dop_write(rdev, n_block);
+  struct buf *b = bcache_read(rdev, n_block);
+  char *p = b->data + offset * RFS_INODESIZE;
+  // an inode written back unchanged leaves its block clean
+  if (memcmp(p, dinode, sizeof(struct rfs_dinode)) != 0) {
+    memcpy(p, dinode, sizeof(struct rfs_dinode));
+    bcache_dirty(b);
+  }
+  bcache_release(b);
+  return 0;
+}
 
-  return ret;
+/**** free-block bitmap ****/
+// bit i of the bitmap block is set iff data block RFS_BLK_OFFSET_FREE + i is in use.
+// the bitmap is scanned a 64-bit word at a time.
+#define BITMAP_WORD_BITS 64
+
+static struct rfs_bitmap_info *rfs_bitmap(struct super_block *sb) {
+  return (struct rfs_bitmap_info *)sb->s_fs_info;
 }
 
 //
-// allocate a block from RAM disk
+// index of the lowest set bit of a non-zero word
 //
-int rfs_alloc_block(struct super_block *sb) {
-  int free_block = -1;
-  // think of s_fs_info as freemap information
-  int *freemap = (int *)sb->s_fs_info;
-  for (int block = 0; block < sb->nblocks; ++block) {
-    if (freemap[block] == 0) {  // find a free block
-      freemap[block] = 1;
-      free_block = RFS_BLK_OFFSET_FREE + block;
-      break;
+static int rfs_ctz64(uint64 x) {
+  static const int debruijn_index[64] = {
+    0,  1,  2,  53, 3,  7,  54, 27, 4,  38, 41, 8,  34, 55, 48, 28,
+    62, 5,  39, 46, 44, 42, 22, 9,  24, 35, 59, 56, 49, 18, 29, 11,
+    63, 52, 6,  26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+    51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12};
+  return debruijn_index[((x & -x) * 0x022FDD63CC95386DULL) >> 58];
+}
+
+//
+// index of the highest set bit of a non-zero word
+//
+static int rfs_fls64(uint64 x) {
+  int r = 0;
+  for (int shift = 32; shift > 0; shift >>= 1)
+    if (x >> shift) { x >>= shift; r += shift; }
+  return r;
+}
+
+//
+// the first bit at or after "from" (and before "nbits") that equals "value", or nbits
+//
+static int bitmap_find(const uint64 *map, int nbits, int from, int value) {
+  if (from >= nbits) return nbits;
+  int w = from / BITMAP_WORD_BITS;
+  uint64 word = (value ? map[w] : ~map[w]) & (~0ULL << (from % BITMAP_WORD_BITS));
+  while (word == 0) {
+    if (++w * BITMAP_WORD_BITS >= nbits) return nbits;
+    word = value ? map[w] : ~map[w];
+  }
+  int bit = w * BITMAP_WORD_BITS + rfs_ctz64(word);
+  return bit < nbits ? bit : nbits;
+}
+
+static void bitmap_set(struct super_block *sb, int bit, int n, int value) {
+  uint64 *map = (uint64 *)rfs_bitmap(sb)->buf->data;
+  for (int i = bit; i < bit + n; i++) {
+    if (value) map[i / BITMAP_WORD_BITS] |= 1ULL << (i % BITMAP_WORD_BITS);
+    else map[i / BITMAP_WORD_BITS] &= ~(1ULL << (i % BITMAP_WORD_BITS));
+  }
+  bcache_dirty(rfs_bitmap(sb)->buf);
+}
+
+//
+// allocate "n" contiguous free blocks, searching next-fit from the block "goal" (or
+// from where the previous search stopped if goal is not a data block), and wrapping
+// around the end of the disk once.
+// return: the first block of the run, or -1 if there is no such run.
+//
+int rfs_alloc_run(struct super_block *sb, int goal, int n) {
+  struct rfs_bitmap_info *info = rfs_bitmap(sb);
+  const uint64 *map = (const uint64 *)info->buf->data;
+  int start = goal - RFS_BLK_OFFSET_FREE;
+  if (start < 0 || start >= sb->nblocks) start = info->next;
+
+  for (int pass = 0; pass < 2; pass++) {
+    int from = pass == 0 ? start : 0;
+    int limit = pass == 0 ? sb->nblocks : MIN(start + n - 1, sb->nblocks);
+    while (from < limit) {
+      int first = bitmap_find(map, limit, from, 0);
+      if (first >= limit) break;
+      int end = bitmap_find(map, limit, first, 1);
+      if (end - first >= n) {
+        bitmap_set(sb, first, n, 1);
+        info->next = (first + n) % sb->nblocks;
+        return RFS_BLK_OFFSET_FREE + first;
+      }
+      from = end;
     }
   }
+  return -1;
+}
+
+//
+// allocate a block from RAM disk, next-fit.
+//
+int rfs_alloc_block(struct super_block *sb) {
+  int free_block = rfs_alloc_run(sb, -1, 1);
   if (free_block == -1) panic("rfs_alloc_block: no more free block!\n");
   return free_block;
 }
 
+//
+// allocate the block "goal" if it is free, so that a file written sequentially gets
+// consecutive blocks. otherwise, allocate the next free block after it.
+//
+int rfs_alloc_block_near(struct super_block *sb, int goal) {
+  int free_block = rfs_alloc_run(sb, goal, 1);
+  if (free_block == -1) panic("rfs_alloc_block_near: no more free block!\n");
+  return free_block;
+}
+
+//
+// allocate an indirect block from the end of the disk, away from the data blocks
+// that files grow into
+//
+static int rfs_alloc_indirect_block(struct super_block *sb) {
+  const uint64 *map = (const uint64 *)rfs_bitmap(sb)->buf->data;
+  for (int w = (sb->nblocks - 1) / BITMAP_WORD_BITS; w >= 0; --w) {
+    uint64 word = ~map[w];
+    int valid = sb->nblocks - w * BITMAP_WORD_BITS;  // bits of this word on the disk
+    if (valid < BITMAP_WORD_BITS) word &= (1ULL << valid) - 1;
+    if (word) {
+      int block = w * BITMAP_WORD_BITS + rfs_fls64(word);
+      bitmap_set(sb, block, 1, 1);
+      return RFS_BLK_OFFSET_FREE + block;
+    }
+  }
+  panic("rfs_alloc_indirect_block: no more free block!\n");
+  return -1;
+}
+
 //
 // free a block in RAM disk
 //
 int rfs_free_block(struct super_block *sb, int block_num) {
-  int *freemap = (int *)sb->s_fs_info;
-  freemap[block_num - RFS_BLK_OFFSET_FREE] = 0;
+  int block = block_num - RFS_BLK_OFFSET_FREE;
+  const uint64 *map = (const uint64 *)rfs_bitmap(sb)->buf->data;
+  if (block < 0 || block >= sb->nblocks) {
+    sprint("rfs_free_block: block %d is not a data block!\n", block_num);
+    return -1;
+  }
+  if (!(map[block / BITMAP_WORD_BITS] & (1ULL << (block % BITMAP_WORD_BITS)))) {
+    sprint("rfs_free_block: block %d is already free!\n", block_num);
+    return -1;
+  }
+  bitmap_set(sb, block, 1, 0);
   return 0;
 }
 
+//
+// make the allocated disk block blk the next block of a file
+//
+static void rfs_append_block(struct vinode *node, int blk) {
+  struct rfs_device *rdev = rfs_device_list[node->sb->s_dev->dev_id];
+  struct buf *b;
+  int n = node->blocks;
+
+  if (n < RFS_DIRECT_BLKNUM) {
+    node->addrs[n] = blk;
+  } else {
+    if (n == RFS_DIRECT_BLKNUM) {
+      node->addrs[RFS_INDIRECT] = rfs_alloc_indirect_block(node->sb);
+      b = bcache_get(rdev, node->addrs[RFS_INDIRECT]);
+      memset(b->data, 0, RFS_BLKSIZE);
+    } else {
+      b = bcache_read(rdev, node->addrs[RFS_INDIRECT]);
+    }
+    ((int *)b->data)[n - RFS_DIRECT_BLKNUM] = blk;
+    bcache_dirty(b);
+    bcache_release(b);
+  }
+  node->blocks++;
+}
+
+//
+// map block "n" of a file to its disk block. blocks past RFS_DIRECT_BLKNUM are listed
+// in the indirect block. with "alloc", the block after the last one of the file is
+// allocated, next to its predecessor on the disk if possible.
+// return: the disk block, or 0 if the file has no such block.
+//
+int rfs_bmap(struct vinode *node, int n, int alloc) {
+  struct rfs_device *rdev = rfs_device_list[node->sb->s_dev->dev_id];
+  struct buf *b;
+  int blk;
+
+  if (n < 0 || n >= RFS_MAX_FILE_BLKNUM) return 0;
+  if (n < node->blocks) {
+    if (n < RFS_DIRECT_BLKNUM) return node->addrs[n];
+    b = bcache_read(rdev, node->addrs[RFS_INDIRECT]);
+    blk = ((int *)b->data)[n - RFS_DIRECT_BLKNUM];
+    bcache_release(b);
+    return blk;
+  }
+  if (!alloc || n != node->blocks) return 0;
+
+  blk = rfs_alloc_block_near(node->sb, n > 0 ? rfs_bmap(node, n - 1, 0) + 1 : -1);
+  rfs_append_block(node, blk);
+  return blk;
+}
+
+//
+// the number of blocks, at most "max", from block n of a file on that follow each
+// other on the disk. blk is the disk block of block n. with "alloc", missing blocks
+// are allocated on the way.
+//
+static int rfs_run_length(struct vinode *node, int n, int blk, int max, int alloc) {
+  int count = 1;
+  while (count < max && rfs_bmap(node, n + count, alloc) == blk + count) count++;
+  return count;
+}
+
+//
+// free all the data blocks of a file, and its indirect block
+//
+static void rfs_free_file_blocks(struct vinode *node) {
+  for (int i = 0; i < node->blocks; ++i) rfs_free_block(node->sb, rfs_bmap(node, i, 0));
+  if (node->blocks > RFS_DIRECT_BLKNUM) rfs_free_block(node->sb, node->addrs[RFS_INDIRECT]);
+}
+
 //
 // add a new directory entry to a directory
 //
@@ -218,23 +386,22 @@ int rfs_add_direntry(struct vinode *dir, const char *name, int inum) {
   }
 
   struct rfs_device *rdev = rfs_device_list[dir->sb->s_dev->dev_id];
-  int n_block = dir->addrs[dir->size / RFS_BLKSIZE];
-  if (rfs_r1block(rdev, n_block) != 0) {
-    sprint("rfs_add_direntry: failed to read block %d!\n", n_block);
+  // a full directory grows by one block
+  int new_block = dir->size / RFS_BLKSIZE == dir->blocks;
+  int n_block = rfs_bmap(dir, dir->size / RFS_BLKSIZE, 1);
+  if (n_block == 0) {
+    sprint("rfs_add_direntry: the directory is full!\n");
     return -1;
   }
+  struct buf *b = new_block ? bcache_get(rdev, n_block) : bcache_read(rdev, n_block);
 
-  // prepare iobuffer
-  char *addr = (char *)rdev->iobuffer + dir->size % RFS_BLKSIZE;
+  // fill the new direntry in the cached (parent) directory block
+  char *addr = b->data + dir->size % RFS_BLKSIZE;
   struct rfs_direntry *p_direntry = (struct rfs_direntry *)addr;
   p_direntry->inum = inum;
   strcpy(p_direntry->name, name);
-
-  // write the modified (parent) directory block back to disk
-  if (rfs_w1block(rdev, n_block) != 0) {
-    sprint("rfs_add_direntry: failed to write block %d!\n", n_block);
-    return -1;
-  }
+  bcache_dirty(b);
+  bcache_release(b);
 
   // update its parent dir state
   dir->size += sizeof(struct rfs_direntry);
@@ -258,7 +425,9 @@ struct vinode *rfs_alloc_vinode(struct super_block *sb) {
 }
 
 //
-// convert vfs inode to disk inode, and write it back to disk
+// convert vfs inode to disk inode, and write it back to its cached inode block. the
+// block reaches the disk on the next sync (see rfs_fsync), or when its buffer is
+// reused.
 //
 int rfs_write_back_vinode(struct vinode *vinode) {
   // copy vinode info to disk inode
@@ -267,7 +436,7 @@ int rfs_write_back_vinode(struct vinode *vinode) {
   dinode.nlinks = vinode->nlinks;
   dinode.blocks = vinode->blocks;
   dinode.type = vinode->type;
-  for (int i = 0; i < RFS_DIRECT_BLKNUM; ++i) {
+  for (int i = 0; i <= RFS_INDIRECT; ++i) {
     dinode.addrs[i] = vinode->addrs[i];
   }
 
@@ -280,6 +449,21 @@ int rfs_write_back_vinode(struct vinode *vinode) {
   return 0;
 }
 
+//
+// push a file to the disk: its inode, together with all dirty cached blocks (its data,
+// and the bitmap and directory blocks it refers to).
+//
+int rfs_fsync(struct vinode *vinode) {
+  if (rfs_write_back_vinode(vinode) != 0) return -1;
+
+  struct rfs_device *rdev = rfs_device_list[vinode->sb->s_dev->dev_id];
+  if (bcache_sync(rdev) != 0) {
+    sprint("rfs_fsync: failed to sync the block cache!\n");
+    return -1;
+  }
+  return 0;
+}
+
 //
 // update vinode info by reading disk inode
 //
@@ -294,142 +478,113 @@ int rfs_update_vinode(struct vinode *vinode) {
   vinode->nlinks = dinode->nlinks;
   vinode->blocks = dinode->blocks;
   vinode->type = dinode->type;
-  for (int i = 0; i < RFS_DIRECT_BLKNUM; ++i) {
+  for (int i = 0; i <= RFS_INDIRECT; ++i) {
     vinode->addrs[i] = dinode->addrs[i];
   }
-  free_page(dinode);
+  kfree(dinode);
 
   return 0;
 }
 
 /**** vfs-rfs file interface functions ****/
 //
-// read the content (for "len") of a file ("f_inode"), and copy the content
-// to "r_buf".
+// read the content of a file ("f_inode") into the segments of "iov", for at most
+// iov->len bytes. runs of whole blocks that are consecutive on the disk are copied
+// at once, straight from the disk into the segments.
 //
-ssize_t rfs_read(struct vinode *f_inode, char *r_buf, ssize_t len,
-                 int *offset) {
+ssize_t rfs_read(struct vinode *f_inode, const struct io_vec *iov, int *offset) {
   // obtain disk inode from vfs inode
   if (f_inode->size < *offset)
     panic("rfs_read:offset should less than file size!");
 
+  ssize_t len = iov->len;
   if (f_inode->size < (*offset + len)) len = f_inode->size - *offset;
 
-  char buffer[len + 1];
-
-  // compute how many blocks we need to read
-  int align = *offset % RFS_BLKSIZE;
-  int block_offset = *offset / RFS_BLKSIZE;
-  int buf_offset = 0;
-
-  int readtimes = (align + len) / RFS_BLKSIZE;
-  int remain = (align + len) % RFS_BLKSIZE;
-
   struct rfs_device *rdev = rfs_device_list[f_inode->sb->s_dev->dev_id];
-
-  // read first block
-  rfs_r1block(rdev, f_inode->addrs[block_offset]);
-  int first_block_len = (readtimes == 0 ? len : RFS_BLKSIZE - align);
-  memcpy(buffer + buf_offset, rdev->iobuffer + align, first_block_len);
-  buf_offset += first_block_len;
-  block_offset++;
-  readtimes--;
-
-  // readtimes < 0 means that the file has only one block (and not full),
-  // so our work is done
-  // otherwise...
-  if (readtimes >= 0) {
-    // read in complete blocks
-    while (readtimes != 0) {
-      rfs_r1block(rdev, f_inode->addrs[block_offset]);
-      memcpy(buffer + buf_offset, rdev->iobuffer, RFS_BLKSIZE);
-      buf_offset += RFS_BLKSIZE;
-      block_offset++;
-      readtimes--;
-    }
-
-    // read in the remaining data
-    if (remain > 0) {
-      rfs_r1block(rdev, f_inode->addrs[block_offset]);
-      memcpy(buffer + buf_offset, rdev->iobuffer, remain);
+  ssize_t done = 0;
+  while (done < len) {
+    int n = (*offset + done) / RFS_BLKSIZE;
+    int align = (*offset + done) % RFS_BLKSIZE;
+    int blk = rfs_bmap(f_inode, n, 0);
+
+    if (align != 0 || len - done < RFS_BLKSIZE) {
+      // part of a block, through the cache
+      int part = MIN(RFS_BLKSIZE - align, len - done);
+      struct buf *b = bcache_read(rdev, blk);
+      io_vec_copy_to(iov, done, b->data + align, part);
+      bcache_release(b);
+      done += part;
+    } else {
+      int count = rfs_run_length(f_inode, n, blk, (len - done) / RFS_BLKSIZE, 0);
+      bcache_read_run(rdev, blk, count, iov, done);
+      done += (ssize_t)count * RFS_BLKSIZE;
     }
   }
 
-  buffer[len] = '\0';
-  strcpy(r_buf, buffer);
-
   *offset += len;
   return len;
 }
 
 //
-// write the content of "w_buf" (lengthed "len") to a file ("f_inode").
+// write the content of the segments of "iov" to a file ("f_inode"). the file
+// grows by blocks allocated next to each other, and runs of whole blocks are
+// written at once, straight from the segments to the disk.
+// return: the number of bytes written, less than iov->len if the file reached its
+// maximum size.
 //
-ssize_t rfs_write(struct vinode *f_inode, const char *w_buf, ssize_t len,
-                  int *offset) {
+ssize_t rfs_write(struct vinode *f_inode, const struct io_vec *iov, int *offset) {
+  ssize_t len = iov->len;
   if (f_inode->size < *offset) {
     panic("rfs_write:offset should less than file size!");
   }
 
-  // compute how many blocks we need to write
-  int align = *offset % RFS_BLKSIZE;
-  int writetimes = (len + align) / RFS_BLKSIZE;
-  int remain = (len + align) % RFS_BLKSIZE;
-
-  int buf_offset = 0;
-  int block_offset = *offset / RFS_BLKSIZE;
-
   struct rfs_device *rdev = rfs_device_list[f_inode->sb->s_dev->dev_id];
 
-  // write first block
-  if (align != 0) {
-    rfs_r1block(rdev, f_inode->addrs[block_offset]);
-    int first_block_len = (writetimes == 0 ? len : RFS_BLKSIZE - align);
-    memcpy(rdev->iobuffer + align, w_buf, first_block_len);
-    rfs_w1block(rdev, f_inode->addrs[block_offset]);
-
-    buf_offset += first_block_len;
-    block_offset++;
-    writetimes--;
-  }
-
-  // writetimes < 0 means that the file has only one block (and not full),
-  // so our work is done
-  // otherwise...
-  if (writetimes >= 0) {
-    // write complete blocks
-    while (writetimes != 0) {
-      if (block_offset == f_inode->blocks) {  // need to create new block
-        // allocate a free block for the file
-        f_inode->addrs[block_offset] = rfs_alloc_block(f_inode->sb);
-        f_inode->blocks++;
-      }
-
-      memcpy(rdev->iobuffer, w_buf + buf_offset, RFS_BLKSIZE);
-      rfs_w1block(rdev, f_inode->addrs[block_offset]);
-
-      buf_offset += RFS_BLKSIZE;
-      block_offset++;
-      writetimes--;
-    }
+  // take the blocks the file grows by as one run if the disk has one
+  int need = MIN((*offset + len + RFS_BLKSIZE - 1) / RFS_BLKSIZE, RFS_MAX_FILE_BLKNUM) -
+             f_inode->blocks;
+  int old_blocks = f_inode->blocks;
+  if (need > 1) {
+    int goal = old_blocks > 0 ? rfs_bmap(f_inode, old_blocks - 1, 0) + 1 : -1;
+    int run = rfs_alloc_run(f_inode->sb, goal, need);
+    for (int i = 0; run > 0 && i < need; i++) rfs_append_block(f_inode, run + i);
+  }
 
-    // write the remaining data
-    if (remain > 0) {
-      if (block_offset == f_inode->blocks) {
-        f_inode->addrs[block_offset] = rfs_alloc_block(f_inode->sb);
-        ++f_inode->blocks;
+  ssize_t done = 0;
+  while (done < len) {
+    int n = (*offset + done) / RFS_BLKSIZE;
+    int align = (*offset + done) % RFS_BLKSIZE;
+    int new_block = n >= old_blocks;
+    int blk = rfs_bmap(f_inode, n, 1);
+    if (blk == 0) break;
+
+    if (align != 0 || len - done < RFS_BLKSIZE) {
+      // part of a block, through the cache. keep the rest of an existing block.
+      int part = MIN(RFS_BLKSIZE - align, len - done);
+      struct buf *b;
+      if (new_block) {
+        b = bcache_get(rdev, blk);
+        memset(b->data, 0, RFS_BLKSIZE);
+      } else {
+        b = bcache_read(rdev, blk);
       }
-      memcpy(rdev->iobuffer, w_buf + buf_offset, remain);
-      rfs_w1block(rdev, f_inode->addrs[block_offset]);
+      io_vec_copy_from(iov, done, b->data + align, part);
+      bcache_dirty(b);
+      bcache_release(b);
+      done += part;
+    } else {
+      int count = rfs_run_length(f_inode, n, blk, (len - done) / RFS_BLKSIZE, 1);
+      bcache_write_run(rdev, blk, count, iov, done);
+      done += (ssize_t)count * RFS_BLKSIZE;
     }
   }
 
   // update file size
   f_inode->size =
-      (f_inode->size < *offset + len ? *offset + len : f_inode->size);
+      (f_inode->size < *offset + done ? *offset + done : f_inode->size);
 
-  *offset += len;
-  return len;
+  *offset += done;
+  return done;
 }
 
 //
@@ -448,10 +603,12 @@ struct vinode *rfs_lookup(struct vinode *parent, struct dentry *sub_dentry) {
   struct rfs_device *rdev = rfs_device_list[parent->sb->s_dev->dev_id];
 
   // browse the dir entries contained in a directory file
+  struct buf *b = NULL;
   for (int i = 0; i < total_direntrys; ++i) {
-    if (i % one_block_direntrys == 0) {  // read in the disk block at boundary
-      rfs_r1block(rdev, parent->addrs[i / one_block_direntrys]);
-      p_direntry = (struct rfs_direntry *)rdev->iobuffer;
+    if (i % one_block_direntrys == 0) {  // get the disk block at boundary
+      if (b) bcache_release(b);
+      b = bcache_read(rdev, rfs_bmap(parent, i / one_block_direntrys, 0));
+      p_direntry = (struct rfs_direntry *)b->data;
     }
     if (strcmp(p_direntry->name, sub_dentry->name) == 0) {  // found
       child_vinode = rfs_alloc_vinode(parent->sb);
@@ -462,6 +619,7 @@ struct vinode *rfs_lookup(struct vinode *parent, struct dentry *sub_dentry) {
     }
     ++p_direntry;
   }
+  if (b) bcache_release(b);
   return child_vinode;
 }
 
@@ -482,7 +640,7 @@ struct vinode *rfs_create(struct vinode *parent, struct dentry *sub_dentry) {
       free_inum = i;
       break;
     }
-    free_page(free_dinode);
+    kfree(free_dinode);
   }
 
   if (free_dinode == NULL)
@@ -510,7 +668,7 @@ struct vinode *rfs_create(struct vinode *parent, struct dentry *sub_dentry) {
 
   // **  write the disk inode of file being created to disk
   rfs_write_dinode(rdev, free_dinode, free_inum);
-  free_page(free_dinode);
+  kfree(free_dinode);
 
   // ** build vfs inode according to dinode
   struct vinode *new_vinode = rfs_alloc_vinode(parent->sb);
@@ -577,7 +735,7 @@ int rfs_disk_stat(struct vinode *vinode, struct istat *istat) {
   istat->st_type = dinode->type;
   istat->st_nlinks = dinode->nlinks;
   istat->st_blocks = dinode->blocks;
-  free_page(dinode);
+  kfree(dinode);
   return 0;
 }
 
@@ -618,12 +776,14 @@ int rfs_unlink(struct vinode *parent, struct dentry *sub_dentry, struct vinode *
   int one_block_direntrys = RFS_BLKSIZE / sizeof(struct rfs_direntry);
 
   struct rfs_direntry *p_direntry = NULL;
+  struct buf *b = NULL;
   int delete_index;
   for (delete_index = 0; delete_index < total_direntrys; ++delete_index) {
-    // read in the disk block at boundary
+    // get the disk block at boundary
     if (delete_index % one_block_direntrys == 0) {
-      rfs_r1block(rdev, parent->addrs[delete_index / one_block_direntrys]);
-      p_direntry = (struct rfs_direntry *)rdev->iobuffer;
+      if (b) bcache_release(b);
+      b = bcache_read(rdev, rfs_bmap(parent, delete_index / one_block_direntrys, 0));
+      p_direntry = (struct rfs_direntry *)b->data;
     }
     if (strcmp(p_direntry->name, sub_dentry->name) == 0) {  // found
       break;
@@ -631,13 +791,14 @@ int rfs_unlink(struct vinode *parent, struct dentry *sub_dentry, struct vinode *
     ++p_direntry;
   }
 
-  int inum = p_direntry->inum;
-
   if (delete_index == total_direntrys) {
+    if (b) bcache_release(b);
     sprint("unlink: file %s not found.\n", sub_dentry->name);
     return -1;
   }
 
+  int inum = p_direntry->inum;
+
   // ** read the disk inode of the file to be unlinked
   struct rfs_dinode *unlink_dinode = rfs_read_dinode(rdev, inum);
 
@@ -654,63 +815,51 @@ int rfs_unlink(struct vinode *parent, struct dentry *sub_dentry, struct vinode *
   // ** if nlinks == 0, free the disk inode and disk blocks
   if (unlink_dinode->nlinks == 0) {
     // free disk blocks
-    for (int i = 0; i < unlink_dinode->blocks; ++i) {
-      rfs_free_block(parent->sb, unlink_dinode->addrs[i]);
-    }
+    rfs_free_file_blocks(unlink_vinode);
     // free disk inode
     unlink_dinode->type = R_FREE;
   }
   // ** write the disk inode back to disk
   rfs_write_dinode(rdev, unlink_dinode, inum);
-  free_page(unlink_dinode);
+  kfree(unlink_dinode);
 
   // ** remove the direntry from the directory
 
-  // handle the first block
-  int delete_block_index = delete_index / one_block_direntrys;
-  rfs_r1block(rdev, parent->addrs[delete_block_index]);
-
+  // shift the following direntries forward by one, across the cached blocks. b is
+  // the block holding the deleted direntry.
   int offset = delete_index % one_block_direntrys;
-  memmove(rdev->iobuffer + offset * sizeof(struct rfs_direntry),
-          rdev->iobuffer + (offset + 1) * sizeof(struct rfs_direntry),
+  struct rfs_direntry *previous_block = (struct rfs_direntry *)b->data;
+  memmove(previous_block + offset, previous_block + offset + 1,
           (one_block_direntrys - offset - 1) * sizeof(struct rfs_direntry));
 
-  struct rfs_direntry *previous_block = (struct rfs_direntry *)alloc_page();
-  memcpy(previous_block, rdev->iobuffer, RFS_BLKSIZE);
-
-  for (int i = delete_block_index + 1; i < parent->blocks; i++) {
-    rfs_r1block(rdev, parent->addrs[i]);
-    struct rfs_direntry *this_block = (struct rfs_direntry *)alloc_page();
-    memcpy(this_block, rdev->iobuffer, RFS_BLKSIZE);
+  for (int i = delete_index / one_block_direntrys + 1; i < parent->blocks; i++) {
+    struct buf *next = bcache_read(rdev, rfs_bmap(parent, i, 0));
+    struct rfs_direntry *this_block = (struct rfs_direntry *)next->data;
 
-    // copy the first direntry of this block to the last direntry 
+    // copy the first direntry of this block to the last direntry
     // of previous block
-    memcpy(previous_block + one_block_direntrys - 1, rdev->iobuffer,
+    memcpy(previous_block + one_block_direntrys - 1, this_block,
            sizeof(struct rfs_direntry));
+    bcache_dirty(b);
+    bcache_release(b);
 
     // move the direntry in this block forward by one
     memmove(this_block, this_block + 1,
             (one_block_direntrys - 1) * sizeof(struct rfs_direntry));
 
-    // write the previous block back to disk
-    memcpy(rdev->iobuffer, previous_block, RFS_BLKSIZE);
-    rfs_w1block(rdev, parent->addrs[i - 1]);
-
-    // update previous block
-    free_page(previous_block);
+    b = next;
     previous_block = this_block;
   }
-
-  // write the last block back to disk
-  memcpy(rdev->iobuffer, previous_block, RFS_BLKSIZE);
-  rfs_w1block(rdev, parent->addrs[parent->blocks - 1]);
-  free_page(previous_block);
+  bcache_dirty(b);
+  bcache_release(b);
 
   // if the last block is empty, free it
   total_direntrys--;
   if (total_direntrys % one_block_direntrys == 0 && parent->blocks > 1) {
-    rfs_free_block(parent->sb, parent->addrs[parent->blocks - 1]);
+    rfs_free_block(parent->sb, rfs_bmap(parent, parent->blocks - 1, 0));
     parent->blocks--;
+    if (parent->blocks == RFS_DIRECT_BLKNUM)
+      rfs_free_block(parent->sb, parent->addrs[RFS_INDIRECT]);
   }
 
   // ** update the directory file's size
@@ -745,30 +894,34 @@ int rfs_munmap(struct vinode *node, uint64 num, uint64 length) {
   panic("rfs_munmap not implemented!\n");
 }
 
+//
+// the last close of a file syncs it, so a file that is not open any more is on the
+// disk. closes of a file that stays open cost nothing.
+//
+int rfs_hook_close(struct vinode *f_inode, struct dentry *dentry) {
+  if (dentry->d_ref > 1) return 0;
+  return rfs_fsync(f_inode);
+}
+
 //
 // when a directory is opened, the contents of the directory file are read
 // into the memory for directory read operations
 //
 int rfs_hook_opendir(struct vinode *dir_vinode, struct dentry *dentry) {
-  // allocate space and read the contents of the dir block into memory
-  void *pdire = NULL;
-  void *previous = NULL;
+  // allocate contiguous space and read the contents of the dir blocks into memory
+  char *pdire = alloc_pages_exact(dir_vinode->blocks);
+  if (pdire == NULL) panic("rfs_hook_opendir: no memory for the directory blocks");
   struct rfs_device *rdev = rfs_device_list[dir_vinode->sb->s_dev->dev_id];
 
   // read-in the directory file, store all direntries in dir cache.
-  for (int i = dir_vinode->blocks - 1; i >= 0; i--) {
-    previous = pdire;
-    pdire = alloc_page();
-
-    if (previous != NULL && previous - pdire != RFS_BLKSIZE)
-      panic("rfs_hook_opendir: memory discontinuity");
-
-    rfs_r1block(rdev, dir_vinode->addrs[i]);
-    memcpy(pdire, rdev->iobuffer, RFS_BLKSIZE);
+  for (int i = 0; i < dir_vinode->blocks; i++) {
+    struct buf *b = bcache_read(rdev, rfs_bmap(dir_vinode, i, 0));
+    memcpy(pdire + i * RFS_BLKSIZE, b->data, RFS_BLKSIZE);
+    bcache_release(b);
   }
 
   // save the pointer to the directory block in the vinode
-  struct rfs_dir_cache *dir_cache = (struct rfs_dir_cache *)alloc_page();
+  struct rfs_dir_cache *dir_cache = kmalloc(sizeof(struct rfs_dir_cache));
   dir_cache->block_count = dir_vinode->blocks;
   dir_cache->dir_base_addr = (struct rfs_direntry *)pdire;
 
@@ -789,6 +942,8 @@ int rfs_hook_closedir(struct vinode *dir_vinode, struct dentry *dentry) {
   for (int i = 0; i < dir_cache->block_count; ++i) {
     free_page((char *)dir_cache->dir_base_addr + i * RFS_BLKSIZE);
   }
+  kfree(dir_cache);
+  dir_vinode->i_fs_info = NULL;
   return 0;
 }
 
@@ -846,7 +1001,7 @@ struct vinode *rfs_mkdir(struct vinode *parent, struct dentry *sub_dentry) {
       free_inum = i;
       break;
     }
-    free_page(free_dinode);
+    kfree(free_dinode);
   }
 
   if (free_dinode == NULL)
@@ -862,7 +1017,7 @@ struct vinode *rfs_mkdir(struct vinode *parent, struct dentry *sub_dentry) {
 
   // **  write the disk inode of file being created to disk
   rfs_write_dinode(rdev, free_dinode, free_inum);
-  free_page(free_dinode);
+  kfree(free_dinode);
 
   // ** add a direntry to the directory
   int result = rfs_add_direntry(parent, sub_dentry->name, free_inum);
@@ -884,14 +1039,13 @@ struct super_block *rfs_get_superblock(struct device *dev) {
   struct rfs_device *rdev = rfs_device_list[dev->dev_id];
 
   // read super block from ramdisk
-  if (rfs_r1block(rdev, RFS_BLK_OFFSET_SUPER) != 0)
-    panic("RFS: failed to read superblock!\n");
-
+  struct buf *b = bcache_read(rdev, RFS_BLK_OFFSET_SUPER);
   struct rfs_superblock d_sb;
-  memcpy(&d_sb, rdev->iobuffer, sizeof(struct rfs_superblock));
+  memcpy(&d_sb, b->data, sizeof(struct rfs_superblock));
+  bcache_release(b);
 
   // set the data for the vfs super block
-  struct super_block *sb = alloc_page();
+  struct super_block *sb = kmalloc(sizeof(struct super_block));
   sb->magic = d_sb.magic;
   sb->size = d_sb.size;
   sb->nblocks = d_sb.nblocks;
@@ -909,11 +1063,11 @@ struct super_block *rfs_get_superblock(struct device *dev) {
   struct dentry *root_dentry = alloc_vfs_dentry("/", root_inode, NULL);
   sb->s_root = root_dentry;
 
-  // save the bitmap in the s_fs_info field
-  if (rfs_r1block(rdev, RFS_BLK_OFFSET_BITMAP) != 0)
-    panic("RFS: failed to read bitmap!\n");
-  void *bitmap = alloc_page();
-  memcpy(bitmap, rdev->iobuffer, RFS_BLKSIZE);
+  // save the bitmap in the s_fs_info field. its buffer stays held, so block
+  // allocation always finds it cached, and updates reach the disk on sync.
+  struct rfs_bitmap_info *bitmap = kmalloc(sizeof(struct rfs_bitmap_info));
+  bitmap->buf = bcache_read(rdev, RFS_BLK_OFFSET_BITMAP);
+  bitmap->next = 0;
   sb->s_fs_info = bitmap;
 
   return sb;
@@ -13,6 +13,10 @@
 #define RFS_MAX_INODE_BLKNUM 10
 #define RFS_MAX_FILE_NAME_LEN 28
 #define RFS_DIRECT_BLKNUM DIRECT_BLKNUM
+// addrs[RFS_INDIRECT] is a block holding the numbers of the following data blocks
+#define RFS_INDIRECT RFS_DIRECT_BLKNUM
+#define RFS_NINDIRECT (RFS_BLKSIZE / sizeof(int))
+#define RFS_MAX_FILE_BLKNUM (RFS_DIRECT_BLKNUM + RFS_NINDIRECT)
 
 // rfs block offset
 #define RFS_BLK_OFFSET_SUPER 0
@@ -38,8 +42,8 @@ struct rfs_dinode {
   int size;                      // size of the file (in bytes)
   int type;                      // one of R_FREE, R_FILE, R_DIR
   int nlinks;                    // number of hard links to this file
-  int blocks;                    // number of blocks
-  int addrs[RFS_DIRECT_BLKNUM];  // direct blocks
+  int blocks;                        // number of data blocks
+  int addrs[RFS_DIRECT_BLKNUM + 1];  // direct blocks, then the indirect block
 };
 
 // directory entry
@@ -48,6 +52,12 @@ struct rfs_direntry {
   char name[RFS_MAX_FILE_NAME_LEN];  // file name
 };
 
+// in-memory state of the free-block bitmap (the s_fs_info of an rfs super block)
+struct rfs_bitmap_info {
+  struct buf *buf;  // the bitmap block, held in the buffer cache while mounted
+  int next;         // where the next-fit search for a free block starts
+};
+
 // directory memory cache (used by opendir/readdir/closedir)
 struct rfs_dir_cache {
   int block_count;
@@ -58,23 +68,24 @@ struct rfs_dir_cache {
 int register_rfs();
 int rfs_format_dev(struct device *dev);
 
-int rfs_r1block(struct rfs_device *rfs_dev, int n_block);
-int rfs_w1block(struct rfs_device *rfs_dev, int n_block);
 struct rfs_dinode *rfs_read_dinode(struct rfs_device *rdev, int n_inode);
 int rfs_write_dinode(struct rfs_device *rdev, const struct rfs_dinode *dinode,
                      int n_inode);
 int rfs_alloc_block(struct super_block *sb);
+int rfs_alloc_block_near(struct super_block *sb, int goal);
+int rfs_alloc_run(struct super_block *sb, int goal, int n);
 int rfs_free_block(struct super_block *sb, int block_num);
 int rfs_add_direntry(struct vinode *dir, const char *name, int inum);
+int rfs_bmap(struct vinode *node, int n, int alloc);
 
 struct vinode *rfs_alloc_vinode(struct super_block *sb);
 int rfs_write_back_vinode(struct vinode *vinode);
+int rfs_fsync(struct vinode *vinode);
 int rfs_update_vinode(struct vinode *vinode);
 
 // rfs interface function declarations
-ssize_t rfs_read(struct vinode *f_inode, char *r_buf, ssize_t len, int *offset);
-ssize_t rfs_write(struct vinode *f_inode, const char *w_buf, ssize_t len,
-                  int *offset);
+ssize_t rfs_read(struct vinode *f_inode, const struct io_vec *iov, int *offset);
+ssize_t rfs_write(struct vinode *f_inode, const struct io_vec *iov, int *offset);
 struct vinode *rfs_lookup(struct vinode *parent, struct dentry *sub_dentry);
 struct vinode *rfs_create(struct vinode *parent, struct dentry *sub_dentry);
 int rfs_lseek(struct vinode *f_inode, ssize_t new_offset, int whence, int *offset);
@@ -88,6 +99,7 @@ int rfs_read_mmap(struct vinode *node, uint64 num, char *base_addr, char *read_a
                 uint64 length, char *buf);
 int rfs_munmap(struct vinode *node, uint64 num, uint64 length);
 
+int rfs_hook_close(struct vinode *f_inode, struct dentry *dentry);
 int rfs_hook_opendir(struct vinode *dir_vinode, struct dentry *dentry);
 int rfs_hook_closedir(struct vinode *dir_vinode, struct dentry *dentry);
 int rfs_readdir(struct vinode *dir_vinode, struct dir *dir, int *offset);
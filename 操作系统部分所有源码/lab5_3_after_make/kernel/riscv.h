@@ -91,6 +91,11 @@
 #define MIE_MTIE (1L << 7)   // timer
 #define MIE_MSIE (1L << 3)   // software
 
+// fields of mcounteren and scounteren: the counters the next lower mode may read
+#define COUNTEREN_CY (1L << 0)  // cycle
+#define COUNTEREN_TM (1L << 1)  // time
+#define COUNTEREN_IR (1L << 2)  // instret
+
 #define read_const_csr(reg)              \
   ({                                     \
     unsigned long __tmp;                 \
@@ -206,6 +211,7 @@ static inline void flush_tlb(void) { asm volatile("sfence.vma zero, zero"); }
 #define PTE_G (1L << 5)  // global
 #define PTE_A (1L << 6)  // accessed
 #define PTE_D (1L << 7)  // dirty
+#define PTE_COW (1L << 8)  // copy-on-write, a software (RSW) bit
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -1,38 +1,105 @@
 /*
  * implementing the scheduler
+ *
+ * the ready queue is one FIFO per priority class plus a bitmap of the non-empty
+ * classes, so both inserting a process and picking the next one take O(1).
  */
 
 #include "sched.h"
+#include "klog.h"
+#include "trace.h"
+#include "config.h"
+#include "strap.h"
+#include "timer.h"
 #include "spike_interface/spike_utils.h"
 
-process* ready_queue_head = NULL;
+// every queue operation is logged at KLOG_DEBUG, which the sched subsystem of the
+// kernel log does not keep by default (see klog_set_level).
+#define sched_trace(...) klog(KLOG_SCHED, KLOG_DEBUG, __VA_ARGS__)
+
+// ready processes of each priority class, linked through queue_next
+static struct {
+  process *head;
+  process *tail;
+} ready_queue[SCHED_NPRIO];
+
+// bit i is set iff ready_queue[i] is not empty
+static uint32 ready_bitmap = 0;
 
 //
-// insert a process, proc, into the END of ready queue.
+// index of the lowest set bit of a non-zero word
 //
-void insert_to_ready_queue( process* proc ) {
-  sprint( "going to insert process %d to ready queue.\n", proc->pid );
-  // if the queue is empty in the beginning
-  if( ready_queue_head == NULL ){
-    proc->status = READY;
-    proc->queue_next = NULL;
-    ready_queue_head = proc;
-    return;
-  }
-
-  // ready queue is not empty
-  process *p;
-  // browse the ready queue to see if proc is already in-queue
-  for( p=ready_queue_head; p->queue_next!=NULL; p=p->queue_next )
-    if( p == proc ) return;  //already in queue
+static int lowest_set_bit(uint32 x) {
+  static const int debruijn_index[32] = {
+    0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+    31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9};
+  return debruijn_index[((x & -x) * 0x077CB531U) >> 27];
+}
 
-  // p points to the last element of the ready queue
-  if( p==proc ) return;
-  p->queue_next = proc;
+//
+// insert a process, proc, into the END of the ready queue of its priority class.
+//
+void insert_to_ready_queue( process* proc ) {
+  sched_trace( "going to insert process %d to ready queue.\n", proc->pid );
   proc->status = READY;
+  if( proc->on_ready_queue ) return;  //already in queue
+
+  int prio = proc->priority;
   proc->queue_next = NULL;
+  if( ready_queue[prio].head == NULL )
+    ready_queue[prio].head = proc;
+  else
+    ready_queue[prio].tail->queue_next = proc;
+  ready_queue[prio].tail = proc;
 
-  return;
+  proc->on_ready_queue = 1;
+  ready_bitmap |= 1U << prio;
+}
+
+//
+// returns non-zero if no process is READY to run.
+//
+int ready_queue_empty() {
+  return ready_bitmap == 0;
+}
+
+//
+// returns non-zero if a READY process has a higher priority than the current one.
+//
+int should_preempt() {
+  if( ready_bitmap == 0 || current == NULL || current->status != RUNNING ) return 0;
+  return lowest_set_bit(ready_bitmap) < current->priority;
+}
+
+//
+// give the CPU to a higher-priority process that has become READY. does not return
+// if current gets preempted.
+//
+void preempt_current() {
+  if( !should_preempt() ) return;
+  insert_to_ready_queue( current );
+  schedule();
+}
+
+//
+// nothing is READY, but some processes are BLOCKED (e.g., on Bluetooth input). stop the
+// hart with wfi until an interrupt makes one of them READY. meanwhile the timer only
+// fires at the nearest real deadline (tickless), not every TIMER_INTERVAL.
+// interrupts stay disabled in S-mode: wfi still returns when one is pending, and it
+// is handled right here.
+//
+static void idle() {
+  while( ready_queue_empty() ){
+    // nobody waits for the CPU, a good time to show the kernel log
+    klog_flush();
+    timer_program( timer_next_deadline() );
+    asm volatile( "wfi" );
+
+    // the deadline we slept to need not be a tick
+    if( (read_csr(sip) & SIP_SSIP) && !handle_mtimer_trap() ) expire_timeouts();
+    if( read_csr(sip) & MIP_SEIP ) handle_mexternal_trap();
+  }
+  timer_resume_periodic();
 }
 
 //
@@ -43,7 +110,8 @@ void insert_to_ready_queue( process* proc ) {
 //
 extern process procs[NPROC];
 void schedule() {
-  if ( !ready_queue_head ){
+  process *prev = current;
+  if ( ready_queue_empty() ){
     // by default, if there are no ready process, and all processes are in the status of
     // FREE and ZOMBIE, we should shutdown the emulated RISC-V machine.
     int should_shutdown = 1;
@@ -51,7 +119,7 @@ void schedule() {
     for( int i=0; i<NPROC; i++ )
       if( (procs[i].status != FREE) && (procs[i].status != ZOMBIE) ){
         should_shutdown = 0;
-        sprint( "ready queue empty, but process %d is not in free/zombie state:%d\n", 
+        sched_trace( "ready queue empty, but process %d is not in free/zombie state:%d\n",
           i, procs[i].status );
       }
 
@@ -59,15 +127,23 @@ void schedule() {
       sprint( "no more ready processes, system shutdown now.\n" );
       shutdown( 0 );
     }else{
-      panic( "Not handled: we should let system wait for unfinished processes.\n" );
+      idle();
     }
   }
 
-  current = ready_queue_head;
+  int prio = lowest_set_bit(ready_bitmap);
+  current = ready_queue[prio].head;
+  ready_queue[prio].head = current->queue_next;
+  if( ready_queue[prio].head == NULL ){
+    ready_queue[prio].tail = NULL;
+    ready_bitmap &= ~(1U << prio);
+  }
+  current->queue_next = NULL;
+  current->on_ready_queue = 0;
   assert( current->status == READY );
-  ready_queue_head = ready_queue_head->queue_next;
 
   current->status = RUNNING;
-  sprint( "going to schedule process %d to run.\n", current->pid );
+  sched_trace( "going to schedule process %d to run.\n", current->pid );
+  trace_event( TRACE_SWITCH, prev ? prev->pid : -1, 0 );
   switch_to( current );
 }
@@ -6,7 +6,21 @@
 //length of a time slice, in number of ticks
 #define TIME_SLICE_LEN  2
 
+// priority classes of the scheduler. a READY process of a lower class number always
+// runs before those of higher numbers, processes of the same class share the CPU
+// round-robin.
+enum sched_priority {
+  SCHED_PRIO_RT = 0,    // real-time, e.g., motor control
+  SCHED_PRIO_HIGH,
+  SCHED_PRIO_NORMAL,    // default class of a new process
+  SCHED_PRIO_LOW,
+  SCHED_NPRIO,
+};
+
 void insert_to_ready_queue( process* proc );
 void schedule();
+int ready_queue_empty();
+int should_preempt();
+void preempt_current();
 
 #endif
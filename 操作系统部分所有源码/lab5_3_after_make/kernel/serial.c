@@ -0,0 +1,253 @@
+/*
+ * Supervisor-mode driver of the UARTs on the car.
+ *
+ * bytes sent to the motor controller (uart2) are queued in a ring buffer and moved
+ * into the hardware FIFO whenever it has room: right after queueing, and again from
+ * the interrupt the controller raises when its transmit FIFO runs empty. a writer
+ * therefore never spins on the TX-full bit.
+ *
+ * on the receive side, the interrupt handler drains the whole FIFO of each uart into
+ * a per-uart ring, and hands the bytes to the processes blocked on that uart in the
+ * order they went to sleep.
+ */
+
+#include "serial.h"
+#include "riscv.h"
+#include "process.h"
+#include "sched.h"
+#include "vmm.h"
+#include "timer.h"
+#include "vdso.h"
+#include "config.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+static struct {
+  char buf[SERIAL_TX_RING_SIZE];
+  uint32 head;  // next byte to move into the FIFO
+  uint32 tail;  // next free slot
+} uart2_tx;
+
+// a process blocked on a receive ring
+struct serial_waiter {
+  process *proc;
+  int getchar;      // uartgetchar() returns the byte itself, uart_read() a count
+  uint64 bufva;     // destination of uart_read() in the address space of proc
+  uint64 n;
+  uint64 deadline;  // mtime at which uart_read() gives up, TIMER_NO_DEADLINE if never
+  struct serial_waiter *next;
+};
+
+static struct serial_port {
+  uint64 base;
+  char rx_buf[SERIAL_RX_RING_SIZE];
+  uint32 rx_head;   // next byte to hand out
+  uint32 rx_tail;   // next free slot
+  uint64 rx_dropped;
+  struct serial_waiter *waiters;  // FIFO of blocked readers
+} ports[SERIAL_NPORTS];
+
+// a process waits on at most one uart, so its waiter record is indexed by pid
+static struct serial_waiter waiter_pool[NPROC];
+
+//
+// move queued bytes into the uart2 transmit FIFO until it is full or the ring is empty
+//
+static void serial_tx_kick(void) {
+  while (uart2_tx.head != uart2_tx.tail &&
+         !(UART_REG(UART2_BASE, UARTLITE_STAT) & UARTLITE_STAT_TX_FULL)) {
+    UART_REG(UART2_BASE, UARTLITE_TX) = uart2_tx.buf[uart2_tx.head % SERIAL_TX_RING_SIZE];
+    uart2_tx.head++;
+  }
+}
+
+//
+// enable the interrupt of uart2, so that the TX ring is drained when the FIFO empties.
+// the interrupt of uart1 is enabled in m_start().
+//
+void serial_init(void) {
+  uart2_tx.head = uart2_tx.tail = 0;
+  ports[SERIAL_BLUETOOTH].base = UART1_BASE;
+  ports[SERIAL_MOTOR].base = UART2_BASE;
+  UART_REG(UART2_BASE, UARTLITE_CTRL) = UARTLITE_CTRL_INTR_EN;
+}
+
+//
+// queue "n" bytes of "buf" for uart2 and start the transmission.
+// return: the number of bytes queued, which is less than n if the ring is full.
+//
+int serial_tx_write(const char *buf, int n) {
+  int queued = 0;
+  while (queued < n && uart2_tx.tail - uart2_tx.head < SERIAL_TX_RING_SIZE) {
+    uart2_tx.buf[uart2_tx.tail % SERIAL_TX_RING_SIZE] = buf[queued++];
+    uart2_tx.tail++;
+  }
+  serial_tx_kick();
+  return queued;
+}
+
+//
+// show the number of bytes waiting in the receive ring of "port" on the status page
+//
+static void serial_rx_publish(struct serial_port *port) {
+  vdso_uart_rx(port - ports, port->rx_tail - port->rx_head);
+}
+
+//
+// copy up to n received bytes of "port" to bufva in the address space of "proc".
+// return: the number of bytes copied.
+//
+static uint64 serial_rx_copy(struct serial_port *port, process *proc, uint64 bufva,
+                             uint64 n) {
+  uint64 copied = 0;
+  while (copied < n && port->rx_head != port->rx_tail) {
+    uint64 va = bufva + copied;
+    uint64 pa = lookup_pa((pagetable_t)proc->pagetable, va);
+    if (pa == 0) break;
+    char *dst = (char *)pa + (va - ROUNDDOWN(va, PGSIZE));
+    uint64 room = PGSIZE - (va - ROUNDDOWN(va, PGSIZE));
+
+    // copy within the current page
+    for (uint64 i = 0; i < room && copied < n && port->rx_head != port->rx_tail; i++) {
+      dst[i] = port->rx_buf[port->rx_head % SERIAL_RX_RING_SIZE];
+      port->rx_head++;
+      copied++;
+    }
+  }
+  serial_rx_publish(port);
+  return copied;
+}
+
+//
+// finish the syscall of waiter w with the bytes currently in the ring, and make its
+// process runnable again.
+//
+static void serial_complete(struct serial_port *port, struct serial_waiter *w) {
+  process *proc = w->proc;
+  if (w->getchar) {
+    proc->trapframe->regs.a0 = (uint64)port->rx_buf[port->rx_head % SERIAL_RX_RING_SIZE];
+    port->rx_head++;
+    serial_rx_publish(port);
+  } else {
+    proc->trapframe->regs.a0 = serial_rx_copy(port, proc, w->bufva, w->n);
+  }
+  w->proc = NULL;
+  insert_to_ready_queue(proc);
+}
+
+//
+// put current to sleep on "port" until data arrives (or the timeout expires).
+// like do_sleep, this never returns: the syscall result is set by serial_complete().
+//
+static void serial_wait(struct serial_port *port, struct serial_waiter *w) {
+  w->proc = current;
+  w->next = NULL;
+
+  struct serial_waiter **pp = &port->waiters;
+  while (*pp) pp = &(*pp)->next;
+  *pp = w;
+
+  do_sleep(NULL, NULL);
+}
+
+//
+// read one byte from "port", sleeping until one arrives.
+//
+long serial_getchar(int port_id) {
+  struct serial_port *port = &ports[port_id];
+  if (port->rx_head != port->rx_tail) {
+    char c = port->rx_buf[port->rx_head % SERIAL_RX_RING_SIZE];
+    port->rx_head++;
+    serial_rx_publish(port);
+    return c;
+  }
+
+  struct serial_waiter *w = &waiter_pool[current->pid];
+  w->getchar = 1;
+  w->deadline = TIMER_NO_DEADLINE;
+  serial_wait(port, w);
+  return 0;
+}
+
+//
+// read up to n bytes of "port" into bufva (a user address). returns as soon as some
+// bytes are available, or after "timeout" ticks with 0. timeout 0 never sleeps, and
+// a negative timeout waits forever.
+//
+long serial_read(int port_id, uint64 bufva, uint64 n, int64 timeout) {
+  struct serial_port *port = &ports[port_id];
+  if (n == 0 || port->rx_head != port->rx_tail || timeout == 0)
+    return serial_rx_copy(port, current, bufva, n);
+
+  struct serial_waiter *w = &waiter_pool[current->pid];
+  w->getchar = 0;
+  w->bufva = bufva;
+  w->n = n;
+  w->deadline = timeout < 0 ? TIMER_NO_DEADLINE : timer_mtime() + timeout * TIMER_INTERVAL;
+  serial_wait(port, w);
+  return 0;
+}
+
+//
+// external interrupt from the UARTs: refill the uart2 transmit FIFO, drain the receive
+// FIFOs and wake up the readers that can be served.
+//
+void serial_intr(void) {
+  int woken = 0;
+
+  serial_tx_kick();
+
+  for (int i = 0; i < SERIAL_NPORTS; i++) {
+    struct serial_port *port = &ports[i];
+    while (UART_REG(port->base, UARTLITE_STAT) & UARTLITE_STAT_RX_VALID) {
+      char c = UART_REG(port->base, UARTLITE_RX);
+      if (port->rx_tail - port->rx_head < SERIAL_RX_RING_SIZE) {
+        port->rx_buf[port->rx_tail % SERIAL_RX_RING_SIZE] = c;
+        port->rx_tail++;
+      } else {
+        port->rx_dropped++;
+      }
+    }
+
+    while (port->waiters && port->rx_head != port->rx_tail) {
+      struct serial_waiter *w = port->waiters;
+      port->waiters = w->next;
+      serial_complete(port, w);
+      woken = 1;
+    }
+    serial_rx_publish(port);
+  }
+
+  // a woken reader of a higher priority class (e.g., motor control) runs right away
+  if (woken) preempt_current();
+}
+
+//
+// called on timer interrupts: expire the timeouts of uart_read() callers.
+//
+void serial_tick(void) {
+  uint64 now = timer_mtime();
+  for (int i = 0; i < SERIAL_NPORTS; i++) {
+    struct serial_waiter **pp = &ports[i].waiters;
+    while (*pp) {
+      struct serial_waiter *w = *pp;
+      if (w->deadline <= now) {
+        *pp = w->next;
+        serial_complete(&ports[i], w);
+      } else {
+        pp = &w->next;
+      }
+    }
+  }
+}
+
+//
+// the earliest uart_read() timeout, or TIMER_NO_DEADLINE.
+//
+uint64 serial_next_deadline(void) {
+  uint64 deadline = TIMER_NO_DEADLINE;
+  for (int i = 0; i < SERIAL_NPORTS; i++)
+    for (struct serial_waiter *w = ports[i].waiters; w; w = w->next)
+      deadline = MIN(deadline, w->deadline);
+  return deadline;
+}
@@ -0,0 +1,47 @@
+#ifndef _SERIAL_H_
+#define _SERIAL_H_
+
+#include "util/types.h"
+
+// the two AXI UART Lite controllers of the car: uart1 talks to the Bluetooth module,
+// uart2 drives the motor (servo) controller.
+#define UART1_BASE 0x60000000
+#define UART2_BASE 0x60001000
+
+// register offsets of an AXI UART Lite controller
+#define UARTLITE_RX   0x0
+#define UARTLITE_TX   0x4
+#define UARTLITE_STAT 0x8
+#define UARTLITE_CTRL 0xc
+
+// bits of the status register
+#define UARTLITE_STAT_RX_VALID 0x01
+#define UARTLITE_STAT_TX_EMPTY 0x04
+#define UARTLITE_STAT_TX_FULL  0x08
+
+// bits of the control register
+#define UARTLITE_CTRL_INTR_EN 0x10
+
+#define UART_REG(base, reg) (*(volatile uint32 *)(uint64)((base) + (reg)))
+
+// size of the uart2 transmit ring, must be a power of two
+#define SERIAL_TX_RING_SIZE 1024
+// size of the receive ring of each uart, must be a power of two
+#define SERIAL_RX_RING_SIZE 256
+
+// uarts that receive data
+enum serial_port_id {
+  SERIAL_BLUETOOTH = 0,  // uart1
+  SERIAL_MOTOR,          // uart2
+  SERIAL_NPORTS,
+};
+
+void serial_init(void);
+int serial_tx_write(const char *buf, int n);
+long serial_getchar(int port);
+long serial_read(int port, uint64 bufva, uint64 n, int64 timeout);
+void serial_intr(void);
+void serial_tick(void);
+uint64 serial_next_deadline(void);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * slab allocator for small kernel objects.
+ *
+ * every slab is one physical page starting with a struct slab header, the rest of the
+ * page is cut into objects of the cache's size. free objects are chained through their
+ * first word. kfree finds the header by rounding the object address down to its page,
+ * so objects need no per-object header.
+ */
+
+#include "slab.h"
+#include "pmm.h"
+#include "riscv.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+#define SLAB_MAGIC 0x51ab51ab
+#define SLAB_LARGE_MAGIC 0x1a26e51a
+
+// header at the beginning of every slab page, and of every large kmalloc block
+struct slab {
+  uint32 magic;
+  uint32 inuse;              // objects in use
+  struct kmem_cache *cache;  // owning cache, NULL for a large block
+  uint64 order;              // order of a large block
+  struct slab *prev;         // links in the cache's partial list
+  struct slab *next;
+  void *freelist;            // first free object
+};
+
+#define SLAB_HDR_SIZE ROUNDUP(sizeof(struct slab), 16)
+
+static struct kmem_cache kmalloc_caches[KMALLOC_NCLASSES] = {
+  {.name = "kmalloc-16", .size = 16},
+  {.name = "kmalloc-32", .size = 32},
+  {.name = "kmalloc-64", .size = 64},
+  {.name = "kmalloc-128", .size = 128},
+  {.name = "kmalloc-256", .size = 256},
+  {.name = "kmalloc-512", .size = 512},
+  {.name = "kmalloc-1024", .size = 1024},
+};
+
+static void partial_insert(struct kmem_cache *cache, struct slab *slab) {
+  slab->prev = NULL;
+  slab->next = cache->partial;
+  if (cache->partial) cache->partial->prev = slab;
+  cache->partial = slab;
+}
+
+static void partial_remove(struct kmem_cache *cache, struct slab *slab) {
+  if (slab->prev) slab->prev->next = slab->next;
+  else cache->partial = slab->next;
+  if (slab->next) slab->next->prev = slab->prev;
+  slab->prev = slab->next = NULL;
+}
+
+//
+// add a fresh page to the cache, with all its objects free
+//
+static struct slab *slab_grow(struct kmem_cache *cache) {
+  struct slab *slab = (struct slab *)alloc_page();
+  if (slab == NULL) return NULL;
+
+  slab->magic = SLAB_MAGIC;
+  slab->inuse = 0;
+  slab->cache = cache;
+  slab->order = 0;
+  slab->freelist = NULL;
+  // chain from the end so that objects are handed out in address order
+  for (uint64 off = SLAB_HDR_SIZE + (PGSIZE - SLAB_HDR_SIZE) / cache->size * cache->size;
+       off > SLAB_HDR_SIZE;) {
+    off -= cache->size;
+    void *obj = (char *)slab + off;
+    *(void **)obj = slab->freelist;
+    slab->freelist = obj;
+  }
+
+  partial_insert(cache, slab);
+  cache->nslabs++;
+  return slab;
+}
+
+//
+// create a cache for objects of "size" bytes. ctor, if given, initializes each object
+// that kmem_cache_alloc returns.
+//
+struct kmem_cache *kmem_cache_create(const char *name, uint64 size, void (*ctor)(void *obj)) {
+  size = ROUNDUP(MAX(size, sizeof(void *)), 8);
+  if (size > PGSIZE - SLAB_HDR_SIZE) {
+    sprint("kmem_cache_create: %s objects do not fit in a slab.\n", name);
+    return NULL;
+  }
+
+  struct kmem_cache *cache = kmalloc(sizeof(struct kmem_cache));
+  if (cache == NULL) return NULL;
+  cache->name = name;
+  cache->size = size;
+  cache->ctor = ctor;
+  cache->partial = NULL;
+  cache->nslabs = 0;
+  cache->nobjs = 0;
+  return cache;
+}
+
+//
+// allocate one object from the cache
+//
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+  struct slab *slab = cache->partial;
+  if (slab == NULL && (slab = slab_grow(cache)) == NULL) return NULL;
+
+  void *obj = slab->freelist;
+  slab->freelist = *(void **)obj;
+  slab->inuse++;
+  cache->nobjs++;
+  if (slab->freelist == NULL) partial_remove(cache, slab);
+
+  if (cache->ctor) cache->ctor(obj);
+  return obj;
+}
+
+//
+// return an object to its cache. a slab that becomes empty is given back to pmm,
+// unless it is the last one with free objects.
+//
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+  struct slab *slab = (struct slab *)ROUNDDOWN((uint64)obj, PGSIZE);
+  if (slab->magic != SLAB_MAGIC || slab->cache != cache)
+    panic("kmem_cache_free: 0x%lx does not belong to %s.\n", obj, cache->name);
+
+  if (slab->freelist == NULL) partial_insert(cache, slab);
+  *(void **)obj = slab->freelist;
+  slab->freelist = obj;
+  slab->inuse--;
+  cache->nobjs--;
+
+  if (slab->inuse == 0 && (slab->prev || slab->next)) {
+    partial_remove(cache, slab);
+    slab->magic = 0;
+    free_page(slab);
+    cache->nslabs--;
+  }
+}
+
+//
+// allocate "size" bytes of kernel memory. returns NULL when out of memory.
+//
+void *kmalloc(uint64 size) {
+  if (size == 0) return NULL;
+
+  int shift = KMALLOC_MIN_SHIFT;
+  while (shift <= KMALLOC_MAX_SHIFT && (1UL << shift) < size) shift++;
+  if (shift <= KMALLOC_MAX_SHIFT)
+    return kmem_cache_alloc(&kmalloc_caches[shift - KMALLOC_MIN_SHIFT]);
+
+  // too large for a size class: a block of pages behind a header
+  int order = pages_to_order(ROUNDUP(size + SLAB_HDR_SIZE, PGSIZE) / PGSIZE);
+  struct slab *block = alloc_pages(order);
+  if (block == NULL) return NULL;
+  block->magic = SLAB_LARGE_MAGIC;
+  block->cache = NULL;
+  block->order = order;
+  return (char *)block + SLAB_HDR_SIZE;
+}
+
+//
+// free memory obtained from kmalloc
+//
+void kfree(void *obj) {
+  if (obj == NULL) return;
+
+  struct slab *slab = (struct slab *)ROUNDDOWN((uint64)obj, PGSIZE);
+  if (slab->magic == SLAB_LARGE_MAGIC && (char *)obj == (char *)slab + SLAB_HDR_SIZE) {
+    slab->magic = 0;
+    free_pages(slab, slab->order);
+  } else if (slab->magic == SLAB_MAGIC && slab->cache >= kmalloc_caches &&
+             slab->cache < kmalloc_caches + KMALLOC_NCLASSES) {
+    kmem_cache_free(slab->cache, obj);
+  } else {
+    panic("kfree: 0x%lx was not allocated by kmalloc.\n", obj);
+  }
+}
+
+//
+// print the usage of the kmalloc size classes
+//
+void kmalloc_dump(void) {
+  for (int i = 0; i < KMALLOC_NCLASSES; i++)
+    sprint("%s: %ld objects in %ld slabs\n", kmalloc_caches[i].name,
+           kmalloc_caches[i].nobjs, kmalloc_caches[i].nslabs);
+}
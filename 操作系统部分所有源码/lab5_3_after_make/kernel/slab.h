@@ -0,0 +1,32 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "util/types.h"
+
+// size classes of kmalloc: 16, 32, ..., 1024 bytes. larger requests get whole pages.
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MAX_SHIFT 10
+#define KMALLOC_NCLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+struct slab;
+
+// a cache of equally sized objects, carved out of single pages (slabs)
+struct kmem_cache {
+  const char *name;
+  uint64 size;               // object size, rounded up to 8 bytes
+  void (*ctor)(void *obj);   // called on every object handed out, may be NULL
+  struct slab *partial;      // slabs that still have free objects
+  uint64 nslabs;             // pages owned by the cache
+  uint64 nobjs;              // objects in use
+};
+
+struct kmem_cache *kmem_cache_create(const char *name, uint64 size, void (*ctor)(void *obj));
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+void *kmalloc(uint64 size);
+void kfree(void *obj);
+// print the usage of the kmalloc size classes
+void kmalloc_dump(void);
+
+#endif
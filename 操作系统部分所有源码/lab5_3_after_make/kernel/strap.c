@@ -8,7 +8,14 @@
 #include "syscall.h"
 #include "pmm.h"
 #include "vmm.h"
+#include "vma.h"
 #include "sched.h"
+#include "klog.h"
+#include "serial.h"
+#include "futex.h"
+#include "timer.h"
+#include "vdso.h"
+#include "trace.h"
 #include "util/functions.h"
 
 #include "spike_interface/spike_utils.h"
@@ -27,52 +34,95 @@ static void handle_syscall(trapframe *tf) {
   // IMPORTANT: return value should be returned to user app, or else, you will encounter
   // problems in later experiments!
   //panic( "call do_syscall to accomplish the syscall and lab1_1 here.\n" );
+  // a syscall that puts the process to sleep does not come back here: its exit is
+  // the TRACE_TRAP_EXIT once the process runs again
+  long num = tf->regs.a0;
+  trace_event(TRACE_SYSCALL_ENTER, num, 0);
   tf->regs.a0=do_syscall((tf->regs.a0),(tf->regs.a1), (tf->regs.a2), (tf->regs.a3), (tf->regs.a4), (tf->regs.a5),(tf->regs.a6), (tf->regs.a7));
+  trace_event(TRACE_SYSCALL_EXIT, num, tf->regs.a0);
 
 }
 
+//
+// complete the waits whose time has come. their deadlines are mtime values, so this
+// is right on any timer interrupt.
+//
+void expire_timeouts(void) {
+  // expire uart_read() timeouts
+  serial_tick();
+
+  // expire futex_wait() timeouts
+  futex_tick();
+
+  // hand filled camera buffers to processes sleeping on them
+  capture_poll();
+}
+
 //
 // global variable that store the recorded "ticks". added @lab1_3
 static uint64 g_ticks = 0;
 //
-// added @lab1_3
+// added @lab1_3. the timer also interrupts early for the timer wheel (see
+// kernel/timer.c): such an interrupt only fires the timers that are due, a tick is
+// counted once the periodic deadline has passed.
+// returns non-zero if the interrupt was a tick.
 //
-void handle_mtimer_trap() {
-  sprint("Ticks %d\n", g_ticks);
+int handle_mtimer_trap() {
   // TODO (lab1_3): increase g_ticks to record this "tick", and then clear the "SIP"
   // field in sip register.
   // hint: use write_csr to disable the SIP_SSIP bit in sip.
   //panic( "lab1_3: increase g_ticks by one, and clear SIP field in sip register.\n" );
-  g_ticks++;
   write_csr(sip, 0);
 
+  // fire the sleeps and periodic timers that are due
+  timer_wheel_run();
+
+  // the M-mode handler left the timer off. it is turned back on before the tick work,
+  // so that nothing in there can leave it off.
+  int tick = timer_tick_due();
+  timer_rearm();
+
+  if (tick) {
+    klog(KLOG_TRAP, KLOG_INFO, "Ticks %d", g_ticks);
+    g_ticks++;
+    vdso_tick(g_ticks);
+    expire_timeouts();
+  }
+  return tick;
+}
+
+//
+// external interrupt routed through the PLIC. added @lab5_2
+//
+void handle_mexternal_trap() {
+  //reset the PLIC so that we can get the next external interrupt.
+  volatile int irq = *(uint32 *)0xc201004L;
+  *(uint32 *)0xc201004L = irq;
+  trace_event(TRACE_IRQ, irq, 0);
+  volatile int *ctrl_reg = (void *)(uintptr_t)0x6000000c;
+  *ctrl_reg = *ctrl_reg | (1 << 4);
+
+  // the uarts buffer received bytes in their rings and wake up the blocked
+  // readers; uart2 also gets its transmit FIFO refilled.
+  serial_intr();
 }
 
 //
 // the page fault handler. added @lab2_3. parameters:
 // sepc: the pc when fault happens;
 // stval: the virtual address that causes pagefault when being accessed.
+// pages of the process's regions are mapped on their first access, and copy-on-write
+// pages are copied on a store. any other fault stops the process.
 //
 void handle_user_page_fault(uint64 mcause, uint64 sepc, uint64 stval) {
-  sprint("handle_page_fault: %lx\n", stval);
-  switch (mcause) {
-    case CAUSE_STORE_PAGE_FAULT:
-      // TODO (lab2_3): implement the operations that solve the page fault to
-      // dynamically increase application stack.
-      // hint: first allocate a new physical page, and then, maps the new page to the
-      // virtual address that causes the page fault.
-      {
-      void* pa = alloc_page();
-      //分配一个物理页，将所分配的物理页面映射到stval所对应的虚拟地址上
-      user_vm_map((pagetable_t)current->pagetable, stval, 1, (uint64)pa, prot_to_type(PROT_WRITE | PROT_READ, 1));
-      }
-      //panic( "You need to implement the operations that actually handle the page fault in lab2_3.\n" );
-
-      break;
-    default:
-      sprint("unknown page fault.\n");
-      break;
-  }
+  trace_event(TRACE_PAGE_FAULT, mcause, stval);
+  if (vma_handle_fault(current, stval, mcause) == 0) return;
+
+  klog(KLOG_TRAP, KLOG_ERR,
+       "handle_page_fault: illegal access to 0x%lx at pc 0x%lx, process %d killed.",
+       stval, sepc, current->pid);
+  free_process(current);
+  schedule();
 }
 
 //
@@ -83,6 +133,13 @@ void rrsched() {
   // hint: increase the tick_count member of current process by one, if it is bigger than
   // TIME_SLICE_LEN (means it has consumed its time slice), change its status into READY,
   // place it in the rear of ready queue, and finally schedule next process to run.
+  // a higher-priority process woken up since the last tick (e.g., by a timeout) takes
+  // over right away, without waiting for the time slice to run out.
+  if( should_preempt() ){
+    current->tick_count = 0;
+    preempt_current();
+  }
+
   current->tick_count++;
   if(current->tick_count >= TIME_SLICE_LEN)
   {
@@ -111,6 +168,8 @@ void smode_trap_handler(void) {
   // if the cause of trap is syscall from user application.
   // read_csr() and CAUSE_USER_ECALL are macros defined in kernel/riscv.h
   uint64 cause = read_csr(scause);
+  // interrupts keep their top bit as bit 31 of the event
+  trace_event(TRACE_TRAP_ENTER, (uint32)cause | (uint32)(cause >> 63) << 31, 0);
 
   // use switch-case instead of if-else, as there are many cases since lab2_3.
   switch (cause) {
@@ -118,40 +177,20 @@ void smode_trap_handler(void) {
       handle_syscall(current->trapframe);
       break;
     case CAUSE_MTIMER_S_TRAP:
-      handle_mtimer_trap();
-      // invoke round-robin scheduler. added @lab3_3
-      rrsched();
+      // invoke round-robin scheduler on ticks. added @lab3_3
+      // an early interrupt of the timer wheel only lets a process it woke take over.
+      if (handle_mtimer_trap())
+        rrsched();
+      else
+        preempt_current();
       break;
     // added @lab5_2
     case CAUSE_MEXTERNEL_S_TRAP:
-      {
-        //reset the PLIC so that we can get the next external interrupt.
-        volatile int irq = *(uint32 *)0xc201004L;
-        *(uint32 *)0xc201004L = irq;
-        volatile int *ctrl_reg = (void *)(uintptr_t)0x6000000c;
-        *ctrl_reg = *ctrl_reg | (1 << 4);
-        // TODO (lab5_2): implment the case of CAUSE_MEXTERNEL_S_TRAP.
-        // hint: the case of CAUSE_MEXTERNEL_S_TRAP is to get data from UART address and wake 
-        // the process. therefore, you need to construct an update_uartvalue_ctx structure
-        // then store the interrupt processing process pid and the uart value in it
-        // and use this structure to update the wake callback context of the process
-        // finally call do_wake to wake up the process.
-        volatile uint32 *rx = (void*)(uintptr_t)0x60000000;
-        uint32 data = *rx;
-
-        uint64 handle_intr_pid = 0;  // the pid of the process that will handle this interrupt
-        struct update_uartvalue_ctx *ctx = (struct update_uartvalue_ctx *)alloc_page();
-        ctx->uartvalue = (char)data;
-        ctx->pid = handle_intr_pid;
-        set_wake_callback(handle_intr_pid, NULL, ctx);  // add wake callback context
-
-        do_wake(handle_intr_pid);
-        //panic( "You have to implement CAUSE_MEXTERNEL_S_TRAP to get data from UART and wake the process 0 in lab5_2.\n" );
-
-        break;
-      }
+      handle_mexternal_trap();
+      break;
     case CAUSE_STORE_PAGE_FAULT:
     case CAUSE_LOAD_PAGE_FAULT:
+    case CAUSE_FETCH_PAGE_FAULT:
       // the address of missing page is stored in stval
       // call handle_user_page_fault to process page faults
       handle_user_page_fault(cause, read_csr(sepc), read_csr(stval));
@@ -2,5 +2,8 @@
 #define _STRAP_H_
 
 void smode_trap_handler(void);
+int handle_mtimer_trap();
+void expire_timeouts(void);
+void handle_mexternal_trap();
 
 #endif
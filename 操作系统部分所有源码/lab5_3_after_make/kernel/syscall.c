@@ -12,8 +12,17 @@
 #include "util/functions.h"
 #include "pmm.h"
 #include "vmm.h"
+#include "vma.h"
+#include "slab.h"
+#include "memlayout.h"
 #include "sched.h"
+#include "klog.h"
 #include "proc_file.h"
+#include "hostfs.h"
+#include "serial.h"
+#include "futex.h"
+#include "timer.h"
+#include "trace.h"
 
 #include "spike_interface/spike_utils.h"
 
@@ -24,6 +33,7 @@ ssize_t sys_user_print(const char* buf, size_t n) {
   // buf is now an address in user space of the given app's user stack,
   // so we have to transfer it into phisical address (kernel is running in direct mapping).
   assert( current );
+  vma_prepare(current, (uint64)buf, 1, 0);
   char* pa = (char*)user_va_to_pa((pagetable_t)(current->pagetable), (void*)buf);
   sprint(pa);
   return 0;
@@ -33,7 +43,7 @@ ssize_t sys_user_print(const char* buf, size_t n) {
 // implement the SYS_user_exit syscall
 //
 ssize_t sys_user_exit(uint64 code) {
-  sprint("User exit with code:%d.\n", code);
+  klog(KLOG_PROC, KLOG_INFO, "User exit with code:%d.", code);
   // reclaim the current process, and reschedule. added @lab3_1
   free_process( current );
   schedule();
@@ -42,35 +52,53 @@ ssize_t sys_user_exit(uint64 code) {
 
 //
 // maybe, the simplest implementation of malloc in the world ... added @lab2_2
+// the page is only reserved here, it gets memory on its first access.
 //
 uint64 sys_user_allocate_page() {
-  void* pa = alloc_page();
-  uint64 va;
-  // if there are previously reclaimed pages, use them first (this does not change the
-  // size of the heap)
-  if (current->user_heap.free_pages_count > 0) {
-    va =  current->user_heap.free_pages_address[--current->user_heap.free_pages_count];
-    assert(va < current->user_heap.heap_top);
-  } else {
-    // otherwise, allocate a new page (this increases the size of the heap by one page)
-    va = current->user_heap.heap_top;
-    current->user_heap.heap_top += PGSIZE;
-
-    current->mapped_info[HEAP_SEGMENT].npages++;
+  // if there are previously reclaimed pages (holes in the heap), use them first (this
+  // does not change the size of the heap)
+  uint64 va = vma_find_gap(current, current->user_heap.heap_bottom, PGSIZE);
+  if (vma_add(current, va, va + PGSIZE, HEAP_SEGMENT, PROT_READ | PROT_WRITE) == NULL)
+    return -1;
+
+  // otherwise, the heap grows by one page
+  if (va + PGSIZE > current->user_heap.heap_top) current->user_heap.heap_top = va + PGSIZE;
+  return va;
+}
+
+//
+// move the program break (the end of the heap) by "increment" bytes, in one trap for
+// any size. new heap pages get memory on their first access, released pages are
+// unmapped right away.
+// return: the previous break, or -1 if the heap cannot grow or shrink that far.
+//
+uint64 sys_user_sbrk(int64 increment) {
+  uint64 old_brk = current->user_heap.heap_top;
+  uint64 new_brk = old_brk + increment;
+  if (new_brk < current->user_heap.heap_bottom || new_brk > USER_SHARE_MEMORY_START)
+    return -1;
+
+  uint64 old_end = ROUNDUP(old_brk, PGSIZE), new_end = ROUNDUP(new_brk, PGSIZE);
+  if (new_end > old_end) {
+    if (vma_add(current, old_end, new_end, HEAP_SEGMENT, PROT_READ | PROT_WRITE) == NULL)
+      return -1;
+  } else if (new_end < old_end) {
+    vma_remove(current, new_end, old_end);
   }
-  user_vm_map((pagetable_t)current->pagetable, va, PGSIZE, (uint64)pa,
-         prot_to_type(PROT_WRITE | PROT_READ, 1));
 
-  return va;
+  current->user_heap.heap_top = new_brk;
+  return old_brk;
 }
 
 //
 // reclaim a page, indicated by "va". added @lab2_2
 //
 uint64 sys_user_free_page(uint64 va) {
-  user_vm_unmap((pagetable_t)current->pagetable, va, PGSIZE, 1);
-  // add the reclaimed page to the free page list
-  current->user_heap.free_pages_address[current->user_heap.free_pages_count++] = va;
+  vm_area *vma = vma_find(current, va);
+  if (vma == NULL || vma->seg_type != HEAP_SEGMENT) return -1;
+
+  // the page becomes a hole in the heap, reused by the next allocation
+  vma_remove(current, va, va + PGSIZE);
   return 0;
 }
 
@@ -79,20 +107,20 @@ uint64 sys_user_free_page(uint64 va) {
 //
 uint64 sys_user_allocate_share_page() {
     void* pa = alloc_page();
+    if (pa == NULL) return -1;
     memset((void *)pa, 0, PGSIZE);
-    uint64 va = current->share_memory_top;
-    current->share_memory_top += PGSIZE;
+    uint64 va = vma_find_gap(current, USER_SHARE_MEMORY_START, PGSIZE);
+    // shared pages are mapped right away, so that a later fork shares them
+    vma_add(current, va, va + PGSIZE, SHARE_SEGMENT, PROT_READ | PROT_WRITE);
     user_vm_map((pagetable_t)current->pagetable, va, PGSIZE, (uint64)pa,
             prot_to_type(PROT_WRITE | PROT_READ, 1));
-
-    current->mapped_info[SHARE_SEGMENT].npages++;
     return va;
 }
 //
 // kerenl entry point of naive_fork
 //
 ssize_t sys_user_fork() {
-  sprint("User call fork.\n");
+  klog(KLOG_PROC, KLOG_INFO, "User call fork.");
   return do_fork( current );
 }
 
@@ -116,40 +144,103 @@ ssize_t sys_user_yield() {
 // open file
 //
 ssize_t sys_user_open(char *pathva, int flags) {
+  vma_prepare(current, (uint64)pathva, 1, 0);
   char* pathpa = (char*)user_va_to_pa((pagetable_t)(current->pagetable), pathva);
   return do_open(pathpa, flags);
 }
 
 //
-// read file
+// describe the user buffer [bufva, bufva + count) of current, mapped by vma_prepare(),
+// as segments of physical memory. pages that are also adjacent in physical memory
+// share a segment. the caller frees iov->segs.
 //
-ssize_t sys_user_read(int fd, char *bufva, uint64 count) {
-  int i = 0;
-  while (i < count) { // count can be greater than page size
-    uint64 addr = (uint64)bufva + i;
+static int user_io_vec(char *bufva, uint64 count, struct io_vec *iov) {
+  uint64 va = (uint64)bufva;
+  uint64 npages = (ROUNDUP(va + count, PGSIZE) - ROUNDDOWN(va, PGSIZE)) / PGSIZE;
+  iov->segs = kmalloc(MAX(npages, 1) * sizeof(struct io_seg));
+  iov->nsegs = 0;
+  iov->len = count;
+
+  uint64 done = 0;
+  while (done < count) { // count can be greater than page size
+    uint64 addr = va + done;
     uint64 pa = lookup_pa((pagetable_t)current->pagetable, addr);
+    if (pa == 0) {
+      kfree(iov->segs);
+      return -1;
+    }
     uint64 off = addr - ROUNDDOWN(addr, PGSIZE);
-    uint64 len = count - i < PGSIZE - off ? count - i : PGSIZE - off;
-    uint64 r = do_read(fd, (char *)pa + off, len);
-    i += r; if (r < len) return i;
+    uint64 len = MIN(count - done, PGSIZE - off);
+    char *base = (char *)pa + off;
+
+    struct io_seg *last = iov->nsegs > 0 ? &iov->segs[iov->nsegs - 1] : NULL;
+    if (last && last->base + last->len == base) {
+      last->len += len;
+    } else {
+      iov->segs[iov->nsegs].base = base;
+      iov->segs[iov->nsegs].len = len;
+      iov->nsegs++;
+    }
+    done += len;
   }
-  return count;
+  return 0;
+}
+
+//
+// copy n bytes from kernel memory at "src" to the user buffer at va of current
+// return: 0 on success, -1 if the buffer is not valid.
+//
+static int user_copy_out(uint64 va, const void *src, uint64 n) {
+  struct io_vec iov;
+  if (vma_prepare(current, va, n, 1) != 0) return -1;
+  if (user_io_vec((char *)va, n, &iov) != 0) return -1;
+  io_vec_copy_to(&iov, 0, src, n);
+  kfree(iov.segs);
+  return 0;
+}
+
+//
+// copy n bytes from the user buffer at va of current to kernel memory at "dst"
+// return: 0 on success, -1 if the buffer is not valid.
+//
+static int user_copy_in(uint64 va, void *dst, uint64 n) {
+  struct io_vec iov;
+  if (vma_prepare(current, va, n, 0) != 0) return -1;
+  if (user_io_vec((char *)va, n, &iov) != 0) return -1;
+  io_vec_copy_from(&iov, 0, dst, n);
+  kfree(iov.segs);
+  return 0;
 }
 
 //
-// write file
+// read file. the file system copies the data straight into the pages of bufva.
+//
+ssize_t sys_user_read(int fd, char *bufva, uint64 count) {
+  struct io_vec iov;
+  if (vma_prepare(current, (uint64)bufva, count, 1) != 0) return -1;
+  if (user_io_vec(bufva, count, &iov) != 0) return -1;
+  ssize_t r = do_read(fd, &iov);
+  kfree(iov.segs);
+  return r;
+}
+
+//
+// write file. the file system copies the data straight from the pages of bufva.
 //
 ssize_t sys_user_write(int fd, char *bufva, uint64 count) {
-  int i = 0;
-  while (i < count) { // count can be greater than page size
-    uint64 addr = (uint64)bufva + i;
-    uint64 pa = lookup_pa((pagetable_t)current->pagetable, addr);
-    uint64 off = addr - ROUNDDOWN(addr, PGSIZE);
-    uint64 len = count - i < PGSIZE - off ? count - i : PGSIZE - off;
-    uint64 r = do_write(fd, (char *)pa + off, len);
-    i += r; if (r < len) return i;
-  }
-  return count;
+  struct io_vec iov;
+  if (vma_prepare(current, (uint64)bufva, count, 0) != 0) return -1;
+  if (user_io_vec(bufva, count, &iov) != 0) return -1;
+  ssize_t r = do_write(fd, &iov);
+  kfree(iov.segs);
+  return r;
+}
+
+//
+// sync file
+//
+ssize_t sys_user_fsync(int fd) {
+  return do_fsync(fd);
 }
 
 //
@@ -163,6 +254,7 @@ ssize_t sys_user_lseek(int fd, int offset, int whence) {
 // read vinode
 //
 ssize_t sys_user_stat(int fd, struct istat *istat) {
+  if (vma_prepare(current, (uint64)istat, sizeof(struct istat), 1) != 0) return -1;
   struct istat * pistat = (struct istat *)user_va_to_pa((pagetable_t)(current->pagetable), istat);
   return do_stat(fd, pistat);
 }
@@ -171,6 +263,7 @@ ssize_t sys_user_stat(int fd, struct istat *istat) {
 // read disk inode
 //
 ssize_t sys_user_disk_stat(int fd, struct istat *istat) {
+  if (vma_prepare(current, (uint64)istat, sizeof(struct istat), 1) != 0) return -1;
   struct istat * pistat = (struct istat *)user_va_to_pa((pagetable_t)(current->pagetable), istat);
   return do_disk_stat(fd, pistat);
 }
@@ -186,6 +279,7 @@ ssize_t sys_user_close(int fd) {
 // lib call to opendir
 //
 ssize_t sys_user_opendir(char * pathva){
+  vma_prepare(current, (uint64)pathva, 1, 0);
   char * pathpa = (char*)user_va_to_pa((pagetable_t)(current->pagetable), pathva);
   return do_opendir(pathpa);
 }
@@ -194,6 +288,7 @@ ssize_t sys_user_opendir(char * pathva){
 // lib call to readdir
 //
 ssize_t sys_user_readdir(int fd, struct dir *vdir){
+  if (vma_prepare(current, (uint64)vdir, sizeof(struct dir), 1) != 0) return -1;
   struct dir * pdir = (struct dir *)user_va_to_pa((pagetable_t)(current->pagetable), vdir);
   return do_readdir(fd, pdir);
 }
@@ -202,6 +297,7 @@ ssize_t sys_user_readdir(int fd, struct dir *vdir){
 // lib call to mkdir
 //
 ssize_t sys_user_mkdir(char * pathva){
+  vma_prepare(current, (uint64)pathva, 1, 0);
   char * pathpa = (char*)user_va_to_pa((pagetable_t)(current->pagetable), pathva);
   return do_mkdir(pathpa);
 }
@@ -217,7 +313,9 @@ ssize_t sys_user_closedir(int fd){
 // lib call to link
 //
 ssize_t sys_user_link(char * vfn1, char * vfn2){
+  vma_prepare(current, (uint64)vfn1, 1, 0);
   char * pfn1 = (char*)user_va_to_pa((pagetable_t)(current->pagetable), (void*)vfn1);
+  vma_prepare(current, (uint64)vfn2, 1, 0);
   char * pfn2 = (char*)user_va_to_pa((pagetable_t)(current->pagetable), (void*)vfn2);
   return do_link(pfn1, pfn2);
 }
@@ -226,6 +324,7 @@ ssize_t sys_user_link(char * vfn1, char * vfn2){
 // lib call to unlink
 //
 ssize_t sys_user_unlink(char * vfn){
+  vma_prepare(current, (uint64)vfn, 1, 0);
   char * pfn = (char*)user_va_to_pa((pagetable_t)(current->pagetable), (void*)vfn);
   return do_unlink(pfn);
 }
@@ -240,45 +339,149 @@ void sys_user_uart_putchar(uint8 ch) {
   *tx = ch;
 }
 
-// added @lab5_2. Sets the return value of the uart_getchar system call, which should be called
-// when waking up the process. For ctx, there needs to be the process number that initiates 
-// the system call and the data obtained from the uart device.
-void update_uartvalue(void *ctx) {
-  struct update_uartvalue_ctx *uart_ctx = (struct update_uartvalue_ctx *)ctx;
-  char value = uart_ctx->uartvalue;
-  process *proc = &procs[uart_ctx->pid];
-
-  // set system call return value
-  proc->trapframe->regs.a0 = (uint64)value;
+// added @lab5_1. the byte comes from the uart1 receive ring; if it is empty the
+// process sleeps until the uart interrupt delivers one.
+ssize_t sys_user_uart_getchar() {
+  return serial_getchar(SERIAL_BLUETOOTH);
 }
 
-// added @lab5_1
-ssize_t sys_user_uart_getchar() {
-  // TODO (lab5_1 and lab5_2): implment the syscall of sys_user_uart_getchar and modify it in lab5_2.
-  // hint (lab5_1): the functionality of sys_user_uart_getchar is to get data from UART address.
-  // therefore, we should let a pointer point, insert it in 
-  // the rear of ready queue, and finally, schedule a READY process to run.
-  // hint (lab5_2): the functionality of sys_user_uart_getchar is let process sleep
-  // and register a callback function to handle system call return value.
-  // therefore, we should call do_sleep to let process 0 sleep. 
-  // Note that the do_sleep function will never return, and the function passed to do_sleep
-  // will be called in do_wake.
-  volatile uint32 *status = (void*)(uintptr_t)0x60000008;
-  volatile uint32 *rx = (void*)(uintptr_t)0x60000000;
-  while (!(*status & 0x00000001));
-  return *rx;
-  //panic( "You have to implement sys_user_uart_getchar to get data from UART using uartgetchar in lab5_1 and modify it in lab5_2.\n" );
+//
+// read up to n bytes from the Bluetooth uart into bufva, waiting at most "timeout"
+// ticks (forever if negative) for the first one.
+//
+ssize_t sys_user_uart_read(char *bufva, uint64 n, int64 timeout) {
+  if (vma_prepare(current, (uint64)bufva, n, 1) != 0) return -1;
+  return serial_read(SERIAL_BLUETOOTH, (uint64)bufva, n, timeout);
 }
 
 // used for car control. added @lab5_1
 void sys_user_uart2_putchar(uint8 ch) {
-  volatile uint32 *status = (void*)(uintptr_t)0x60001008;
-  volatile uint32 *tx = (void*)(uintptr_t)0x60001004;
-  while (*status & 0x00000008);
-  *tx = ch;
+  char c = ch;
+  serial_tx_write(&c, 1);
+}
+
+//
+// queue a whole command for uart2. the bytes go out from the uart2 interrupt, so the
+// caller neither traps per byte nor waits for the transmission.
+// return: the number of bytes queued.
+//
+ssize_t sys_user_uart2_write(char *bufva, uint64 n) {
+  uint64 i = 0;
+  if (vma_prepare(current, (uint64)bufva, n, 0) != 0) return -1;
+  while (i < n) {  // the buffer may cross a page boundary
+    uint64 addr = (uint64)bufva + i;
+    uint64 pa = lookup_pa((pagetable_t)current->pagetable, addr);
+    uint64 off = addr - ROUNDDOWN(addr, PGSIZE);
+    uint64 len = n - i < PGSIZE - off ? n - i : PGSIZE - off;
+    if (pa == 0) return -1;
+    int r = serial_tx_write((char *)pa + off, len);
+    i += r; if (r < len) break;
+  }
+  return i;
+}
+
+//
+// move the current process into priority class "prio" (see kernel/sched.h)
+//
+ssize_t sys_user_set_priority(int prio) {
+  if (prio < 0 || prio >= SCHED_NPRIO) return -1;
+  current->priority = prio;
+  return 0;
+}
+
+//
+// translate the futex word at uaddr of current. the page is made private first if it is
+// copy-on-write, so the word keeps its physical address while current waits on it.
+// return: the physical address of the word, or 0 if uaddr is not a valid word.
+//
+static uint64 futex_word_pa(uint64 uaddr) {
+  if ((uaddr & 3) || vma_prepare(current, uaddr, 4, 1) != 0) return 0;
+  uint64 pa = lookup_pa((pagetable_t)current->pagetable, uaddr);
+  return pa ? pa + (uaddr & (PGSIZE - 1)) : 0;
+}
+
+//
+// sleep while the word at uaddr holds "expected", for at most "timeout" ticks
+//
+ssize_t sys_user_futex_wait(uint64 uaddr, uint32 expected, int64 timeout) {
+  uint64 pa = futex_word_pa(uaddr);
+  if (pa == 0) return -1;
+  return futex_wait(pa, expected, timeout);
+}
+
+//
+// wake up at most n processes waiting on the word at uaddr
+//
+ssize_t sys_user_futex_wake(uint64 uaddr, int n) {
+  uint64 pa = futex_word_pa(uaddr);
+  if (pa == 0) return -1;
+  return futex_wake(pa, n);
+}
+
+//
+// kernel log commands (KLOG_CMD_*, see kernel/klog.h)
+//
+ssize_t sys_user_klog(int cmd, uint64 arg0, uint64 arg1) {
+  switch (cmd) {
+    case KLOG_CMD_FLUSH:
+      klog_flush();
+      return 0;
+    case KLOG_CMD_DUMP: {
+      if (vma_prepare(current, arg0, 1, 0) != 0) return -1;
+      char *pathpa = (char *)user_va_to_pa((pagetable_t)(current->pagetable), (void *)arg0);
+      return klog_dump(pathpa);
+    }
+    case KLOG_CMD_SET_LEVEL:
+      return klog_set_level(arg0, arg1);
+    default:
+      return -1;
+  }
+}
+
+//
+// the time since boot, from the CLINT mtime counter
+//
+ssize_t sys_user_clock_gettime(uint64 tsva) {
+  struct ktimespec ts;
+  mtime_to_timespec(timer_mtime(), &ts);
+  return user_copy_out(tsva, &ts, sizeof(ts));
+}
+
+//
+// sleep for the duration at reqva, without taking the CPU
+//
+ssize_t sys_user_nanosleep(uint64 reqva) {
+  struct ktimespec req;
+  if (user_copy_in(reqva, &req, sizeof(req)) != 0) return -1;
+  if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) return -1;
+  return timer_sleep(timespec_to_mtime(&req));
+}
+
+//
+// start a timer expiring at a fixed rate, with the period at periodva
+//
+ssize_t sys_user_timer_create(uint64 periodva) {
+  struct ktimespec period;
+  if (user_copy_in(periodva, &period, sizeof(period)) != 0) return -1;
+  if (period.tv_sec < 0 || period.tv_nsec < 0 || period.tv_nsec >= 1000000000) return -1;
+  return timer_periodic_create(timespec_to_mtime(&period));
+}
+
+//
+// kernel trace commands (TRACE_CMD_*, see kernel/trace.h)
+//
+ssize_t sys_user_trace(int cmd, uint64 pathva) {
+  char *pathpa = NULL;
+  if (cmd == TRACE_CMD_DUMP) {
+    if (vma_prepare(current, pathva, 1, 0) != 0) return -1;
+    pathpa = (char *)user_va_to_pa((pagetable_t)(current->pagetable), (void *)pathva);
+  }
+  return trace_control(cmd, pathpa);
 }
 
 ssize_t sys_user_ioctl(int fd, uint64 request, char *datava) {
+    if (datava && vma_prepare(current, (uint64)datava, MAX(V4L2_IOC_SIZE(request), 1), 1) != 0)
+      return -1;
     char* datapa = (char*)user_va_to_pa((pagetable_t)(current->pagetable), datava);
     return do_ioctl(fd, request, datapa);
 }
@@ -293,6 +496,7 @@ ssize_t sys_user_munmap(char *addr, uint64 length) {
 
 ssize_t sys_user_readmmap(char *dstva, char *src, uint64 count) {
     int i = 0;
+    if (vma_prepare(current, (uint64)dstva, count, 1) != 0) return -1;
     while (i < count) {
         uint64 addr = (uint64)dstva + i;
         uint64 pa = lookup_pa((pagetable_t)current->pagetable, addr);
@@ -334,6 +538,8 @@ long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, l
       return sys_user_write(a1, (char *)a2, a3);
     case SYS_user_lseek:
       return sys_user_lseek(a1, a2, a3);
+    case SYS_user_fsync:
+      return sys_user_fsync(a1);
     case SYS_user_stat:
       return sys_user_stat(a1, (struct istat *)a2);
     case SYS_user_disk_stat:
@@ -358,10 +564,7 @@ long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, l
     case SYS_user_uart_putchar:
       sys_user_uart_putchar(a1);return 1;
     case SYS_user_uart_getchar:
-      //modified by lab5_2
-      do_sleep(update_uartvalue, NULL);
-      return 0;
-      //return sys_user_uart_getchar();
+      return sys_user_uart_getchar();
     case SYS_user_uart2_putchar:
 	    sys_user_uart2_putchar(a1);return 1;
     case SYS_user_ioctl:
@@ -374,6 +577,32 @@ long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, l
       return sys_user_readmmap((char *)a1, (char *)a2, a3);
     case SYS_user_allocate_share_page:
       return sys_user_allocate_share_page();
+    case SYS_user_uart2_write:
+      return sys_user_uart2_write((char *)a1, a2);
+    case SYS_user_uart_read:
+      return sys_user_uart_read((char *)a1, a2, a3);
+    case SYS_user_set_priority:
+      return sys_user_set_priority(a1);
+    case SYS_user_sbrk:
+      return sys_user_sbrk(a1);
+    case SYS_user_futex_wait:
+      return sys_user_futex_wait(a1, a2, a3);
+    case SYS_user_futex_wake:
+      return sys_user_futex_wake(a1, a2);
+    case SYS_user_klog:
+      return sys_user_klog(a1, a2, a3);
+    case SYS_user_clock_gettime:
+      return sys_user_clock_gettime(a1);
+    case SYS_user_nanosleep:
+      return sys_user_nanosleep(a1);
+    case SYS_user_timer_create:
+      return sys_user_timer_create(a1);
+    case SYS_user_timer_wait:
+      return timer_periodic_wait(a1);
+    case SYS_user_timer_close:
+      return timer_periodic_close(a1);
+    case SYS_user_trace:
+      return sys_user_trace(a1, a2);
     default:
       panic("Unknown syscall %ld \n", a0);
   }
@@ -40,6 +40,29 @@
 #define SYS_user_munmap (SYS_user_base + 35)
 #define SYS_user_readmmap (SYS_user_base + 36)
 #define SYS_user_allocate_share_page (SYS_user_base + 37)
+// buffered, interrupt-driven uart2 output
+#define SYS_user_uart2_write (SYS_user_base + 38)
+// buffered Bluetooth input with a timeout
+#define SYS_user_uart_read (SYS_user_base + 39)
+// scheduling priority class
+#define SYS_user_set_priority (SYS_user_base + 40)
+// move the end of the heap
+#define SYS_user_sbrk (SYS_user_base + 41)
+// wait on / wake up a word of (shared) memory
+#define SYS_user_futex_wait (SYS_user_base + 42)
+#define SYS_user_futex_wake (SYS_user_base + 43)
+// push the buffered writes of a file to its storage
+#define SYS_user_fsync (SYS_user_base + 44)
+// flush, dump or configure the kernel log
+#define SYS_user_klog (SYS_user_base + 45)
+// monotonic clock, sleeps and periodic timers
+#define SYS_user_clock_gettime (SYS_user_base + 46)
+#define SYS_user_nanosleep (SYS_user_base + 47)
+#define SYS_user_timer_create (SYS_user_base + 48)
+#define SYS_user_timer_wait (SYS_user_base + 49)
+#define SYS_user_timer_close (SYS_user_base + 50)
+// start, stop, clear or dump the kernel trace
+#define SYS_user_trace (SYS_user_base + 51)
 
 long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, long a7);
 
@@ -0,0 +1,304 @@
+/*
+ * Supervisor-mode access to the CLINT timer.
+ *
+ * the M-mode timer handler only turns the timer off and passes the interrupt on, the
+ * S-mode handler programs mtimecmp for the next one: normally the periodic tick, every
+ * TIMER_INTERVAL from a fixed phase. when the kernel idles it programs mtimecmp to the
+ * nearest deadline of the subsystems instead, and restores the periodic tick once a
+ * process is READY again.
+ *
+ * timers with a finer resolution than the tick (sleeps, periodic timers of apps) sit
+ * on a timer wheel. mtimecmp is pulled in to the earliest of them, so they fire on
+ * time whether the kernel idles or not. such an early interrupt is not a tick.
+ */
+
+#include "timer.h"
+#include "config.h"
+#include "riscv.h"
+#include "process.h"
+#include "proc_file.h"
+#include "sched.h"
+#include "serial.h"
+#include "futex.h"
+#include "util/functions.h"
+
+// the slots of the wheel, each an unsorted list of timers
+static struct ktimer *wheel[TIMER_WHEEL_SLOTS];
+// the first grain (mtime / TIMER_WHEEL_GRAIN) not fully expired yet
+static uint64 wheel_clock;
+// mtime of the next periodic tick. timerinit() (kernel/machine/minit.c) programs the
+// first one TIMER_INTERVAL after boot.
+static uint64 next_tick = TIMER_INTERVAL;
+
+//
+// current value of the CLINT mtime counter
+//
+uint64 timer_mtime(void) {
+  return *(volatile uint64 *)CLINT_MTIME;
+}
+
+//
+// fire the next timer interrupt when mtime reaches "deadline"
+//
+void timer_program(uint64 deadline) {
+  *(volatile uint64 *)CLINT_MTIMECMP(0) = deadline;
+}
+
+//
+// make the next timer interrupt fire at "deadline" at the latest
+//
+static void timer_pull_in(uint64 deadline) {
+  if (deadline < *(volatile uint64 *)CLINT_MTIMECMP(0)) timer_program(deadline);
+}
+
+//
+// go back to the periodic tick, starting TIMER_INTERVAL from now. a timer of the wheel
+// due earlier still gets its interrupt.
+//
+void timer_resume_periodic(void) {
+  next_tick = timer_mtime() + TIMER_INTERVAL;
+  timer_rearm();
+}
+
+//
+// returns non-zero if the periodic tick is due, and moves it on to the next period
+// after now. ticks missed in the meantime are skipped, the phase is kept.
+//
+int timer_tick_due(void) {
+  uint64 now = timer_mtime();
+  if (now < next_tick) return 0;
+  next_tick += ((now - next_tick) / TIMER_INTERVAL + 1) * TIMER_INTERVAL;
+  return 1;
+}
+
+//
+// program the next timer interrupt: the next tick, or a timer of the wheel due earlier
+//
+void timer_rearm(void) {
+  timer_program(MIN(next_tick, timer_wheel_next_deadline()));
+}
+
+//
+// the earliest mtime at which a subsystem needs the timer, or TIMER_NO_DEADLINE.
+//
+uint64 timer_next_deadline(void) {
+  return MIN(MIN(serial_next_deadline(), capture_next_deadline()),
+             MIN(futex_next_deadline(), timer_wheel_next_deadline()));
+}
+
+//
+// put t on the wheel, to fire once mtime reaches "expires". a timer that is already
+// due fires on the next timer interrupt.
+//
+void ktimer_add(struct ktimer *t, uint64 expires) {
+  t->expires = expires;
+  uint64 grain = MAX(expires / TIMER_WHEEL_GRAIN, wheel_clock);
+  struct ktimer **slot = &wheel[grain & (TIMER_WHEEL_SLOTS - 1)];
+
+  t->next = *slot;
+  if (t->next) t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+
+  timer_pull_in(expires);
+}
+
+//
+// take t off the wheel, if it is on it
+//
+void ktimer_cancel(struct ktimer *t) {
+  if (t->pprev == NULL) return;
+  *t->pprev = t->next;
+  if (t->next) t->next->pprev = t->pprev;
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+//
+// called on timer interrupts: fire the timers that are due. only the slots passed
+// since the last call are visited, at most one turn of the wheel.
+//
+void timer_wheel_run(void) {
+  uint64 now = timer_mtime();
+  uint64 end = now / TIMER_WHEEL_GRAIN;
+  uint64 nslots = MIN(end - wheel_clock + 1, TIMER_WHEEL_SLOTS);
+
+  // the due timers are taken off first, as their callbacks may add timers again
+  struct ktimer *due = NULL;
+  for (uint64 i = 0; i < nslots; i++) {
+    struct ktimer *t = wheel[(wheel_clock + i) & (TIMER_WHEEL_SLOTS - 1)];
+    while (t) {
+      struct ktimer *next = t->next;
+      if (t->expires <= now) {
+        ktimer_cancel(t);
+        t->next = due;
+        due = t;
+      }
+      t = next;
+    }
+  }
+  // timers later in the grain of "now" are still in its slot
+  wheel_clock = end;
+
+  while (due) {
+    struct ktimer *t = due;
+    due = t->next;
+    t->next = NULL;
+    t->fn(t);
+  }
+
+  timer_pull_in(timer_wheel_next_deadline());
+}
+
+//
+// the expiry time of the earliest timer on the wheel, or TIMER_NO_DEADLINE. the slots
+// are searched in time order, for a timer due in the current turn of the wheel.
+//
+uint64 timer_wheel_next_deadline(void) {
+  uint64 deadline = TIMER_NO_DEADLINE;
+  for (uint64 i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+    uint64 turn_end = (wheel_clock + i + 1) * TIMER_WHEEL_GRAIN;
+    for (struct ktimer *t = wheel[(wheel_clock + i) & (TIMER_WHEEL_SLOTS - 1)]; t; t = t->next)
+      if (t->expires < turn_end) deadline = MIN(deadline, t->expires);
+    if (deadline != TIMER_NO_DEADLINE) return deadline;
+  }
+
+  // all timers are more than a turn away
+  for (uint64 i = 0; i < TIMER_WHEEL_SLOTS; i++)
+    for (struct ktimer *t = wheel[i]; t; t = t->next) deadline = MIN(deadline, t->expires);
+  return deadline;
+}
+
+uint64 timespec_to_mtime(const struct ktimespec *ts) {
+  return ts->tv_sec * MTIME_FREQ + ts->tv_nsec / NS_PER_MTIME;
+}
+
+void mtime_to_timespec(uint64 mtime, struct ktimespec *ts) {
+  ts->tv_sec = mtime / MTIME_FREQ;
+  ts->tv_nsec = mtime % MTIME_FREQ * NS_PER_MTIME;
+}
+
+//
+// sleeping processes and their periodic timers, indexed by pid
+//
+static struct ktimer sleep_timers[NPROC];
+
+static struct periodic_timer {
+  int used;
+  struct ktimer timer;
+  uint64 period;       // in mtime units
+  uint64 expirations;  // since the last timer_periodic_wait
+  process *waiter;     // the owner, while it sleeps in timer_periodic_wait
+} periodic_timers[NPROC][TIMER_PERIODIC_MAX];
+
+static void sleep_expired(struct ktimer *t) {
+  process *proc = (process *)t->arg;
+  proc->trapframe->regs.a0 = 0;
+  insert_to_ready_queue(proc);
+}
+
+//
+// let current sleep for "duration" mtime units. like do_sleep, this never returns
+// unless there is nothing to wait for: the result is set by sleep_expired().
+// return: 0.
+//
+long timer_sleep(uint64 duration) {
+  if (duration == 0) return 0;
+
+  struct ktimer *t = &sleep_timers[current->pid];
+  t->fn = sleep_expired;
+  t->arg = current;
+  ktimer_add(t, timer_mtime() + duration);
+  do_sleep(NULL, NULL);
+  return 0;
+}
+
+//
+// a periodic timer expired: count the periods that passed, wake its waiting owner
+// and put the timer back for the next period.
+//
+static void periodic_expired(struct ktimer *t) {
+  struct periodic_timer *pt = (struct periodic_timer *)t->arg;
+  uint64 missed = (timer_mtime() - t->expires) / pt->period + 1;
+  pt->expirations += missed;
+
+  if (pt->waiter) {
+    pt->waiter->trapframe->regs.a0 = pt->expirations;
+    pt->expirations = 0;
+    insert_to_ready_queue(pt->waiter);
+    pt->waiter = NULL;
+  }
+  // the next expiry follows the original schedule, so the rate does not drift
+  ktimer_add(t, t->expires + missed * pt->period);
+}
+
+//
+// start a timer of current expiring every "period" mtime units, the first time one
+// period from now.
+// return: the descriptor of the timer, -1 if current has no free one.
+//
+int timer_periodic_create(uint64 period) {
+  if (period == 0) return -1;
+  for (int td = 0; td < TIMER_PERIODIC_MAX; td++) {
+    struct periodic_timer *pt = &periodic_timers[current->pid][td];
+    if (pt->used) continue;
+
+    pt->used = 1;
+    pt->period = period;
+    pt->expirations = 0;
+    pt->waiter = NULL;
+    pt->timer.fn = periodic_expired;
+    pt->timer.arg = pt;
+    ktimer_add(&pt->timer, timer_mtime() + period);
+    return td;
+  }
+  return -1;
+}
+
+static struct periodic_timer *periodic_timer_of(uint64 pid, int td) {
+  if (td < 0 || td >= TIMER_PERIODIC_MAX || !periodic_timers[pid][td].used) return NULL;
+  return &periodic_timers[pid][td];
+}
+
+//
+// wait until the periodic timer "td" of current expires. returns right away if it
+// expired since the last wait, otherwise sleeps (and never returns, see timer_sleep).
+// return: the number of expirations since the last wait, more than one if current
+// fell behind; -1 if td is not a timer of current.
+//
+long timer_periodic_wait(int td) {
+  struct periodic_timer *pt = periodic_timer_of(current->pid, td);
+  if (pt == NULL) return -1;
+
+  if (pt->expirations) {
+    long n = pt->expirations;
+    pt->expirations = 0;
+    return n;
+  }
+  pt->waiter = current;
+  do_sleep(NULL, NULL);
+  return 0;
+}
+
+//
+// stop and free the periodic timer "td" of current.
+// return: 0 on success, -1 if td is not a timer of current.
+//
+int timer_periodic_close(int td) {
+  struct periodic_timer *pt = periodic_timer_of(current->pid, td);
+  if (pt == NULL) return -1;
+  ktimer_cancel(&pt->timer);
+  pt->used = 0;
+  return 0;
+}
+
+//
+// cancel the sleep and the periodic timers of process pid, when it exits.
+//
+void timer_release(uint64 pid) {
+  ktimer_cancel(&sleep_timers[pid]);
+  for (int td = 0; td < TIMER_PERIODIC_MAX; td++) {
+    ktimer_cancel(&periodic_timers[pid][td].timer);
+    periodic_timers[pid][td].used = 0;
+  }
+}
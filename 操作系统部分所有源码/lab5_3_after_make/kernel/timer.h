@@ -0,0 +1,51 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include "util/types.h"
+
+// returned by the deadline queries when nothing waits for a timeout
+#define TIMER_NO_DEADLINE ((uint64)-1)
+
+// rate of the CLINT mtime counter (Spike: one tick per 100 instructions at 1 GHz)
+#define MTIME_FREQ 10000000
+#define NS_PER_MTIME (1000000000 / MTIME_FREQ)
+
+// the timer wheel: TIMER_WHEEL_SLOTS slots of TIMER_WHEEL_GRAIN mtime units each.
+// a timer goes into the slot of its expiry time modulo one turn of the wheel.
+#define TIMER_WHEEL_SLOTS 256  // a power of two
+#define TIMER_WHEEL_GRAIN (MTIME_FREQ / 1000)
+
+// periodic timers a process can have at once
+#define TIMER_PERIODIC_MAX 4
+
+// a timer on the wheel, it calls fn once mtime reaches "expires"
+struct ktimer {
+  uint64 expires;
+  void (*fn)(struct ktimer *t);
+  void *arg;
+  struct ktimer *next;
+  struct ktimer **pprev;  // NULL while the timer is not on the wheel
+};
+
+uint64 timer_mtime(void);
+void timer_program(uint64 deadline);
+void timer_resume_periodic(void);
+int timer_tick_due(void);
+void timer_rearm(void);
+uint64 timer_next_deadline(void);
+
+void ktimer_add(struct ktimer *t, uint64 expires);
+void ktimer_cancel(struct ktimer *t);
+void timer_wheel_run(void);
+uint64 timer_wheel_next_deadline(void);
+
+uint64 timespec_to_mtime(const struct ktimespec *ts);
+void mtime_to_timespec(uint64 mtime, struct ktimespec *ts);
+
+long timer_sleep(uint64 duration);
+int timer_periodic_create(uint64 period);
+long timer_periodic_wait(int td);
+int timer_periodic_close(int td);
+void timer_release(uint64 pid);
+
+#endif
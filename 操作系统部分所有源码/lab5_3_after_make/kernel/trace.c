@@ -0,0 +1,97 @@
+/*
+ * the kernel trace: a ring of timestamped events (traps, syscalls, context switches,
+ * irqs, page faults, camera frames) per hart.
+ *
+ * recording an event costs a few stores, so tracing is on from boot. the ring keeps
+ * the latest TRACE_NEVENTS events, an app can dump them to a file in a compact binary
+ * format (see kernel/trace.h) that tools/trace2chrome.py turns into a Chrome trace.
+ */
+
+#include "trace.h"
+#include "config.h"
+#include "process.h"
+#include "riscv.h"
+#include "timer.h"
+#include "vfs.h"
+#include "util/functions.h"
+
+static struct trace_ring {
+  struct trace_event events[TRACE_NEVENTS];
+  uint64 head;  // events ever recorded, the next one goes to head % TRACE_NEVENTS
+  int on;
+} trace_rings[NCPU] = {
+  [0] = { .on = 1 },
+};
+
+// we use only one HART (see kernel/config.h), its ring is the first one
+#define this_ring (&trace_rings[0])
+
+//
+// record an event of "type" for the current process
+//
+void trace_event(int type, uint32 arg, uint64 arg2) {
+  struct trace_ring *ring = this_ring;
+  if (!ring->on) return;
+
+  struct trace_event *e = &ring->events[ring->head++ & (TRACE_NEVENTS - 1)];
+  e->cycle = read_csr(cycle);
+  e->time = timer_mtime();
+  e->type = type;
+  e->pid = current ? current->pid : (uint16)-1;
+  e->arg = arg;
+  e->arg2 = arg2;
+}
+
+//
+// write the events in the ring to the file at "path", oldest first, after a header.
+// return: the number of bytes written, -1 on error.
+//
+static int trace_dump(struct trace_ring *ring, const char *path) {
+  struct file *file = vfs_open(path, O_WRONLY | O_CREAT);
+  if (file == NULL) return -1;
+
+  uint64 n = MIN(ring->head, TRACE_NEVENTS);
+  uint64 start = (ring->head - n) & (TRACE_NEVENTS - 1);
+  uint64 first = MIN(n, TRACE_NEVENTS - start);
+  struct trace_header hdr = {TRACE_MAGIC, TRACE_VERSION, MTIME_FREQ, n};
+
+  // the ring wraps around at most once
+  struct io_seg segs[3] = {
+    {(char *)&hdr, sizeof(hdr)},
+    {(char *)&ring->events[start], first * sizeof(struct trace_event)},
+    {(char *)&ring->events[0], (n - first) * sizeof(struct trace_event)},
+  };
+  struct io_vec iov = {segs, n > first ? 3 : 2, sizeof(hdr) + n * sizeof(struct trace_event)};
+
+  // the file system calls of the dump itself are not recorded
+  int was_on = ring->on;
+  ring->on = 0;
+  ssize_t r = vfs_write(file, &iov);
+  vfs_close(file);
+  free_vfs_file(file);
+  ring->on = was_on;
+  return r;
+}
+
+//
+// carry out a trace command (TRACE_CMD_*), "path" is the file of TRACE_CMD_DUMP.
+// return: 0 (the bytes written for a dump) on success, -1 on error.
+//
+int trace_control(int cmd, const char *path) {
+  struct trace_ring *ring = this_ring;
+  switch (cmd) {
+    case TRACE_CMD_START:
+      ring->on = 1;
+      return 0;
+    case TRACE_CMD_STOP:
+      ring->on = 0;
+      return 0;
+    case TRACE_CMD_DUMP:
+      return trace_dump(ring, path);
+    case TRACE_CMD_CLEAR:
+      ring->head = 0;
+      return 0;
+    default:
+      return -1;
+  }
+}
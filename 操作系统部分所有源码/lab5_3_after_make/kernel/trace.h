@@ -0,0 +1,48 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "util/types.h"
+
+// events kept by the trace ring of each hart, a power of two
+#define TRACE_NEVENTS 1024
+
+// event types, and what "arg" and "arg2" of each hold
+#define TRACE_TRAP_ENTER     1  // arg: scause (low 32 bits, bit 31 set for interrupts)
+#define TRACE_TRAP_EXIT      2  // back to user mode
+#define TRACE_SYSCALL_ENTER  3  // arg: syscall number
+#define TRACE_SYSCALL_EXIT   4  // arg: syscall number, arg2: return value
+#define TRACE_SWITCH         5  // arg: pid of the process switched from, -1 if none
+#define TRACE_IRQ            6  // arg: PLIC irq number
+#define TRACE_PAGE_FAULT     7  // arg: scause, arg2: faulting address
+#define TRACE_FRAME          8  // arg: index of the dequeued camera buffer
+
+// one event, as kept in the ring and written by a dump (little-endian)
+struct trace_event {
+  uint64 cycle;  // rdcycle
+  uint64 time;   // rdtime, i.e., mtime
+  uint16 type;
+  uint16 pid;    // the current process
+  uint32 arg;
+  uint64 arg2;
+};
+
+// a dump is this header, followed by nevents events, oldest first
+#define TRACE_MAGIC 0x52544b50  // "PKTR"
+#define TRACE_VERSION 1
+struct trace_header {
+  uint32 magic;
+  uint32 version;
+  uint64 mtime_freq;
+  uint64 nevents;
+};
+
+// commands of the trace syscall
+#define TRACE_CMD_START 0  // record events (the default)
+#define TRACE_CMD_STOP  1  // stop recording, the ring keeps what it has
+#define TRACE_CMD_DUMP  2  // write the ring to the file at path arg0
+#define TRACE_CMD_CLEAR 3  // drop all recorded events
+
+void trace_event(int type, uint32 arg, uint64 arg2);
+int trace_control(int cmd, const char *path);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * the kernel status page (vDSO-style): one page of kernel state mapped read-only at
+ * USER_VDSO_VA into every process, so apps can poll the tick count, the camera frame
+ * sequence or the uart receive rings without a syscall.
+ */
+
+#include "vdso.h"
+#include "process.h"
+#include "timer.h"
+#include "vmm.h"
+#include "riscv.h"
+
+// the page itself lives in the kernel image, the kernel writes it through its direct
+// mapping
+static union {
+  struct vdso_data data;
+  char page[PGSIZE];
+} vdso_page __attribute__((aligned(PGSIZE))) = {
+  .data = { .mtime_freq = MTIME_FREQ },
+};
+
+#define vdso (&vdso_page.data)
+
+//
+// start a change of the page: readers that see an odd seq retry.
+//
+static void vdso_write_begin(void) {
+  vdso->seq++;
+  asm volatile("fence w,w" ::: "memory");
+}
+
+static void vdso_write_end(void) {
+  asm volatile("fence w,w" ::: "memory");
+  vdso->seq++;
+}
+
+//
+// map the page read-only at USER_VDSO_VA of proc
+//
+void vdso_map(process *proc) {
+  user_vm_map((pagetable_t)proc->pagetable, USER_VDSO_VA, PGSIZE, (uint64)&vdso_page,
+              prot_to_type(PROT_READ, 1));
+}
+
+//
+// called on timer ticks
+//
+void vdso_tick(uint64 ticks) {
+  vdso_write_begin();
+  vdso->ticks = ticks;
+  vdso->tick_mtime = timer_mtime();
+  vdso_write_end();
+}
+
+//
+// called when a process dequeued a camera frame
+//
+void vdso_frame_dequeued(void) {
+  vdso_write_begin();
+  vdso->frame_seq++;
+  vdso_write_end();
+}
+
+//
+// called when the receive ring of uart "port" changed
+//
+void vdso_uart_rx(int port, uint64 avail) {
+  vdso_write_begin();
+  vdso->uart_rx_avail[port] = avail;
+  vdso_write_end();
+}
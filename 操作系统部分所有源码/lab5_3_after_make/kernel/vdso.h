@@ -0,0 +1,32 @@
+#ifndef _VDSO_H_
+#define _VDSO_H_
+
+#include "util/types.h"
+
+// virtual address of the kernel status page in every process, right above the stack
+#define USER_VDSO_VA 0x7ffff000
+
+// uarts whose receive rings are shown on the page, one per serial_port_id
+#define VDSO_NUARTS 2
+
+// the kernel status page. the kernel keeps it up to date, apps map it read-only and
+// read it with plain loads. "seq" is odd while the kernel changes the page: a reader
+// copies the fields and starts over if seq was odd or changed meanwhile.
+struct vdso_data {
+  uint32 seq;
+  uint32 pad;
+  uint64 mtime_freq;     // rate of mtime (and of the time CSR) in Hz
+  uint64 ticks;          // timer ticks since boot
+  uint64 tick_mtime;     // mtime at the last tick
+  uint64 frame_seq;      // camera frames dequeued since boot
+  uint64 uart_rx_avail[VDSO_NUARTS];  // bytes waiting in the receive ring of each uart
+};
+
+// kernel side. the page is mapped into a process by alloc_process.
+struct process_t;
+void vdso_map(struct process_t *proc);
+void vdso_tick(uint64 ticks);
+void vdso_frame_dequeued(void);
+void vdso_uart_rx(int port, uint64 avail);
+
+#endif
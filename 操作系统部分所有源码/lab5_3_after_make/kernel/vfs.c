@@ -5,6 +5,7 @@
 #include "vfs.h"
 
 #include "pmm.h"
+#include "slab.h"
 #include "spike_interface/spike_utils.h"
 #include "util/string.h"
 #include "util/types.h"
@@ -17,17 +18,182 @@ struct device *vfs_dev_list[MAX_VFS_DEV];     // system device list in vfs layer
 struct hash_table dentry_hash_table;
 struct hash_table vinode_hash_table;
 
+// slab caches of the vfs objects
+static struct kmem_cache *dentry_cache;
+static struct kmem_cache *vinode_cache;
+static struct kmem_cache *file_cache;
+
+// a new vinode starts out zeroed, with no blocks and no fs-specific info
+static void vinode_ctor(void *obj) { memset(obj, 0, sizeof(struct vinode)); }
+
+// the cached result of looking up a full path from the root. a negative entry
+// (dentry == NULL) remembers that the path does not exist, and where the lookup
+// stopped. entries are found through a hash of the path, and the least recently
+// used one is reused when the cache is full.
+struct path_entry {
+  int used;
+  char path[MAX_PATH_LEN];
+  struct dentry *dentry;            // the final dentry, NULL for a negative entry
+  struct dentry *parent;            // the last directory the lookup reached
+  char miss_name[MAX_PATH_LEN];     // the missing component of a negative entry
+  struct path_entry *hash_next;
+  struct path_entry *lru_prev, *lru_next;
+};
+
+static struct path_entry path_cache[PATH_CACHE_SIZE];
+static struct path_entry *path_hash[PATH_CACHE_HASH_SIZE];
+// entries in use, from the least to the most recently used
+static struct path_entry *path_lru_head = NULL, *path_lru_tail = NULL;
+
+static struct path_entry **path_bucket(const char *path) {
+  uint64 hash = 5381;
+  while (*path) hash = ((hash << 5) + hash) + *path++;  // hash * 33 + c
+  return &path_hash[hash & (PATH_CACHE_HASH_SIZE - 1)];
+}
+
+static void path_lru_remove(struct path_entry *e) {
+  if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+  else path_lru_head = e->lru_next;
+  if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+  else path_lru_tail = e->lru_prev;
+  e->lru_prev = e->lru_next = NULL;
+}
+
+static void path_lru_append(struct path_entry *e) {
+  e->lru_prev = path_lru_tail;
+  e->lru_next = NULL;
+  if (path_lru_tail) path_lru_tail->lru_next = e;
+  else path_lru_head = e;
+  path_lru_tail = e;
+}
+
+//
+// drop entry "e" from the cache.
+//
+static void path_cache_drop(struct path_entry *e) {
+  struct path_entry **pp = path_bucket(e->path);
+  while (*pp != e) pp = &(*pp)->hash_next;
+  *pp = e->hash_next;
+  path_lru_remove(e);
+  e->used = 0;
+}
+
+//
+// find the entry of "path", and mark it as the most recently used one.
+//
+static struct path_entry *path_cache_find(const char *path) {
+  for (struct path_entry *e = *path_bucket(path); e; e = e->hash_next) {
+    if (strcmp(e->path, path) == 0) {
+      path_lru_remove(e);
+      path_lru_append(e);
+      return e;
+    }
+  }
+  return NULL;
+}
+
+//
+// whether a cached path still leads to "dentry".
+//
+static int path_cache_holds(struct dentry *dentry) {
+  for (int i = 0; i < PATH_CACHE_SIZE; i++)
+    if (path_cache[i].used && path_cache[i].dentry == dentry) return 1;
+  return 0;
+}
+
+//
+// drop the dentry of a file that no file and no cached path refers to any more,
+// together with its vinode once no other dentry refers to that.
+//
+static void dentry_release(struct dentry *dentry) {
+  struct vinode *inode = dentry->dentry_inode;
+  hash_erase_dentry(dentry);
+  free_vfs_dentry(dentry);
+  inode->ref--;
+  // no other opened hard link
+  if (inode->ref == 0) {
+    // write back the inode and free it
+    if (viop_write_back_vinode(inode) != 0)
+      panic("dentry_release: free inode failed!\n");
+    hash_erase_vinode(inode);
+    free_vfs_vinode(inode);
+  }
+}
+
+//
+// remember the result of looking up "path" from the root.
+//
+static void path_cache_put(const char *path, struct dentry *dentry,
+                           struct dentry *parent, const char *miss_name) {
+  if (strlen(path) >= MAX_PATH_LEN) return;
+
+  struct path_entry *e = path_cache_find(path);
+  if (e) path_cache_drop(e);
+
+  // take a free entry, or the least recently used one
+  e = NULL;
+  for (int i = 0; i < PATH_CACHE_SIZE && !e; i++)
+    if (!path_cache[i].used) e = &path_cache[i];
+  if (!e) {
+    e = path_lru_head;
+    struct dentry *old = e->dentry;
+    path_cache_drop(e);
+    // a closed file was only kept for the path
+    if (old && old != dentry && old != parent && old->d_ref == 0 &&
+        old->dentry_inode->type == FILE_I && !path_cache_holds(old))
+      dentry_release(old);
+  }
+
+  e->used = 1;
+  strcpy(e->path, path);
+  e->dentry = dentry;
+  e->parent = parent;
+  strcpy(e->miss_name, dentry ? "" : miss_name);
+  struct path_entry **bucket = path_bucket(path);
+  e->hash_next = *bucket;
+  *bucket = e;
+  path_lru_append(e);
+}
+
+//
+// drop the cached paths that lead to or through "dentry", which is being freed.
+//
+static void path_cache_forget(struct dentry *dentry) {
+  for (int i = 0; i < PATH_CACHE_SIZE; i++) {
+    struct path_entry *e = &path_cache[i];
+    if (e->used && (e->dentry == dentry || e->parent == dentry)) path_cache_drop(e);
+  }
+}
+
 //
-// initializes the dentry hash list and vinode hash list
+// "name" has been created in the directory "parent": drop the negative entries
+// whose lookup stopped there.
+//
+static void path_cache_created(struct dentry *parent, const char *name) {
+  for (int i = 0; i < PATH_CACHE_SIZE; i++) {
+    struct path_entry *e = &path_cache[i];
+    if (e->used && e->dentry == NULL && e->parent == parent &&
+        strcmp(e->miss_name, name) == 0)
+      path_cache_drop(e);
+  }
+}
+
+//
+// initializes the vfs object caches, the dentry hash list and vinode hash list
 //
 int vfs_init() {
   int ret;
-  ret = hash_table_init(&dentry_hash_table, dentry_hash_equal, dentry_hash_func,
-                            NULL, NULL, NULL);
+  dentry_cache = kmem_cache_create("dentry", sizeof(struct dentry), NULL);
+  vinode_cache = kmem_cache_create("vinode", sizeof(struct vinode), vinode_ctor);
+  file_cache = kmem_cache_create("file", sizeof(struct file), NULL);
+  if (!dentry_cache || !vinode_cache || !file_cache) return -1;
+
+  ret = hash_table_init(&dentry_hash_table, sizeof(struct dentry_key),
+                        dentry_hash_equal, dentry_hash_func);
   if (ret != 0) return ret;
 
-  ret = hash_table_init(&vinode_hash_table, vinode_hash_equal, vinode_hash_func,
-                            NULL, NULL, NULL);
+  ret = hash_table_init(&vinode_hash_table, sizeof(struct vinode_key),
+                        vinode_hash_equal, vinode_hash_func);
   if (ret != 0) return ret;
   return 0; 
 }
@@ -96,6 +262,7 @@ struct super_block *vfs_mount(const char *dev_name, int mnt_type) {
 
     // insert the mount point into hash table
     hash_put_dentry(sb->s_root);
+    path_cache_created(vfs_root_dentry, dev_name);
   } else {
     panic("vfs_mount: unknown mount type!\n");
   }
@@ -140,6 +307,7 @@ struct file *vfs_open(const char *path, int flags) {
       new_inode->ref++;
       hash_put_dentry(file_dentry);
       hash_put_vinode(new_inode); 
+      path_cache_created(parent, basename);
     } else {
       sprint("vfs_open: cannot find the file!\n");
       return NULL;
@@ -186,10 +354,60 @@ struct file *vfs_open(const char *path, int flags) {
 }
 
 //
-// read content from "file" starting from file->offset, and store it in "buf".
+// locate byte "pos" of the buffer "iov". *avail is set to the number of bytes that
+// follow it in the same segment.
+// return: the address of the byte, NULL if pos lies past the end of the buffer.
+//
+char *io_vec_at(const struct io_vec *iov, uint64 pos, uint64 *avail) {
+  for (int i = 0; i < iov->nsegs; i++) {
+    if (pos < iov->segs[i].len) {
+      *avail = iov->segs[i].len - pos;
+      return iov->segs[i].base + pos;
+    }
+    pos -= iov->segs[i].len;
+  }
+  *avail = 0;
+  return NULL;
+}
+
+//
+// copy "n" bytes of "src" into "iov", from its byte "pos" on.
+//
+void io_vec_copy_to(const struct io_vec *iov, uint64 pos, const void *src, uint64 n) {
+  while (n > 0) {
+    uint64 avail;
+    char *dst = io_vec_at(iov, pos, &avail);
+    if (dst == NULL) panic("io_vec_copy_to: copy past the end of the buffer!\n");
+    uint64 part = avail < n ? avail : n;
+    memcpy(dst, src, part);
+    src = (const char *)src + part;
+    pos += part;
+    n -= part;
+  }
+}
+
+//
+// copy "n" bytes of "iov", from its byte "pos" on, into "dst".
+//
+void io_vec_copy_from(const struct io_vec *iov, uint64 pos, void *dst, uint64 n) {
+  while (n > 0) {
+    uint64 avail;
+    char *src = io_vec_at(iov, pos, &avail);
+    if (src == NULL) panic("io_vec_copy_from: copy past the end of the buffer!\n");
+    uint64 part = avail < n ? avail : n;
+    memcpy(dst, src, part);
+    dst = (char *)dst + part;
+    pos += part;
+    n -= part;
+  }
+}
+
+//
+// read content from "file" starting from file->offset, and store it in the
+// segments of "iov".
 // return: the number of bytes actually read
 //
-ssize_t vfs_read(struct file *file, char *buf, size_t count) {
+ssize_t vfs_read(struct file *file, const struct io_vec *iov) {
   if (!file->readable) {
     sprint("vfs_read: file is not readable!\n");
     return -1;
@@ -199,14 +417,14 @@ ssize_t vfs_read(struct file *file, char *buf, size_t count) {
     return -1;
   }
   // actual reading.
-  return viop_read(file->f_dentry->dentry_inode, buf, count, &(file->offset));
+  return viop_read(file->f_dentry->dentry_inode, iov, &(file->offset));
 }
 
 //
-// write content in "buf" to "file", at file->offset.
+// write content in the segments of "iov" to "file", at file->offset.
 // return: the number of bytes actually written
 //
-ssize_t vfs_write(struct file *file, const char *buf, size_t count) {
+ssize_t vfs_write(struct file *file, const struct io_vec *iov) {
   if (!file->writable) {
     sprint("vfs_write: file is not writable!\n");
     return -1;
@@ -216,7 +434,7 @@ ssize_t vfs_write(struct file *file, const char *buf, size_t count) {
     return -1;
   }
   // actual writing.
-  return viop_write(file->f_dentry->dentry_inode, buf, count, &(file->offset));
+  return viop_write(file->f_dentry->dentry_inode, iov, &(file->offset));
 }
 
 //
@@ -256,6 +474,20 @@ int vfs_disk_stat(struct file *file, struct istat *istat) {
   return viop_disk_stat(file->f_dentry->dentry_inode, istat);
 }
 
+//
+// push the data of "file" that the file system still buffers to its storage.
+// return: 0 on success, -1 on failure.
+//
+int vfs_fsync(struct file *file) {
+  struct vinode *node = file->f_dentry->dentry_inode;
+  if (node->type != FILE_I) {
+    sprint("vfs_fsync: cannot sync a directory!\n");
+    return -1;
+  }
+  if (!node->i_ops->viop_fsync) return 0;
+  return viop_fsync(node);
+}
+
 //
 // make hard link to the file specified by "oldpath" with the name "newpath"
 // return: -1 on failure, 0 on success.
@@ -302,6 +534,7 @@ int vfs_link(const char *oldpath, const char *newpath) {
 
   // make a new dentry for the new link
   hash_put_dentry(new_file_dentry);
+  path_cache_created(parent, basename);
 
   return 0;
 }
@@ -348,7 +581,7 @@ int vfs_unlink(const char *path) {
 
     // we don't write back the inode, because it has disappeared from the disk
     hash_erase_vinode(unlinked_vinode);
-    free_page(unlinked_vinode);  // free the vinode
+    free_vfs_vinode(unlinked_vinode);  // free the vinode
   }
   
 
@@ -407,19 +640,14 @@ int vfs_close(struct file *file) {
   }
 
   dentry->d_ref--;
-  // if the dentry is not pointed by any opened file, free the dentry
+  // if the dentry is not pointed by any opened file, free the dentry. a dentry that
+  // a cached path leads to is kept (with its inode written back), so opening the
+  // path again costs no lookup. it is freed when its path leaves the cache.
   if (dentry->d_ref == 0) {
-    // free the dentry
-    hash_erase_dentry(dentry);
-    free_vfs_dentry(dentry);
-    inode->ref--;
-    // no other opened hard link
-    if (inode->ref == 0) {
-      // write back the inode and free it
-      if (viop_write_back_vinode(inode) != 0)
-        panic("vfs_close: free inode failed!\n");
-      hash_erase_vinode(inode);
-      free_page(inode);
+    if (!path_cache_holds(dentry)) {
+      dentry_release(dentry);
+    } else if (viop_write_back_vinode(inode) != 0) {
+      panic("vfs_close: write back inode failed!\n");
     }
   }
 
@@ -496,7 +724,7 @@ int vfs_mkdir(const char *path) {
   struct dentry *new_dentry = alloc_vfs_dentry(basename, NULL, parent);
   struct vinode *new_dir_inode = viop_mkdir(parent->dentry_inode, new_dentry);
   if (!new_dir_inode) {
-    free_page(new_dentry);
+    free_vfs_dentry(new_dentry);
     sprint("vfs_mkdir: cannot create directory!\n");
     return -1;
   }
@@ -505,6 +733,7 @@ int vfs_mkdir(const char *path) {
   new_dir_inode->ref++;
   hash_put_dentry(new_dentry);
   hash_put_vinode(new_dir_inode);
+  path_cache_created(parent, basename);
   return 0;
 }
 
@@ -537,10 +766,22 @@ int vfs_closedir(struct file *file) {
 //
 // lookup the "path" and return its dentry (or NULL if not found).
 // the lookup starts from parent, and stop till the full "path" is parsed.
+// lookups from the root go through the path cache first, which also remembers
+// the paths that do not exist.
 // return: the final dentry if we find it, NULL for otherwise.
 //
 struct dentry *lookup_final_dentry(const char *path, struct dentry **parent,
                                    char *miss_name) {
+  int from_root = (*parent == vfs_root_dentry);
+  if (from_root) {
+    struct path_entry *e = path_cache_find(path);
+    if (e) {
+      *parent = e->parent;
+      if (!e->dentry) strcpy(miss_name, e->miss_name);
+      return e->dentry;
+    }
+  }
+
   char path_copy[MAX_PATH_LEN];
   strcpy(path_copy, path);
 
@@ -564,8 +805,9 @@ struct dentry *lookup_final_dentry(const char *path, struct dentry **parent,
       struct vinode *found_vinode = viop_lookup((*parent)->dentry_inode, this);
       if (found_vinode == NULL) {
         // not found in both hash table and directory file on disk.
-        free_page(this);
+        free_vfs_dentry(this);
         strcpy(miss_name, token);
+        if (from_root) path_cache_put(path, NULL, *parent, miss_name);
         return NULL;
       }
 
@@ -574,7 +816,7 @@ struct dentry *lookup_final_dentry(const char *path, struct dentry **parent,
         // the vinode is already in the hash table (i.e. we are opening another hard link)
         this->dentry_inode = same_inode;
         same_inode->ref++;
-        free_page(found_vinode);
+        free_vfs_vinode(found_vinode);
       } else {
         // the vinode is not in the hash table
         this->dentry_inode = found_vinode;
@@ -588,6 +830,8 @@ struct dentry *lookup_final_dentry(const char *path, struct dentry **parent,
     // get next token
     token = strtok(NULL, "/");
   }
+
+  if (from_root) path_cache_put(path, this, *parent, NULL);
   return this;
 }
 
@@ -613,7 +857,7 @@ void get_base_name(const char *path, char *base_name) {
 //
 struct file *alloc_vfs_file(struct dentry *file_dentry, int readable, int writable,
                         int offset) {
-  struct file *file = alloc_page();
+  struct file *file = kmem_cache_alloc(file_cache);
   file->f_dentry = file_dentry;
   file_dentry->d_ref += 1;
 
@@ -624,12 +868,20 @@ struct file *alloc_vfs_file(struct dentry *file_dentry, int readable, int writab
   return file;
 }
 
+//
+// free a (virtual) file. the dentry reference it took is dropped by vfs_close, or
+// kept by the copy the caller made of it.
+//
+void free_vfs_file(struct file *file) {
+  kmem_cache_free(file_cache, file);
+}
+
 //
 // alloc a (virtual) dir entry
 //
 struct dentry *alloc_vfs_dentry(const char *name, struct vinode *inode,
                             struct dentry *parent) {
-  struct dentry *dentry = (struct dentry *)alloc_page();
+  struct dentry *dentry = kmem_cache_alloc(dentry_cache);
   strcpy(dentry->name, name);
   dentry->dentry_inode = inode;
   if (inode) inode->ref++;
@@ -652,14 +904,15 @@ int free_vfs_dentry(struct dentry *dentry) {
     sprint("free_vfs_dentry: dentry is still in use!\n");
     return -1;
   }
-  free_page((void *)dentry);
+  path_cache_forget(dentry);
+  kmem_cache_free(dentry_cache, dentry);
   return 0;
 }
 
 // dentry generic hash table method implementation
-int dentry_hash_equal(void *key1, void *key2) {
-  struct dentry_key *dentry_key1 = key1;
-  struct dentry_key *dentry_key2 = key2;
+int dentry_hash_equal(const void *key1, const void *key2) {
+  const struct dentry_key *dentry_key1 = key1;
+  const struct dentry_key *dentry_key2 = key2;
   if (strcmp(dentry_key1->name, dentry_key2->name) == 0 &&
       dentry_key1->parent == dentry_key2->parent) {
     return 1;
@@ -667,94 +920,86 @@ int dentry_hash_equal(void *key1, void *key2) {
   return 0;
 }
 
-size_t dentry_hash_func(void *key) {
-  struct dentry_key *dentry_key = key;
-  char *name = dentry_key->name;
+size_t dentry_hash_func(const void *key) {
+  const struct dentry_key *dentry_key = key;
+  const char *name = dentry_key->name;
 
   size_t hash = 5381;
   int c;
 
   while ((c = *name++)) hash = ((hash << 5) + hash) + c;  // hash * 33 + c
 
-  hash = ((hash << 5) + hash) + (size_t)dentry_key->parent;
-  return hash % HASH_TABLE_SIZE;
+  hash = ((hash << 5) + hash) + ((size_t)dentry_key->parent >> 4);
+  return hash;
 }
 
-// dentry hash table interface
+// dentry hash table interface. the key points to the name inside the dentry, which
+// stays in the table no longer than the dentry itself.
 struct dentry *hash_get_dentry(struct dentry *parent, char *name) {
   struct dentry_key key = {.parent = parent, .name = name};
-  return (struct dentry *)dentry_hash_table.virtual_hash_get(&dentry_hash_table,
-                                                             &key);
+  return (struct dentry *)hash_table_get(&dentry_hash_table, &key);
 }
 
 int hash_put_dentry(struct dentry *dentry) {
-  struct dentry_key *key = alloc_page();
-  key->name = dentry->name;
-  key->parent = dentry->parent;
-
-  int ret = dentry_hash_table.virtual_hash_put(&dentry_hash_table, key, dentry);
-  if (ret != 0)
-    free_page(key);
-  return ret;
+  struct dentry_key key = {.parent = dentry->parent, .name = dentry->name};
+  return hash_table_put(&dentry_hash_table, &key, dentry);
 }
 
 int hash_erase_dentry(struct dentry *dentry) {
   struct dentry_key key = {.parent = dentry->parent, .name = dentry->name};
-  return dentry_hash_table.virtual_hash_erase(&dentry_hash_table, &key);
+  return hash_table_erase(&dentry_hash_table, &key);
 }
 
 // vinode generic hash table method implementation
-int vinode_hash_equal(void *key1, void *key2) {
-  struct vinode_key *vinode_key1 = key1;
-  struct vinode_key *vinode_key2 = key2;
+int vinode_hash_equal(const void *key1, const void *key2) {
+  const struct vinode_key *vinode_key1 = key1;
+  const struct vinode_key *vinode_key2 = key2;
   if (vinode_key1->inum == vinode_key2->inum && vinode_key1->sb == vinode_key2->sb) {
     return 1;
   }
   return 0;
 }
 
-size_t vinode_hash_func(void *key) {
-  struct vinode_key *vinode_key = key;
-  return vinode_key->inum % HASH_TABLE_SIZE;
+size_t vinode_hash_func(const void *key) {
+  const struct vinode_key *vinode_key = key;
+  return (size_t)vinode_key->inum * 2654435761u + ((size_t)vinode_key->sb >> 4);
 }
 
 // vinode hash table interface
 struct vinode *hash_get_vinode(struct super_block *sb, int inum) {
   if (inum < 0) return NULL;
   struct vinode_key key = {.sb = sb, .inum = inum};
-  return (struct vinode *)vinode_hash_table.virtual_hash_get(&vinode_hash_table,
-                                                             &key);
+  return (struct vinode *)hash_table_get(&vinode_hash_table, &key);
 }
 
 int hash_put_vinode(struct vinode *vinode) {
   if (vinode->inum < 0) return -1;
-  struct vinode_key *key = alloc_page();
-  key->sb = vinode->sb;
-  key->inum = vinode->inum;
-
-  int ret = vinode_hash_table.virtual_hash_put(&vinode_hash_table, key, vinode);
-  if (ret != 0) free_page(key);
-  return ret;
+  struct vinode_key key = {.sb = vinode->sb, .inum = vinode->inum};
+  return hash_table_put(&vinode_hash_table, &key, vinode);
 }
 
 int hash_erase_vinode(struct vinode *vinode) {
   if (vinode->inum < 0) return -1;
   struct vinode_key key = {.sb = vinode->sb, .inum = vinode->inum};
-  return vinode_hash_table.virtual_hash_erase(&vinode_hash_table, &key);
+  return hash_table_erase(&vinode_hash_table, &key);
 }
 
 //
 // shared (default) actions on allocating a vfs inode.
 //
 struct vinode *default_alloc_vinode(struct super_block *sb) {
-  struct vinode *vinode = (struct vinode *)alloc_page();
-  vinode->blocks = 0;
-  vinode->inum = 0;
-  vinode->nlinks = 0;
-  vinode->ref = 0;
+  struct vinode *vinode = kmem_cache_alloc(vinode_cache);
   vinode->sb = sb;
-  vinode->size = 0;
   return vinode;
 }
 
+//
+// free a vfs inode that is no longer referenced
+//
+void free_vfs_vinode(struct vinode *vinode) {
+  // the fs layer drops what it keeps for the vinode
+  if (vinode->i_ops && vinode->i_ops->viop_hook_free) vinode->i_ops->viop_hook_free(vinode);
+  kmem_cache_free(vinode_cache, vinode);
+}
+
 struct file_system_type *fs_list[MAX_SUPPORTED_FS];
@@ -10,9 +10,30 @@
 #define MAX_DENTRY_HASH_SIZE 100  // the maximum size of dentry hash table
 #define MAX_PATH_LEN 30           // the maximum length of path
 #define MAX_SUPPORTED_FS 10       // the maximum number of supported file systems
+#define PATH_CACHE_SIZE 64        // the number of cached path lookups
+#define PATH_CACHE_HASH_SIZE 64   // buckets of the path cache, a power of two
 
 #define DIRECT_BLKNUM 10          // the number of direct blocks
 
+/**** vfs I/O buffers ****/
+// a physically contiguous piece of an I/O buffer
+struct io_seg {
+  char *base;
+  uint64 len;
+};
+
+// the buffer of a read or write, as a list of segments (e.g., the pages of a user
+// buffer). file systems copy straight between their storage and the segments.
+struct io_vec {
+  struct io_seg *segs;
+  int nsegs;
+  uint64 len;  // total length of the segments
+};
+
+char *io_vec_at(const struct io_vec *iov, uint64 pos, uint64 *avail);
+void io_vec_copy_to(const struct io_vec *iov, uint64 pos, const void *src, uint64 n);
+void io_vec_copy_from(const struct io_vec *iov, uint64 pos, void *dst, uint64 n);
+
 /**** vfs initialization function ****/
 int vfs_init();
 
@@ -23,9 +44,10 @@ struct super_block *vfs_mount(const char *dev_name, int mnt_type);
 
 // file interfaces
 struct file *vfs_open(const char *path, int flags);
-ssize_t vfs_read(struct file *file, char *buf, size_t count);
-ssize_t vfs_write(struct file *file, const char *buf, size_t count);
+ssize_t vfs_read(struct file *file, const struct io_vec *iov);
+ssize_t vfs_write(struct file *file, const struct io_vec *iov);
 ssize_t vfs_lseek(struct file *file, ssize_t offset, int whence);
+int vfs_fsync(struct file *file);
 int vfs_stat(struct file *file, struct istat *istat);
 int vfs_disk_stat(struct file *file, struct istat *istat);
 int vfs_link(const char *oldpath, const char *newpath);
@@ -73,8 +95,8 @@ struct dentry_key {
 };
 
 // generic hash table method implementation
-int dentry_hash_equal(void *key1, void *key2);
-size_t dentry_hash_func(void *key);
+int dentry_hash_equal(const void *key1, const void *key2);
+size_t dentry_hash_func(const void *key);
 
 // dentry hash table interface
 struct dentry *hash_get_dentry(struct dentry *parent, char *name);
@@ -90,9 +112,10 @@ struct file {
   struct dentry *f_dentry;
 };
 
-// file constructor and destructor(use free_page to destruct)
+// file constructor and destructor
 struct file *alloc_vfs_file(struct dentry *dentry, int readable, int writable,
                         int offset);
+void free_vfs_file(struct file *file);
 
 // abstract device entry in vfs_dev_list
 struct device {
@@ -122,7 +145,7 @@ struct super_block {
   int ninodes;            // number of inodes.
   struct dentry *s_root;  // root dentry of inode
   struct device *s_dev;   // device of the superblock
-  void *s_fs_info;        // filesystem-specific info. for rfs, it points bitmap
+  void *s_fs_info;        // filesystem-specific info. for rfs, the bitmap state
   const struct sb_ops *s_ops;  // vfs super block operations
 };
 
@@ -134,7 +157,7 @@ struct vinode {
   int type;                  // one of FILE_I, DIR_I
   int nlinks;                // number of hard links to this file
   int blocks;                // number of blocks
-  int addrs[DIRECT_BLKNUM];  // direct blocks
+  int addrs[DIRECT_BLKNUM + 1];  // direct blocks, then the indirect block
   void *i_fs_info;           // filesystem-specific info (see s_fs_info)
   struct super_block *sb;          // super block of the vfs inode
   const struct vinode_ops *i_ops;  // vfs inode operations
@@ -142,10 +165,8 @@ struct vinode {
 
 struct vinode_ops {
   // file operations
-  ssize_t (*viop_read)(struct vinode *node, char *buf, ssize_t len,
-                       int *offset);
-  ssize_t (*viop_write)(struct vinode *node, const char *buf, ssize_t len,
-                        int *offset);
+  ssize_t (*viop_read)(struct vinode *node, const struct io_vec *iov, int *offset);
+  ssize_t (*viop_write)(struct vinode *node, const struct io_vec *iov, int *offset);
   struct vinode *(*viop_create)(struct vinode *parent, struct dentry *sub_dentry);
   int (*viop_lseek)(struct vinode *node, ssize_t new_off, int whence, int *off);
   int (*viop_disk_stat)(struct vinode *node, struct istat *istat);
@@ -170,6 +191,8 @@ struct vinode_ops {
 
   // write back inode to disk
   int (*viop_write_back_vinode)(struct vinode *node);
+  // push the data of a file buffered by the fs layer to its storage
+  int (*viop_fsync)(struct vinode *node);
 
   // hook functions
   // In the vfs layer, we do not assume that hook functions will do anything,
@@ -181,14 +204,15 @@ struct vinode_ops {
   int (*viop_hook_close)(struct vinode *node, struct dentry *dentry);
   int (*viop_hook_opendir)(struct vinode *node, struct dentry *dentry);
   int (*viop_hook_closedir)(struct vinode *node, struct dentry *dentry);
+  void (*viop_hook_free)(struct vinode *node);
 };
 
 // vinode operation interface
 // the implementation depends on the vinode type and the specific file system
 
 // virtual file system inode interfaces
-#define viop_read(node, buf, len, offset)      (node->i_ops->viop_read(node, buf, len, offset))
-#define viop_write(node, buf, len, offset)     (node->i_ops->viop_write(node, buf, len, offset))
+#define viop_read(node, iov, offset)           (node->i_ops->viop_read(node, iov, offset))
+#define viop_write(node, iov, offset)          (node->i_ops->viop_write(node, iov, offset))
 #define viop_create(node, name)                (node->i_ops->viop_create(node, name))
 #define viop_lseek(node, new_off, whence, off) (node->i_ops->viop_lseek(node, new_off, whence, off))
 #define viop_disk_stat(node, istat)            (node->i_ops->viop_disk_stat(node, istat))
@@ -202,6 +226,7 @@ struct vinode_ops {
 #define viop_readdir(dir_vinode, dir, offset)  (dir_vinode->i_ops->viop_readdir(dir_vinode, dir, offset))
 #define viop_mkdir(dir, sub_dentry)            (dir->i_ops->viop_mkdir(dir, sub_dentry))
 #define viop_write_back_vinode(node)           (node->i_ops->viop_write_back_vinode(node))
+#define viop_fsync(node)                       (node->i_ops->viop_fsync(node))
 
 // vinode hash table
 extern struct hash_table vinode_hash_table;
@@ -213,8 +238,8 @@ struct vinode_key {
 };
 
 // generic hash table method implementation
-int vinode_hash_equal(void *key1, void *key2);
-size_t vinode_hash_func(void *key);
+int vinode_hash_equal(const void *key1, const void *key2);
+size_t vinode_hash_func(const void *key);
 
 // vinode hash table interface
 struct vinode *hash_get_vinode(struct super_block *sb, int inum);
@@ -223,6 +248,7 @@ int hash_erase_vinode(struct vinode *vinode);
 
 // other utility functions
 struct vinode *default_alloc_vinode(struct super_block *sb);
+void free_vfs_vinode(struct vinode *vinode);
 struct dentry *lookup_final_dentry(const char *path, struct dentry **parent,
                                    char *miss_name);
 void get_base_name(const char *path, char *base_name);
@@ -0,0 +1,254 @@
+/*
+ * per-process regions (vm areas) of the user address space.
+ *
+ * a region only reserves addresses: its pages are allocated and mapped by the page
+ * fault handler on the first access, with the protection of the region. accesses
+ * outside of any region, or not allowed by its protection, are faults of the app.
+ */
+
+#include "vma.h"
+#include "vmm.h"
+#include "klog.h"
+#include "pmm.h"
+#include "slab.h"
+#include "riscv.h"
+#include "util/functions.h"
+#include "util/string.h"
+#include "spike_interface/spike_utils.h"
+
+//
+// the region containing va, or NULL
+//
+vm_area *vma_find(process *proc, uint64 va) {
+  for (vm_area *vma = proc->vmas; vma && vma->start <= va; vma = vma->next)
+    if (va < vma->end) return vma;
+  return NULL;
+}
+
+// mmap regions stay separate, as each of them maps its own device buffer
+static int vma_mergeable(vm_area *a, vm_area *b) {
+  return a->end == b->start && a->seg_type == b->seg_type && a->prot == b->prot &&
+         a->seg_type != MMAP_SEGMENT;
+}
+
+//
+// add the region [start, end) to proc. it is merged with adjacent regions of the same
+// type and protection.
+// return: the region, or NULL if it overlaps an existing one.
+//
+vm_area *vma_add(process *proc, uint64 start, uint64 end, int seg_type, int prot) {
+  start = ROUNDDOWN(start, PGSIZE);
+  end = ROUNDUP(end, PGSIZE);
+  if (start >= end) return NULL;
+
+  vm_area **link = &proc->vmas;
+  vm_area *prev = NULL;
+  while (*link && (*link)->start < end) {
+    if ((*link)->end > start) return NULL;  // overlap
+    prev = *link;
+    link = &(*link)->next;
+  }
+
+  vm_area *vma = kmalloc(sizeof(vm_area));
+  if (vma == NULL) return NULL;
+  memset(vma, 0, sizeof(vm_area));
+  vma->start = start;
+  vma->end = end;
+  vma->seg_type = seg_type;
+  vma->prot = prot;
+  vma->fd = -1;
+  vma->next = *link;
+  *link = vma;
+
+  if (vma->next && vma_mergeable(vma, vma->next)) {
+    vm_area *next = vma->next;
+    vma->end = next->end;
+    vma->next = next->next;
+    kfree(next);
+  }
+  if (prev && vma_mergeable(prev, vma)) {
+    prev->end = vma->end;
+    prev->next = vma->next;
+    kfree(vma);
+    vma = prev;
+  }
+  return vma;
+}
+
+//
+// remove [start, end) from the regions of proc, splitting the regions that are only
+// partly covered. the pages mapped in the range are unmapped and released.
+// return: -1 if no region overlaps the range.
+//
+int vma_remove(process *proc, uint64 start, uint64 end) {
+  start = ROUNDDOWN(start, PGSIZE);
+  end = ROUNDUP(end, PGSIZE);
+  int found = 0;
+
+  vm_area **link = &proc->vmas;
+  while (*link && (*link)->start < end) {
+    vm_area *vma = *link;
+    if (vma->end <= start) {
+      link = &vma->next;
+      continue;
+    }
+    found = 1;
+
+    uint64 lo = MAX(vma->start, start), hi = MIN(vma->end, end);
+    for (uint64 va = lo; va < hi; va += PGSIZE)
+      if (lookup_pa(proc->pagetable, va) != 0)
+        user_vm_unmap(proc->pagetable, va, PGSIZE, 1);
+
+    if (vma->start < lo && hi < vma->end) {
+      // the range is inside the region: split it in two
+      vm_area *upper = kmalloc(sizeof(vm_area));
+      if (upper == NULL) panic("vma_remove: cannot split region.\n");
+      *upper = *vma;
+      upper->start = hi;
+      vma->end = lo;
+      vma->next = upper;
+      break;
+    } else if (vma->start < lo) {
+      vma->end = lo;
+      link = &vma->next;
+    } else if (hi < vma->end) {
+      vma->start = hi;
+      link = &vma->next;
+    } else {
+      *link = vma->next;
+      kfree(vma);
+    }
+  }
+
+  flush_tlb();
+  return found ? 0 : -1;
+}
+
+//
+// the lowest address from base on where "size" bytes are not covered by any region
+//
+uint64 vma_find_gap(process *proc, uint64 base, uint64 size) {
+  uint64 va = ROUNDDOWN(base, PGSIZE);
+  size = ROUNDUP(size, PGSIZE);
+  for (vm_area *vma = proc->vmas; vma; vma = vma->next) {
+    if (vma->end <= va) continue;
+    if (vma->start >= va + size) break;
+    va = vma->end;
+  }
+  return va;
+}
+
+//
+// allocate and map the missing pages of [start, end) in vma. a run of missing pages
+// is backed by physically contiguous memory when there is one, so that devices (see
+// mmap_sync) can fill it in one go.
+//
+static int vma_populate(process *proc, vm_area *vma, uint64 start, uint64 end) {
+  uint64 va = start;
+  while (va < end) {
+    if (lookup_pa(proc->pagetable, va) != 0) {
+      va += PGSIZE;
+      continue;
+    }
+
+    uint64 npages = 1;
+    while (va + npages * PGSIZE < end &&
+           lookup_pa(proc->pagetable, va + npages * PGSIZE) == 0)
+      npages++;
+
+    char *run = npages > 1 ? alloc_pages_exact(npages) : NULL;
+    for (uint64 i = 0; i < npages; i++, va += PGSIZE) {
+      void *pa = run ? run + i * PGSIZE : alloc_page();
+      if (pa == NULL) return -1;
+      memset(pa, 0, PGSIZE);
+      user_vm_map(proc->pagetable, va, PGSIZE, (uint64)pa, prot_to_type(vma->prot, 1));
+    }
+  }
+  return 0;
+}
+
+//
+// handle a page fault of proc at va. the page is mapped if it belongs to a region
+// that allows the access, and a copy-on-write page is copied on a store.
+// return: -1 if the access is not allowed, i.e., the app has to be stopped.
+//
+int vma_handle_fault(process *proc, uint64 va, uint64 cause) {
+  vm_area *vma = vma_find(proc, va);
+  if (vma == NULL) return -1;
+  if (vma->seg_type == GUARD_SEGMENT) {
+    klog(KLOG_MM, KLOG_ERR, "vma_handle_fault: stack overflow at 0x%lx.", va);
+    return -1;
+  }
+
+  int access = cause == CAUSE_STORE_PAGE_FAULT ? PROT_WRITE :
+               cause == CAUSE_FETCH_PAGE_FAULT ? PROT_EXEC : PROT_READ;
+  if ((vma->prot & access) == 0) return -1;
+
+  return vma_prepare(proc, va, 1, access == PROT_WRITE);
+}
+
+//
+// make [va, va+size) of proc accessible through the kernel's direct mapping of
+// physical memory: map the pages not touched yet and, if the kernel is about to
+// write, break their copy-on-write sharing (the direct mapping bypasses the write
+// protection of the user page table).
+// return: -1 if the range is not fully covered by regions.
+//
+int vma_prepare(process *proc, uint64 va, uint64 size, int write) {
+  if (size == 0) return 0;
+  uint64 start = ROUNDDOWN(va, PGSIZE), end = ROUNDUP(va + size, PGSIZE);
+
+  while (start < end) {
+    vm_area *vma = vma_find(proc, start);
+    if (vma == NULL || vma->seg_type == GUARD_SEGMENT) return -1;
+
+    uint64 hi = MIN(vma->end, end);
+    if (vma_populate(proc, vma, start, hi) != 0) return -1;
+    if (write)
+      for (uint64 page = start; page < hi; page += PGSIZE) {
+        pte_t *pte = page_walk(proc->pagetable, page, 0);
+        if (*pte & PTE_COW) {
+          if (cow_break(proc->pagetable, page) != 0) return -1;
+        } else if ((*pte & PTE_W) == 0) {
+          return -1;
+        }
+      }
+    start = hi;
+  }
+  return 0;
+}
+
+//
+// give child the regions of parent. the pages mapped so far are shared: shared memory
+// as it is, the others copy-on-write. mmap regions belong to the device user and are
+// not inherited.
+//
+int vma_fork(process *parent, process *child) {
+  // alloc_process gave child a stack of its own, with no pages mapped yet. the
+  // parent's regions, stack included, take its place.
+  while (child->vmas) {
+    vm_area *vma = child->vmas;
+    child->vmas = vma->next;
+    kfree(vma);
+  }
+
+  for (vm_area *vma = parent->vmas; vma; vma = vma->next) {
+    if (vma->seg_type == MMAP_SEGMENT) continue;
+    if (vma_add(child, vma->start, vma->end, vma->seg_type, vma->prot) == NULL) return -1;
+
+    for (uint64 va = vma->start; va < vma->end; va += PGSIZE) {
+      uint64 pa = lookup_pa(parent->pagetable, va);
+      if (pa == 0) continue;
+      if (vma->seg_type == SHARE_SEGMENT) {
+        user_vm_map(child->pagetable, va, PGSIZE, pa, prot_to_type(vma->prot, 1));
+        page_ref_inc((void *)pa);
+      } else {
+        cow_share_page(parent->pagetable, child->pagetable, va);
+      }
+    }
+  }
+
+  // the parent's writable pages have just become read-only
+  flush_tlb();
+  return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef _VMA_H_
+#define _VMA_H_
+
+#include "util/types.h"
+#include "process.h"
+
+vm_area *vma_find(process *proc, uint64 va);
+vm_area *vma_add(process *proc, uint64 start, uint64 end, int seg_type, int prot);
+int vma_remove(process *proc, uint64 start, uint64 end);
+uint64 vma_find_gap(process *proc, uint64 base, uint64 size);
+
+int vma_handle_fault(process *proc, uint64 va, uint64 cause);
+int vma_prepare(process *proc, uint64 va, uint64 size, int write);
+int vma_fork(process *parent, process *child);
+
+#endif
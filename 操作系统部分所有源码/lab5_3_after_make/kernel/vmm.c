@@ -147,6 +147,10 @@ void kern_vm_init(void) {
   kern_vm_map(t_page_dir, (uint64)0xc201000, (uint64)0xc201000, (uint64)0x100,
          prot_to_type(PROT_READ | PROT_WRITE, 0));
 
+  // clint (mtime and mtimecmp), used to program the timer when the kernel idles.
+  kern_vm_map(t_page_dir, (uint64)CLINT, (uint64)CLINT, (uint64)0x10000,
+         prot_to_type(PROT_READ | PROT_WRITE, 0));
+
   sprint("physical address of _etext is: 0x%lx\n", lookup_pa(t_page_dir, (uint64)_etext));
 
   g_kernel_pagetable = t_page_dir;
@@ -202,20 +206,63 @@ void user_vm_unmap(pagetable_t page_dir, uint64 va, uint64 size, int free) {
 
 }
 
+//
+// map the page at "va" of page_dir into child_dir as well, without copying it. a
+// writable page becomes read-only and copy-on-write in both page tables, until
+// one of them writes to it (see cow_break). the caller flushes the TLB.
+// return: -1 if va is not mapped in page_dir.
+//
+int cow_share_page(pagetable_t page_dir, pagetable_t child_dir, uint64 va) {
+  pte_t *pte = page_walk(page_dir, va, 0);
+  if (pte == 0 || (*pte & PTE_V) == 0) return -1;
+
+  if (*pte & PTE_W) *pte = (*pte & ~PTE_W) | PTE_COW;
+  uint64 pa = PTE2PA(*pte);
+  if (map_pages(child_dir, va, PGSIZE, pa, PTE_FLAGS(*pte) & ~PTE_V) != 0) return -1;
+  page_ref_inc((void *)pa);
+  return 0;
+}
+
+//
+// resolve a write to the copy-on-write page at "va": the last process referencing
+// the page just gets it back writable, the others get a private copy.
+// return: -1 if va is not a copy-on-write page, or no memory is left for the copy.
+//
+int cow_break(pagetable_t page_dir, uint64 va) {
+  pte_t *pte = page_walk(page_dir, va, 0);
+  if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_COW) == 0) return -1;
+
+  uint64 pa = PTE2PA(*pte);
+  uint64 perm = (PTE_FLAGS(*pte) | PTE_W | PTE_D) & ~PTE_COW;
+  if (page_ref_count((void *)pa) > 1) {
+    void *copy = alloc_page();
+    if (copy == NULL) return -1;
+    memcpy(copy, (void *)pa, PGSIZE);
+    free_page((void *)pa);
+    pa = (uint64)copy;
+  }
+  *pte = PA2PTE(pa) | perm;
+  flush_tlb();
+  return 0;
+}
+
 //
 // debug function, print the vm space of a process. added @lab3_1
 //
 void print_proc_vmspace(process* proc) {
   sprint( "======\tbelow is the vm space of process%d\t========\n", proc->pid );
-  for( int i=0; i<proc->total_mapped_region; i++ ){
-    sprint( "-va:%lx, npage:%d, ", proc->mapped_info[i].va, proc->mapped_info[i].npages);
-    switch(proc->mapped_info[i].seg_type){
+  for( vm_area *vma = proc->vmas; vma; vma = vma->next ){
+    sprint( "-va:%lx, npage:%d, ", vma->start, (vma->end - vma->start) / PGSIZE);
+    switch(vma->seg_type){
       case CODE_SEGMENT: sprint( "type: CODE SEGMENT" ); break;
       case DATA_SEGMENT: sprint( "type: DATA SEGMENT" ); break;
+      case WRE_SEGMENT: sprint( "type: WRE SEGMENT" ); break;
       case STACK_SEGMENT: sprint( "type: STACK SEGMENT" ); break;
-      case CONTEXT_SEGMENT: sprint( "type: TRAPFRAME SEGMENT" ); break;
-      case SYSTEM_SEGMENT: sprint( "type: USER KERNEL STACK SEGMENT" ); break;
+      case HEAP_SEGMENT: sprint( "type: HEAP SEGMENT" ); break;
+      case SHARE_SEGMENT: sprint( "type: SHARE SEGMENT" ); break;
+      case MMAP_SEGMENT: sprint( "type: MMAP SEGMENT" ); break;
+      case GUARD_SEGMENT: sprint( "type: GUARD PAGE" ); break;
     }
-    sprint( ", mapped to pa:%lx\n", lookup_pa(proc->pagetable, proc->mapped_info[i].va) );
+    sprint( ", mapped to pa:%lx\n", lookup_pa(proc->pagetable, vma->start) );
   }
 }
@@ -31,6 +31,10 @@ void kern_vm_init(void);
 void *user_va_to_pa(pagetable_t page_dir, void *va);
 void user_vm_map(pagetable_t page_dir, uint64 va, uint64 size, uint64 pa, int perm);
 void user_vm_unmap(pagetable_t page_dir, uint64 va, uint64 size, int free);
+
+/* --- copy-on-write --- */
+int cow_share_page(pagetable_t page_dir, pagetable_t child_dir, uint64 va);
+int cow_break(pagetable_t page_dir, uint64 va);
 void print_proc_vmspace(process* proc);
 
 #endif
@@ -46,7 +46,8 @@ int spike_file_close(spike_file_t* f) {
   if (!f) return -1;
   spike_file_t* old = atomic_cas(&spike_fds[f->kfd], f, 0);
   spike_file_decref(f);
-  if (old != f) return -1;
+  // a file the kernel opened for itself (spike_file_open) has no fd, it is closed too
+  if (old != f && old != NULL) return -1;
   spike_file_decref(f);
   return 0;
 }
@@ -119,6 +120,10 @@ ssize_t spike_file_pread(spike_file_t* f, void* buf, size_t size, off_t offset)
   return frontend_syscall(HTIFSYS_pread, f->kfd, (uint64)buf, size, offset, 0, 0, 0);
 }
 
+ssize_t spike_file_pwrite(spike_file_t* f, const void* buf, size_t size, off_t offset) {
+  return frontend_syscall(HTIFSYS_pwrite, f->kfd, (uint64)buf, size, offset, 0, 0, 0);
+}
+
 ssize_t spike_file_read(spike_file_t* f, void* buf, size_t size) {
   return frontend_syscall(HTIFSYS_read, f->kfd, (uint64)buf, size, 0, 0, 0, 0);
 }
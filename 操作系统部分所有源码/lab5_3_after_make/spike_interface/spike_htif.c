@@ -18,10 +18,12 @@
 #include "string.h"
 
 uint64 htif;  //is Spike HTIF avaiable? initially 0 (false)
+uint64 htif_batch;  // does the host run HTIFSYS_batch? initially 0 (false)
 
 ///////////////////////////    Spike HTIF discovering    //////////////////////////////
 struct htif_scan {
   int compat;
+  int batch;
 };
 
 static void htif_open(const struct fdt_scan_node *node, void *extra) {
@@ -34,6 +36,9 @@ static void htif_prop(const struct fdt_scan_prop *prop, void *extra) {
   if (!strcmp(prop->name, "compatible") && !strcmp((const char *)prop->value, "ucb,htif0")) {
     scan->compat = 1;
   }
+  if (!strcmp(prop->name, "pke,htif-batch")) {
+    scan->batch = 1;
+  }
 }
 
 static void htif_done(const struct fdt_scan_node *node, void *extra) {
@@ -41,6 +46,7 @@ static void htif_done(const struct fdt_scan_node *node, void *extra) {
   if (!scan->compat) return;
 
   htif = 1;
+  htif_batch = scan->batch;
 }
 
 // scanning the HTIF
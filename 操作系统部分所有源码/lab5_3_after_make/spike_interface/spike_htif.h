@@ -86,6 +86,12 @@
 #define HTIFSYS_time 1062
 
 #define HTIFSYS_readmmap 2001
+// run a batch of calls in one round trip: a0 points to an array of a1 entries laid
+// out like the magic_mem of a single call. the host runs them in order, leaves the
+// result of each in its first word, and returns the number of entries run. only
+// hosts whose HTIF node carries the "pke,htif-batch" property understand it (stock
+// Spike does not; test/htif_host.c is a stand-in host that does).
+#define HTIFSYS_batch 2002
 #define IS_ERR_VALUE(x) ((unsigned long)(x) >= (unsigned long)-4096)
 #define ERR_PTR(x) ((void*)(long)(x))
 #define PTR_ERR(x) ((long)(x))
@@ -93,6 +99,7 @@
 #define AT_FDCWD -100
 
 extern uint64 htif;
+extern uint64 htif_batch;
 void query_htif(uint64 dtb);
 
 // Spike HTIF functionalities
@@ -0,0 +1,108 @@
+/*
+ * HTIF syscalls: the kernel's requests to the host (Spike's front-end server), made
+ * one at a time or queued into a batch.
+ *
+ * codes are borrowed from riscv-pk (https://github.com/riscv/riscv-pk)
+ */
+
+#include "atomic.h"
+#include "spike_htif.h"
+#include "spike_utils.h"
+
+//=============    encapsulating htif syscalls, invoking Spike functions    =============
+long frontend_syscall(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4,
+      uint64 a5, uint64 a6) {
+  static volatile uint64 magic_mem[8];
+
+  static spinlock_t lock = SPINLOCK_INIT;
+  spinlock_lock(&lock);
+
+  magic_mem[0] = n;
+  magic_mem[1] = a0;
+  magic_mem[2] = a1;
+  magic_mem[3] = a2;
+  magic_mem[4] = a3;
+  magic_mem[5] = a4;
+  magic_mem[6] = a5;
+  magic_mem[7] = a6;
+
+  htif_syscall((uintptr_t)magic_mem);
+
+  long ret = magic_mem[0];
+
+  spinlock_unlock(&lock);
+  return ret;
+}
+
+//=============    batched htif syscalls, retired in one round trip    =============
+// the ring of queued calls. each entry is the magic_mem of one call, whose first
+// word holds the result once the batch is retired.
+static volatile uint64 batch_ring[HTIF_BATCH_MAX][8];
+static int batch_count;      // entries queued since htif_batch_begin
+static int batch_retired;    // entries before it hold their results
+static spinlock_t batch_lock = SPINLOCK_INIT;
+
+//
+// take the batch ring and empty it. the ring is held until htif_batch_end.
+//
+void htif_batch_begin(void) {
+  spinlock_lock(&batch_lock);
+  batch_count = batch_retired = 0;
+}
+
+//
+// queue a call into the ring.
+// return: the slot of the call (see htif_batch_result), -1 if the ring is full.
+//
+int htif_batch_add(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4,
+                   uint64 a5, uint64 a6) {
+  if (batch_count == HTIF_BATCH_MAX) return -1;
+  volatile uint64 *req = batch_ring[batch_count];
+  req[0] = n;
+  req[1] = a0;
+  req[2] = a1;
+  req[3] = a2;
+  req[4] = a3;
+  req[5] = a4;
+  req[6] = a5;
+  req[7] = a6;
+  return batch_count++;
+}
+
+//
+// hand all queued calls to the host. a host that runs HTIFSYS_batch takes them in
+// a single round trip, on the others the calls are made one after another.
+//
+void htif_batch_submit(void) {
+  int n = batch_count - batch_retired;
+  if (n <= 0) return;
+
+  if (htif_batch) {
+    long ret = frontend_syscall(HTIFSYS_batch, (uint64)batch_ring[batch_retired], n,
+                                0, 0, 0, 0, 0);
+    if (ret == n) {
+      batch_retired = batch_count;
+      return;
+    }
+    // the host gave up part way, the rest is made call by call
+    if (ret > 0) batch_retired += ret;
+  }
+
+  for (; batch_retired < batch_count; batch_retired++)
+    htif_syscall((uintptr_t)batch_ring[batch_retired]);
+}
+
+//
+// return: the result of the call queued in "slot". the batch must have been submitted.
+//
+long htif_batch_result(int slot) {
+  kassert(slot >= 0 && slot < batch_retired);
+  return batch_ring[slot][0];
+}
+
+//
+// release the batch ring.
+//
+void htif_batch_end(void) {
+  spinlock_unlock(&batch_lock);
+}
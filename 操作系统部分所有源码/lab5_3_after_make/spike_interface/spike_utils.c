@@ -4,37 +4,12 @@
  * codes are borrowed from riscv-pk (https://github.com/riscv/riscv-pk)
  */
 
-#include "atomic.h"
 #include "spike_htif.h"
 #include "util/functions.h"
 #include "util/snprintf.h"
 #include "spike_utils.h"
 #include "spike_file.h"
-
-//=============    encapsulating htif syscalls, invoking Spike functions    =============
-long frontend_syscall(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4,
-      uint64 a5, uint64 a6) {
-  static volatile uint64 magic_mem[8];
-
-  static spinlock_t lock = SPINLOCK_INIT;
-  spinlock_lock(&lock);
-
-  magic_mem[0] = n;
-  magic_mem[1] = a0;
-  magic_mem[2] = a1;
-  magic_mem[3] = a2;
-  magic_mem[4] = a3;
-  magic_mem[5] = a4;
-  magic_mem[6] = a5;
-  magic_mem[7] = a6;
-
-  htif_syscall((uintptr_t)magic_mem);
-
-  long ret = magic_mem[0];
-
-  spinlock_unlock(&lock);
-  return ret;
-}
+#include "kernel/klog.h"
 
 //===============    Spike-assisted printf, output string to terminal    ===============
 static uintptr_t mcall_console_putchar(uint8 ch) {
@@ -95,6 +70,7 @@ void poweroff(uint16_t code) {
 }
 
 void shutdown(int code) {
+  klog_flush();
   sprint("System is shutting down with exit code %d.\n", code);
   frontend_syscall(HTIFSYS_exit, code, 0, 0, 0, 0, 0, 0);
   while (1)
@@ -105,6 +81,8 @@ void do_panic(const char* s, ...) {
   va_list vl;
   va_start(vl, s);
 
+  // what led to the panic is likely still in the kernel log
+  klog_flush();
   sprint(s, vl);
   shutdown(-1);
 
@@ -9,6 +9,15 @@
 long frontend_syscall(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5,
                       uint64 a6);
 
+// calls queued between htif_batch_begin and htif_batch_submit go to the host together
+#define HTIF_BATCH_MAX 32
+void htif_batch_begin(void);
+int htif_batch_add(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4,
+                   uint64 a5, uint64 a6);
+void htif_batch_submit(void);
+long htif_batch_result(int slot);
+void htif_batch_end(void);
+
 void poweroff(uint16 code) __attribute((noreturn));
 void sprint(const char* s, ...);
 void putstring(const char* s);
@@ -0,0 +1,116 @@
+/*
+ * fork smoke test: fork a process with a stack, a heap and a shared page through
+ * do_fork, and check that the child gets the regions of the parent and that their
+ * pages are shared copy-on-write.
+ */
+
+#include "kernel/process.h"
+#include "kernel/vma.h"
+#include "kernel/vmm.h"
+#include "kernel/pmm.h"
+#include "kernel/memlayout.h"
+#include "kernel/sched.h"
+#include "kernel/strap.h"
+#include "kernel/timer.h"
+#include "kernel/trace.h"
+#include "kernel/vdso.h"
+#include "kernel/proc_file.h"
+#include "kernel/riscv.h"
+#include "util/functions.h"
+
+// the parts of the kernel that do_fork reaches but this test does not look at
+char trap_sec_start[PGSIZE] __attribute__((aligned(PGSIZE)));
+void smode_trap_handler(void) {}
+void return_to_user(trapframe *tf, uint64 satp) {}
+void vdso_map(process *proc) {}
+void trace_event(int type, uint32 arg, uint64 arg2) {}
+void timer_release(uint64 pid) {}
+void schedule() {}
+void preempt_current() {}
+proc_file_management *init_proc_file_management(void) { return NULL; }
+
+static int nready;
+void insert_to_ready_queue(process *proc) { nready++; }
+
+//
+// touch the page at va of proc as the app would, and return it
+//
+static char *touch(process *proc, uint64 va, int write) {
+  uint64 cause = write ? CAUSE_STORE_PAGE_FAULT : CAUSE_LOAD_PAGE_FAULT;
+  pte_t *pte = page_walk(proc->pagetable, va, 0);
+  if (pte == NULL || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0))
+    host_check(vma_handle_fault(proc, va, cause) == 0);
+  return (char *)lookup_pa(proc->pagetable, va) + (va & (PGSIZE - 1));
+}
+
+static int same_regions(process *a, process *b) {
+  vm_area *x = a->vmas, *y = b->vmas;
+  for (; x && y; x = x->next, y = y->next)
+    if (x->start != y->start || x->end != y->end || x->seg_type != y->seg_type ||
+        x->prot != y->prot)
+      return 0;
+  return x == NULL && y == NULL;
+}
+
+int main() {
+  host_init();
+  init_proc_pool();
+
+  process *parent = alloc_process();
+  parent->status = RUNNING;
+  current = parent;
+
+  uint64 stack_va = USER_STACK_TOP - 8;
+  uint64 heap_va = USER_FREE_ADDRESS_START;
+  uint64 share_va = USER_SHARE_MEMORY_START;
+  host_check(vma_add(parent, heap_va, heap_va + 2 * PGSIZE, HEAP_SEGMENT,
+                     PROT_READ | PROT_WRITE) != NULL);
+  host_check(vma_add(parent, share_va, share_va + PGSIZE, SHARE_SEGMENT,
+                     PROT_READ | PROT_WRITE) != NULL);
+  parent->user_heap.heap_top = heap_va + 2 * PGSIZE;
+
+  *touch(parent, stack_va, 1) = 's';
+  *touch(parent, heap_va, 1) = 'h';
+  *touch(parent, share_va, 1) = 'm';
+
+  // fork: this used to panic on the stack region alloc_process gives the child
+  int pid = do_fork(parent);
+  process *child = &procs[pid];
+  host_check(child != parent && nready == 1);
+  host_check(child->trapframe->regs.a0 == 0 && child->parent == parent);
+  host_check(same_regions(parent, child));
+  host_check(child->user_heap.heap_top == parent->user_heap.heap_top);
+
+  // private pages are shared read-only until one of the processes writes
+  uint64 pa = lookup_pa(parent->pagetable, stack_va);
+  host_check(pa != 0 && lookup_pa(child->pagetable, stack_va) == pa);
+  host_check(page_ref_count((void *)ROUNDDOWN(pa, PGSIZE)) == 2);
+  host_check(*page_walk(child->pagetable, stack_va, 0) & PTE_COW);
+  host_check(*touch(child, stack_va, 0) == 's');
+
+  *touch(child, stack_va, 1) = 'c';
+  host_check(lookup_pa(child->pagetable, stack_va) != pa);
+  host_check(*touch(parent, stack_va, 0) == 's');
+  host_check(page_ref_count((void *)ROUNDDOWN(pa, PGSIZE)) == 1);
+
+  // the last process on a copy-on-write page takes it back without a copy
+  *touch(parent, stack_va, 1) = 'p';
+  host_check(lookup_pa(parent->pagetable, stack_va) == pa);
+
+  // shared memory stays shared and writable in both
+  *touch(child, share_va, 1) = 'M';
+  host_check(*touch(parent, share_va, 0) == 'M');
+
+  // the heap page untouched before the fork is the child's own
+  *touch(child, heap_va + PGSIZE, 1) = 'x';
+  host_check(lookup_pa(parent->pagetable, heap_va + PGSIZE) == 0);
+  host_check(*touch(child, heap_va, 0) == 'h');
+
+  // and the child can fork again
+  current = child;
+  process *grandchild = &procs[do_fork(child)];
+  host_check(same_regions(child, grandchild));
+  host_check(*touch(grandchild, stack_va, 0) == 'c');
+
+  return 0;
+}
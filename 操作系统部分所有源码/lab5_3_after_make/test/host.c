@@ -0,0 +1,81 @@
+/*
+ * what the kernel parts under test need from the rest of the kernel and from the
+ * machine, on the build machine: the physical memory, the CLINT, the console and
+ * panic.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// as in kernel/memlayout.h and kernel/config.h
+#define DRAM_BASE 0x80000000UL
+#define HOST_RAM_SIZE (1024 * 1024UL)
+// as in kernel/riscv.h. the test moves mtime itself.
+#define CLINT 0x2000000UL
+#define CLINT_SIZE 0x10000UL
+
+// the kernel image ends at host_kernel_end (see the Makefile), the rest is free memory
+unsigned long g_mem_size = HOST_RAM_SIZE;
+void pmm_init(void);
+
+static void host_map(unsigned long base, unsigned long size) {
+  void *p = mmap((void *)base, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if (p != (void *)base) {
+    perror("host_init: cannot map the machine");
+    exit(2);
+  }
+}
+
+void host_init(void) {
+  host_map(DRAM_BASE, HOST_RAM_SIZE);
+  host_map(CLINT, CLINT_SIZE);
+  pmm_init();
+}
+
+void host_fail(const char *file, int line, const char *cond) {
+  fprintf(stderr, "%s:%d: check failed: %s\n", file, line, cond);
+  exit(1);
+}
+
+void host_report(const char *fmt, ...) {
+  va_list vl;
+  va_start(vl, fmt);
+  vprintf(fmt, vl);
+  va_end(vl);
+}
+
+// the console stays quiet, so that a test prints only what it checks
+void sprint(const char *s, ...) {}
+
+void klog(int subsys, int level, const char *fmt, ...) {
+  if (level > 0) return;
+  va_list vl;
+  va_start(vl, fmt);
+  vfprintf(stderr, fmt, vl);
+  va_end(vl);
+  fputc('\n', stderr);
+}
+
+void do_panic(const char *s, ...) {
+  va_list vl;
+  va_start(vl, s);
+  vfprintf(stderr, s, vl);
+  va_end(vl);
+  exit(1);
+}
+
+void kassert_fail(const char *s) {
+  fprintf(stderr, "assertion failed: %s\n", s);
+  exit(1);
+}
+
+void poweroff(unsigned short code) {
+  exit(code ? 1 : 0);
+}
+
+void shutdown(int code) {
+  exit(code ? 1 : 0);
+}
@@ -0,0 +1,26 @@
+/*
+ * included first into every file of a host test (see the host_test target of the
+ * Makefile): the kernel is built for the build machine, with the RISC-V instructions
+ * (csr accesses, sfence.vma, ...) turned into no-ops. reading a csr gives garbage, so
+ * the warnings about it are off.
+ */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#define asm __host_asm
+#define __host_asm(...) ((void)0)
+#define volatile(...)
+static int __host_asm __attribute__((unused));
+
+// map the emulated physical memory at DRAM_BASE and the CLINT, and initialize the page
+// allocator
+void host_init(void);
+// stop the test with a message if cond does not hold
+#define host_check(cond) \
+  ((cond) ? (void)0 : host_fail(__FILE__, __LINE__, #cond))
+void host_fail(const char *file, int line, const char *cond) __attribute__((noreturn));
+// print what a test measured
+void host_report(const char *fmt, ...);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * hostfs test: write 2000 small log records to a hostfs file and read them back in
+ * 37-byte pieces, through the vfs and the stand-in host, and count the host calls.
+ */
+
+#include "kernel/hostfs.h"
+#include "kernel/vfs.h"
+#include "kernel/riscv.h"
+#include "util/string.h"
+#include "test/htif_host.h"
+
+#define NRECORDS 2000
+// "record nnnn\n"
+#define RECORD_LEN 12
+#define PIECE 37
+
+static char record[RECORD_LEN + 1] = "record 0000\n";
+static char piece[PIECE], expected[PIECE];
+
+static void number(char *rec, int i) {
+  for (int d = 10; d >= 7; d--, i /= 10) rec[d] = '0' + i % 10;
+}
+
+// byte "pos" of the file
+static char log_byte(int pos) {
+  char rec[RECORD_LEN + 1] = "record 0000\n";
+  number(rec, pos / RECORD_LEN);
+  return rec[pos % RECORD_LEN];
+}
+
+static ssize_t transfer(struct file *f, char *buf, uint64 len, int write) {
+  struct io_seg seg = {buf, len};
+  struct io_vec iov = {&seg, 1, len};
+  return write ? vfs_write(f, &iov) : vfs_read(f, &iov);
+}
+
+int main() {
+  host_init();
+  vfs_init();
+  host_check(register_hostfs() == 0);
+  init_host_device("HOSTDEV", (char *)host_files_init());
+  host_check(vfs_mount("HOSTDEV", MOUNT_AS_ROOT) != NULL);
+
+  // the records gather in the page buffer, each full page is one pwrite
+  struct file *f = vfs_open("/log", O_RDWR | O_CREAT);
+  host_check(f != NULL);
+  unsigned long calls = host_calls;
+  for (int i = 0; i < NRECORDS; i++) {
+    number(record, i);
+    host_check(transfer(f, record, RECORD_LEN, 1) == RECORD_LEN);
+  }
+  host_check(vfs_close(f) == 0);
+  unsigned long write_calls = host_calls - calls;
+  host_check(host_file_size("log") == NRECORDS * RECORD_LEN);
+
+  // a sequential read fetches a page ahead
+  f = vfs_open("/log", O_RDONLY);
+  host_check(f != NULL);
+  calls = host_calls;
+  int pos = 0;
+  ssize_t r;
+  while ((r = transfer(f, piece, PIECE, 0)) > 0) {
+    for (int i = 0; i < r; i++) expected[i] = log_byte(pos + i);
+    host_check(memcmp(piece, expected, r) == 0);
+    pos += r;
+  }
+  host_check(r == 0 && pos == NRECORDS * RECORD_LEN);
+  host_check(vfs_close(f) == 0);
+  unsigned long read_calls = host_calls - calls;
+
+  host_report("hostfs host calls for %d records of %d bytes: %lu to write and close, "
+              "%lu to read back in %d-byte pieces and close\n",
+              NRECORDS, RECORD_LEN, write_calls, read_calls, PIECE);
+  // a pwrite or pread per page and the close. the reads that find the end of the file
+  // are two: the one of the last piece, and the one that returns nothing.
+  int pages = (NRECORDS * RECORD_LEN + PGSIZE - 1) / PGSIZE;
+  host_check(write_calls == pages + 1);
+  host_check(read_calls == pages + 3);
+  return 0;
+}
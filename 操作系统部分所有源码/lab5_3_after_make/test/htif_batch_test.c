@@ -0,0 +1,87 @@
+/*
+ * htif batch test: run the host calls of the capture path (the requeue QBUF with the
+ * next DQBUF, then one readmmap per run of frame pages) against the stand-in host,
+ * with and without HTIFSYS_batch, and count the round trips per frame.
+ */
+
+#include "spike_interface/spike_utils.h"
+#include "kernel/riscv.h"
+#include "test/htif_host.h"
+
+#define NFRAMES 30
+#define NBUFFERS 2
+// a 320x180 YUYV frame, its pages each in a run of their own (the worst case)
+#define FRAME_LEN (320 * 180 * 2)
+#define FRAME_RUNS ((FRAME_LEN + PGSIZE - 1) / PGSIZE)
+
+static char pages[FRAME_RUNS][PGSIZE];
+static uint32 held_buf[22], data[22];
+
+// the v4l2 request numbers as the app encodes them, _IOWR('V', nr, 88 bytes)
+#define REQUEST(nr) ((3UL << 30) | (88UL << 16) | ('V' << 8) | (nr))
+
+//
+// one frame, as capture_ioctl() and mmap_sync() in kernel/proc_file.c do it
+//
+static void frame(int requeue) {
+  htif_batch_begin();
+  if (requeue) htif_batch_add(HTIFSYS_ioctl, 3, REQUEST(15), (uint64)held_buf, 0, 0, 0, 0);
+  int slot = htif_batch_add(HTIFSYS_ioctl, 3, REQUEST(17), (uint64)data, 0, 0, 0, 0);
+  htif_batch_submit();
+  host_check(htif_batch_result(slot) == 0);
+  htif_batch_end();
+  uint32 index = data[0];
+  held_buf[0] = index;
+
+  htif_batch_begin();
+  for (int i = 0; i < FRAME_RUNS; i++) {
+    uint64 len = i == FRAME_RUNS - 1 ? FRAME_LEN - i * PGSIZE : PGSIZE;
+    host_check(htif_batch_add(HTIFSYS_readmmap, index, i * PGSIZE, len, (uint64)pages[i],
+                              0, 0, 0) == i);
+  }
+  htif_batch_submit();
+  for (int i = 0; i < FRAME_RUNS; i++) {
+    uint64 len = i == FRAME_RUNS - 1 ? FRAME_LEN - i * PGSIZE : PGSIZE;
+    host_check(htif_batch_result(i) == len);
+    host_check((unsigned char)pages[i][len - 1] == host_frame_byte(index, i * PGSIZE + len - 1));
+  }
+  htif_batch_end();
+}
+
+//
+// the round trips of NFRAMES frames, the first one has no buffer to requeue
+//
+static unsigned long run(void) {
+  host_camera_init(NBUFFERS);
+  for (uint32 i = 0; i < NBUFFERS; i++)
+    frontend_syscall(HTIFSYS_ioctl, 3, REQUEST(15), (uint64)&i, 0, 0, 0, 0);
+
+  unsigned long before = host_round_trips, calls = host_calls;
+  for (int i = 0; i < NFRAMES; i++) frame(i > 0);
+  host_check(host_calls - calls == NFRAMES * (2 + FRAME_RUNS) - 1);
+  return host_round_trips - before;
+}
+
+int main() {
+  host_check(FRAME_RUNS <= HTIF_BATCH_MAX);
+
+  // stock Spike: the calls of a batch are made one after another
+  htif_batch = 0;
+  unsigned long one_by_one = run();
+  host_check(one_by_one == NFRAMES * (2 + FRAME_RUNS) - 1);
+
+  // a host that runs HTIFSYS_batch
+  htif_batch = 1;
+  unsigned long batched = run();
+  host_check(batched == NFRAMES * 2);
+
+  // a host that gives up part way: the rest is made call by call
+  host_batch_limit = 10;
+  unsigned long partial = run();
+  host_check(partial == NFRAMES * (2 + FRAME_RUNS - 10));
+  host_batch_limit = (unsigned long)-1;
+
+  host_report("htif round trips for %d frames of %d pages: %lu one by one, %lu batched\n",
+              NFRAMES, FRAME_RUNS, one_by_one, batched);
+  return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * a stand-in for the host side of HTIF, see test/htif_host.h. it does with the build
+ * machine what Spike's front-end server does for the emulated one: a request is the
+ * magic_mem of one call (number and 7 arguments), its result goes to the first word.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test/htif_host.h"
+
+typedef unsigned long uint64;
+
+// as in spike_interface/spike_htif.h
+#define HTIFSYS_read 63
+#define HTIFSYS_write 64
+#define HTIFSYS_openat 56
+#define HTIFSYS_close 57
+#define HTIFSYS_lseek 62
+#define HTIFSYS_fstat 80
+#define HTIFSYS_pread 67
+#define HTIFSYS_pwrite 68
+#define HTIFSYS_ioctl 29
+#define HTIFSYS_readmmap 2001
+#define HTIFSYS_batch 2002
+
+// as in kernel/hostfs.h
+#define V4L2_IOC_NR(request) ((request) & 0xff)
+#define V4L2_IOC_NR_QBUF 15
+#define V4L2_IOC_NR_DQBUF 17
+#define HOST_EAGAIN 11
+#define HOST_ENOSYS 38
+
+// as struct frontend_stat in spike_interface/spike_file.h
+struct host_stat {
+  uint64 dev, ino;
+  unsigned mode, nlink, uid, gid;
+  uint64 rdev, pad1, size;
+  unsigned blksize, pad2;
+  uint64 blocks, atime, pad3, mtime, pad4, ctime, pad5;
+  unsigned unused4, unused5;
+};
+
+// what the kernel finds out from the device tree
+uint64 htif = 1, htif_batch;
+
+unsigned long host_round_trips, host_calls;
+unsigned long host_batch_limit = (unsigned long)-1;
+
+// the queued buffers of the camera, in the order they were queued
+static unsigned camera_queue[64];
+static int camera_queued, camera_nbuffers;
+
+void host_camera_init(int nbuffers) {
+  camera_nbuffers = nbuffers;
+  camera_queued = 0;
+}
+
+unsigned char host_frame_byte(unsigned long num, unsigned long offset) {
+  return (unsigned char)(num * 31 + offset / 8);
+}
+
+// QBUF and DQBUF on the camera: data points to a v4l2_buffer, which starts with the
+// buffer index. a DQBUF with nothing queued fails as a non-blocking driver does.
+static long camera_ioctl(uint64 request, unsigned *data) {
+  switch (V4L2_IOC_NR(request)) {
+    case V4L2_IOC_NR_QBUF:
+      if (*data >= (unsigned)camera_nbuffers || camera_queued == 64) return -1;
+      camera_queue[camera_queued++] = *data;
+      return 0;
+    case V4L2_IOC_NR_DQBUF:
+      if (camera_queued == 0) return -HOST_EAGAIN;
+      *data = camera_queue[0];
+      memmove(camera_queue, camera_queue + 1, --camera_queued * sizeof(unsigned));
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+static char files_dir[] = "/tmp/htif_host.XXXXXX";
+
+static void host_files_remove(void) {
+  char cmd[64];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", files_dir);
+  if (system(cmd) != 0) fprintf(stderr, "htif host: cannot remove %s\n", files_dir);
+}
+
+const char *host_files_init(void) {
+  if (mkdtemp(files_dir) == NULL) {
+    perror("htif host: cannot make the file directory");
+    exit(2);
+  }
+  atexit(host_files_remove);
+  return files_dir;
+}
+
+long host_file_size(const char *name) {
+  char path[sizeof(files_dir) + 64];
+  struct stat st;
+  snprintf(path, sizeof(path), "%s/%s", files_dir, name);
+  return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+// the file calls are served by the build machine, their errors come back as -errno
+static long file_result(long r) { return r < 0 ? -errno : r; }
+
+static long file_fstat(int fd, struct host_stat *hs) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) return -errno;
+  memset(hs, 0, sizeof(*hs));
+  hs->dev = st.st_dev;
+  hs->ino = st.st_ino;
+  hs->mode = st.st_mode;
+  hs->nlink = st.st_nlink;
+  hs->size = st.st_size;
+  hs->blksize = st.st_blksize;
+  hs->blocks = st.st_blocks;
+  return 0;
+}
+
+static long serve(volatile uint64 *req) {
+  if (req[0] != HTIFSYS_batch) host_calls++;
+  switch (req[0]) {
+    case HTIFSYS_openat:
+      return file_result(openat(req[1], (char *)req[2], req[4], req[5]));
+    case HTIFSYS_close:
+      return file_result(close(req[1]));
+    case HTIFSYS_read:
+      return file_result(read(req[1], (void *)req[2], req[3]));
+    case HTIFSYS_write:
+      return file_result(write(req[1], (void *)req[2], req[3]));
+    case HTIFSYS_pread:
+      return file_result(pread(req[1], (void *)req[2], req[3], req[4]));
+    case HTIFSYS_pwrite:
+      return file_result(pwrite(req[1], (void *)req[2], req[3], req[4]));
+    case HTIFSYS_lseek:
+      return file_result(lseek(req[1], req[2], req[3]));
+    case HTIFSYS_fstat:
+      return file_fstat(req[1], (struct host_stat *)req[2]);
+    case HTIFSYS_ioctl:
+      return camera_ioctl(req[2], (unsigned *)req[3]);
+    case HTIFSYS_readmmap: {
+      unsigned char *dst = (unsigned char *)req[4];
+      for (uint64 i = 0; i < req[3]; i++) dst[i] = host_frame_byte(req[1], req[2] + i);
+      return req[3];
+    }
+    case HTIFSYS_batch: {
+      volatile uint64 (*entries)[8] = (volatile uint64 (*)[8])req[1];
+      uint64 n = req[2] < host_batch_limit ? req[2] : host_batch_limit;
+      for (uint64 i = 0; i < n; i++) entries[i][0] = serve(entries[i]);
+      return n;
+    }
+    default:
+      fprintf(stderr, "htif host: call %lu is not served\n", req[0]);
+      return -HOST_ENOSYS;
+  }
+}
+
+//
+// the kernel's side of a round trip (spike_interface/spike_htif.c)
+//
+void htif_syscall(uint64 arg) {
+  volatile uint64 *req = (volatile uint64 *)arg;
+  host_round_trips++;
+  req[0] = serve(req);
+}
@@ -0,0 +1,26 @@
+/*
+ * a stand-in for the host side of HTIF (Spike's front-end server), for host tests:
+ * it serves the kernel's htif_syscall() in the same process, and understands the
+ * HTIFSYS_batch format (see spike_interface/spike_htif.h). the file calls go to the
+ * files of a temporary directory of the build machine.
+ */
+
+#ifndef _HTIF_HOST_H_
+#define _HTIF_HOST_H_
+
+// tohost/fromhost round trips made by the kernel, and the calls served in them
+extern unsigned long host_round_trips, host_calls;
+// entries a HTIFSYS_batch runs at most before it gives up, to test partial batches
+extern unsigned long host_batch_limit;
+
+// the camera of the stand-in: "nbuffers" buffers whose readmmap content is a pattern
+// of the buffer number and the offset (see host_frame_byte)
+void host_camera_init(int nbuffers);
+unsigned char host_frame_byte(unsigned long num, unsigned long offset);
+
+// make the temporary directory (removed at exit) and return its path, the hostfs root
+const char *host_files_init(void);
+// the size of a file in that directory, -1 if there is none
+long host_file_size(const char *name);
+
+#endif
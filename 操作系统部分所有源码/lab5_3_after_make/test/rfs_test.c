@@ -0,0 +1,76 @@
+/*
+ * rfs test: count the block writes that reach the RAM disk. metadata updates (file
+ * creation, link, unlink) stay in the block cache, fsync and the last close of a file
+ * push it to the disk.
+ */
+
+#include "kernel/rfs.h"
+#include "kernel/vfs.h"
+#include "kernel/riscv.h"
+#include "util/string.h"
+
+static int writes;
+static int (*disk_write)(struct rfs_device *, int, int, uint64, const void *);
+
+static int counting_write(struct rfs_device *rdev, int blkno, int off, uint64 len,
+                          const void *buf) {
+  writes++;
+  return disk_write(rdev, blkno, off, len, buf);
+}
+
+// the size of inode "inum" as it is on the disk
+static int disk_size(struct rfs_device *rdev, int inum) {
+  char *block = (char *)rdev->d_address +
+                (RFS_BLK_OFFSET_INODE + inum / (RFS_BLKSIZE / RFS_INODESIZE)) * RFS_BLKSIZE;
+  return ((struct rfs_dinode *)(block + inum % (RFS_BLKSIZE / RFS_INODESIZE) *
+                                            RFS_INODESIZE))->size;
+}
+
+static void write_str(struct file *f, char *s) {
+  struct io_seg seg = {s, strlen(s)};
+  struct io_vec iov = {&seg, 1, seg.len};
+  host_check(vfs_write(f, &iov) == seg.len);
+}
+
+int main() {
+  host_init();
+  vfs_init();
+  host_check(register_rfs() == 0);
+  struct device *dev = init_rfs_device("RAMDISK0");
+  host_check(rfs_format_dev(dev) == 0);
+  host_check(vfs_mount("RAMDISK0", MOUNT_AS_ROOT) != NULL);
+
+  struct rfs_device *rdev = rfs_device_list[dev->dev_id];
+  disk_write = rdev->d_write;
+  rdev->d_write = counting_write;
+
+  // creating, linking and unlinking files only changes cached blocks
+  struct file *f = vfs_open("/a", O_RDWR | O_CREAT);
+  struct file *g = vfs_open("/c", O_RDWR | O_CREAT);
+  host_check(f != NULL && g != NULL);
+  host_check(vfs_link("/a", "/b") == 0);
+  host_check(vfs_unlink("/b") == 0);
+  host_check(writes == 0);
+
+  // fsync puts the file on the disk
+  int inum = f->f_dentry->dentry_inode->inum;
+  write_str(f, "hello");
+  host_check(vfs_fsync(f) == 0);
+  host_check(writes > 0 && disk_size(rdev, inum) == 5);
+
+  // so does the last close of a file, and nothing else
+  struct file *f2 = vfs_open("/a", O_RDWR);
+  host_check(f2 != NULL && f2->f_dentry == f->f_dentry);
+  write_str(f, "world");
+  int before = writes;
+  host_check(vfs_close(f2) == 0);
+  host_check(writes == before);
+  host_check(vfs_close(f) == 0);
+  host_check(writes > before && disk_size(rdev, inum) == 10);
+
+  // the blocks of the other file went out with the first one: its close writes nothing
+  before = writes;
+  host_check(vfs_close(g) == 0);
+  host_check(writes == before);
+  return 0;
+}
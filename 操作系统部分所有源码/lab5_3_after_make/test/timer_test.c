@@ -0,0 +1,126 @@
+/*
+ * timer test: run the timer interrupts of one emulated second, with a 30 Hz periodic
+ * timer of an app on the wheel, and check that the early interrupts of the wheel are
+ * not counted as ticks and do not shift the tick. then check that a process woken by
+ * an early interrupt takes over from a lower-priority one at once.
+ */
+
+#include "kernel/timer.h"
+#include "kernel/config.h"
+#include "kernel/riscv.h"
+#include "kernel/process.h"
+#include "kernel/proc_file.h"
+#include "kernel/sched.h"
+#include "kernel/serial.h"
+#include "kernel/futex.h"
+
+// the parts of the kernel that timer.c and sched.c reach but this test does not look at
+process procs[NPROC];
+process *current;
+static trapframe tf[NPROC];
+void do_sleep(void wake_cb(void *), void *wake_cb_arg) { current->status = BLOCKED; }
+uint64 serial_next_deadline(void) { return TIMER_NO_DEADLINE; }
+uint64 capture_next_deadline(void) { return TIMER_NO_DEADLINE; }
+uint64 futex_next_deadline(void) { return TIMER_NO_DEADLINE; }
+void klog_flush(void) {}
+void trace_event(int type, uint32 arg, uint64 arg2) {}
+int handle_mtimer_trap(void) { return 0; }
+void expire_timeouts(void) {}
+void handle_mexternal_trap(void) {}
+
+// the processes the scheduler switched to
+static int switches;
+void switch_to(process *proc) { switches++; }
+
+#define mtime (*(uint64 *)CLINT_MTIME)
+#define mtimecmp (*(uint64 *)CLINT_MTIMECMP(0))
+
+//
+// the S-mode part of a timer interrupt, as handle_mtimer_trap() and the trap handler
+// do it. returns non-zero if it was a tick.
+//
+static int interrupt(void) {
+  timer_wheel_run();
+  int tick = timer_tick_due();
+  timer_rearm();
+  if (!tick) preempt_current();
+  return tick;
+}
+
+int main() {
+  host_init();
+  for (int i = 0; i < NPROC; i++) {
+    procs[i].pid = i;
+    procs[i].trapframe = &tf[i];
+    procs[i].priority = SCHED_PRIO_NORMAL;
+  }
+  current = &procs[0];
+  current->status = RUNNING;
+
+  // as timerinit() does
+  mtime = 0;
+  mtimecmp = TIMER_INTERVAL;
+
+  uint64 period = MTIME_FREQ / 30;
+  int td = timer_periodic_create(period);
+  host_check(td >= 0);
+  host_check(mtimecmp == period);
+
+  int ticks = 0, interrupts = 0;
+  long expirations = 0;
+  while (mtimecmp <= MTIME_FREQ) {
+    // the interrupt comes right on time. the M-mode handler turns the timer off ...
+    mtime = mtimecmp;
+    mtimecmp = (uint64)-1;
+    interrupts++;
+
+    // ... and the S-mode handler turns it back on
+    if (interrupt()) {
+      // ticks keep their phase
+      host_check(mtime == (uint64)(ticks + 1) * TIMER_INTERVAL);
+      ticks++;
+    }
+    host_check(mtimecmp > mtime);
+
+    // the app waits for its timer: an expiry wakes it with the count in a0
+    if (current->status == READY) schedule();
+    expirations += tf[0].regs.a0;
+    tf[0].regs.a0 = 0;
+    expirations += timer_periodic_wait(td);
+    current->status = RUNNING;
+  }
+
+  host_check(ticks == MTIME_FREQ / TIMER_INTERVAL);
+  host_check(expirations == 30);
+  // one interrupt per tick and one per period (no period ends right on a tick)
+  host_check(interrupts == ticks + expirations);
+
+  // a late interrupt skips the missed ticks but keeps the phase
+  uint64 now = mtime + 5 * TIMER_INTERVAL / 2;
+  mtime = now;
+  host_check(timer_tick_due() && !timer_tick_due());
+  timer_periodic_close(td);
+  timer_rearm();
+  host_check(mtimecmp == (now / TIMER_INTERVAL + 1) * TIMER_INTERVAL);
+
+  // a real-time process sleeps for 1 ms while a normal one runs. the early interrupt
+  // that ends the sleep switches to it, it does not wait for the next tick.
+  process *rt = &procs[1];
+  rt->priority = SCHED_PRIO_RT;
+  current = rt;
+  rt->status = RUNNING;
+  timer_sleep(MTIME_FREQ / 1000);
+  host_check(rt->status == BLOCKED);
+  current = &procs[0];
+  current->status = RUNNING;
+
+  host_check(mtimecmp == mtime + MTIME_FREQ / 1000);
+  mtime = mtimecmp;
+  mtimecmp = (uint64)-1;
+  switches = 0;
+  host_check(!interrupt());
+  host_check(switches == 1 && current == rt && rt->status == RUNNING);
+  host_check(procs[0].status == READY && !ready_queue_empty());
+  host_check(mtimecmp == (mtime / TIMER_INTERVAL + 1) * TIMER_INTERVAL);
+  return 0;
+}
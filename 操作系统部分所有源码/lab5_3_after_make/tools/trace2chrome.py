@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+#
+# turn a kernel trace dump (trace_u(TRACE_CMD_DUMP, path), see kernel/trace.h) into a
+# Chrome trace, to be opened with chrome://tracing or https://ui.perfetto.dev.
+#
+# usage: tools/trace2chrome.py hostfs_root/trace.bin > trace.json
+#
+
+import json
+import os
+import re
+import struct
+import sys
+
+TRACE_MAGIC = 0x52544b50
+TRACE_VERSION = 1
+
+HEADER = struct.Struct("<IIQQ")
+EVENT = struct.Struct("<QQHHIQ")
+
+TRAP_ENTER, TRAP_EXIT, SYSCALL_ENTER, SYSCALL_EXIT, SWITCH, IRQ, PAGE_FAULT, FRAME = range(1, 9)
+
+# the user syscall names, by number, from kernel/syscall.h
+SYSCALL_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "kernel", "syscall.h")
+
+
+def load_syscall_names():
+    names = {}
+    try:
+        with open(SYSCALL_H) as f:
+            text = f.read()
+    except OSError:
+        return names
+    base = re.search(r"#define SYS_user_base (\d+)", text)
+    if base:
+        for m in re.finditer(r"#define SYS_user_(\w+) \(SYS_user_base \+ (\d+)\)", text):
+            names[int(base.group(1)) + int(m.group(2))] = m.group(1)
+    return names
+
+
+SYSCALL_NAMES = load_syscall_names()
+
+
+def syscall_name(num):
+    return SYSCALL_NAMES.get(num, "syscall %d" % num)
+
+
+def trap_name(cause):
+    if cause & 0x80000000:
+        return "interrupt %d" % (cause & 0x7fffffff)
+    return "exception %d" % cause
+
+
+def read_events(data):
+    magic, version, mtime_freq, nevents = HEADER.unpack_from(data, 0)
+    if magic != TRACE_MAGIC or version != TRACE_VERSION:
+        sys.exit("not a version %d trace dump" % TRACE_VERSION)
+    off = HEADER.size
+    nevents = min(nevents, (len(data) - off) // EVENT.size)
+    return mtime_freq, [EVENT.unpack_from(data, off + i * EVENT.size) for i in range(nevents)]
+
+
+def to_chrome(mtime_freq, events):
+    out = []
+    for cycle, time, etype, pid, arg, arg2 in events:
+        # pid 0xffff: no process ran, e.g., while the kernel idled
+        tid = -1 if pid == 0xffff else pid
+        e = {"ts": time * 1e6 / mtime_freq, "pid": 0, "tid": tid, "args": {"cycle": cycle}}
+        if etype == TRAP_ENTER:
+            e.update(name=trap_name(arg), cat="trap", ph="B")
+        elif etype == TRAP_EXIT:
+            e.update(name="trap", cat="trap", ph="E")
+        elif etype == SYSCALL_ENTER:
+            e.update(name=syscall_name(arg), cat="syscall", ph="B")
+        elif etype == SYSCALL_EXIT:
+            e.update(name=syscall_name(arg), cat="syscall", ph="E")
+            e["args"]["ret"] = struct.unpack("<q", struct.pack("<Q", arg2))[0]
+        elif etype == SWITCH:
+            e.update(name="switch", cat="sched", ph="i", s="t")
+            e["args"]["from"] = struct.unpack("<i", struct.pack("<I", arg))[0]
+        elif etype == IRQ:
+            e.update(name="irq %d" % arg, cat="irq", ph="i", s="t")
+        elif etype == PAGE_FAULT:
+            e.update(name="page fault", cat="mm", ph="i", s="t")
+            e["args"].update(cause=arg, addr=hex(arg2))
+        elif etype == FRAME:
+            e.update(name="frame", cat="camera", ph="i", s="t")
+            e["args"]["index"] = arg
+        else:
+            e.update(name="event %d" % etype, ph="i", s="t")
+        out.append(e)
+    return out
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: %s <trace dump>" % sys.argv[0])
+    with open(sys.argv[1], "rb") as f:
+        mtime_freq, events = read_events(f.read())
+    json.dump({"traceEvents": to_chrome(mtime_freq, events)}, sys.stdout)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -7,11 +7,29 @@ struct timeval {
 
 #include "user_lib.h"
 #include "videodev2.h"
+#include "ring.h"
 #define DARK 64
 #define RATIO 7 / 10
+#define NBUFFERS 2
+#define NCMDS 16
+#define FRAME_RATE 30
+// the control process collects the frame statistics at least this often (in ticks of
+// 100 ms), well before the stat ring (about 4 s of frames) fills up
+#define STAT_DRAIN_TICKS 10
+
+// telemetry of one processed frame, from the vision process to the control process
+struct frame_stat {
+    int frame;
+    int dark;
+    int stop;   // the vision process stopped the car at this frame
+};
 
 int main() {
-    char *info = allocate_share_page();
+    // one share page holds two rings: Bluetooth commands go to the vision process,
+    // frame statistics come back. the vision process sleeps on the command ring's tail.
+    char *share = allocate_share_page();
+    spsc_ring *cmd_ring = ring_init(share, 2048, sizeof(char));
+    spsc_ring *stat_ring = ring_init(share + 2048, 2048, sizeof(struct frame_stat));
     int pid = fork();
     if (pid == 0) {
         int f = open_u("/dev/video0", O_RDWR), r;
@@ -27,66 +45,130 @@ int main() {
 
         struct v4l2_requestbuffers req;
         req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        req.count = 1; req.memory = V4L2_MEMORY_MMAP;
+        req.count = NBUFFERS; req.memory = V4L2_MEMORY_MMAP;
         r = ioctl_u(f, VIDIOC_REQBUFS, &req);
         printu("Pass request: %d\n", r);
+        int nbuffers = req.count < NBUFFERS ? req.count : NBUFFERS;
 
+        // map every buffer at the offset the driver gave for it
         struct v4l2_buffer buf;
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP; buf.index = 0;
-        r = ioctl_u(f, VIDIOC_QUERYBUF, &buf);
-        printu("Pass buffer: %d\n", r);
+        char *img[NBUFFERS];
+        int length = 0;
+        for (int i = 0; i < nbuffers; i++) {
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf.memory = V4L2_MEMORY_MMAP; buf.index = i;
+            r = ioctl_u(f, VIDIOC_QUERYBUF, &buf);
+            printu("Pass buffer %d: %d\n", i, r);
+            length = buf.length;
+            img[i] = mmap_u(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, f, buf.m.offset);
+        }
 
-        int length = buf.length;
-        char *img = mmap_u(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, f, buf.m.offset);
+        // queue every buffer once. after STREAMON the kernel requeues the previous
+        // buffer on each DQBUF, so the next frame is captured while we process this one.
+        for (int i = 0; i < nbuffers; i++) {
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf.memory = V4L2_MEMORY_MMAP; buf.index = i;
+            r = ioctl_u(f, VIDIOC_QBUF, &buf);
+            printu("Buffer enqueue %d: %d\n", i, r);
+        }
         unsigned int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         r = ioctl_u(f, VIDIOC_STREAMON, &type);
         printu("Open stream: %d\n", r);
 
-        char *img_data = naive_malloc();
-        for (int i = 0; i < (length + 4095) / 4096 - 1; i++)
-            naive_malloc();
+        // frames are taken at a fixed rate, the loop sleeps in between
+        struct ktimespec period = { 0, 1000000000 / FRAME_RATE };
+        int tick = timer_create_u(&period);
+        int64 max_latency = 0;
+
         yield();
 	printu("**************the second group 2024****************\n");
+        int moving = 0, frames = 0, lost = 0;
         for (;;) {
-            if (*info == '1') {
-                r = ioctl_u(f, VIDIOC_QBUF, &buf);
-                printu("Buffer enqueue: %d\n", r);
-                r = ioctl_u(f, VIDIOC_DQBUF, &buf);
-                printu("Buffer dequeue: %d\n", r);
-                r = read_mmap_u(img_data, img, length);
-                int num = 0;
-                for (int i = 0; i < length; i += 2)
-                    if (img_data[i] < DARK) num++;
-                printu("Dark num: %d > %d\n", num, length / 2 * RATIO);
-                if (num > length / 2 * RATIO) {
-                    *info = '0'; car_control('0');
-		    printu("Stop moving forward!!!!!!!!!!!!!!!!!!!!!\n");
-                }
-            } else if (*info == 'q'){
-                    printu("Quit!!!!!!!!!!!!!!!!!!!\n");
-		    break;
-              }
+            // take every command that arrived since the last frame, in order
+            char cmds[NCMDS];
+            int seen = *(volatile int *)&cmd_ring->tail;
+            int n = ring_pop(cmd_ring, cmds, NCMDS), quit = 0;
+            for (int i = 0; i < n; i++) {
+                if (cmds[i] == 'q') quit = 1;
+                else moving = cmds[i] == '1';
+            }
+            if (quit) {
+                printu("Quit!!!!!!!!!!!!!!!!!!!\n");
+                break;
+            }
+            if (!moving) {
+                // not moving forward: sleep until the next command is pushed
+                if (n == 0) futex_wait((int *)&cmd_ring->tail, seen, -1);
+                continue;
+            }
+
+            // periods that passed while the car stood still let the frame go right away
+            timer_wait_u(tick);
+            struct ktimespec start, end;
+            vdso_clock_gettime(&start);
+
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf.memory = V4L2_MEMORY_MMAP;
+            r = ioctl_u(f, VIDIOC_DQBUF, &buf);
+            printu("Buffer dequeue: %d\n", r);
+            if (r < 0 || buf.index >= nbuffers) continue;
+            char *frame = img[buf.index];
+            // the dequeued frame is already in the mapped pages, read it in place
+            int num = 0;
+            for (int i = 0; i < length; i += 2)
+                if (frame[i] < DARK) num++;
+            printu("Dark num: %d > %d\n", num, length / 2 * RATIO);
+            struct frame_stat stat = { frames++, num, 0 };
+            if (num > length / 2 * RATIO) {
+                moving = 0; car_control('0');
+                stat.stop = 1;
+                printu("Stop moving forward!!!!!!!!!!!!!!!!!!!!!\n");
+            }
+            if (ring_push(stat_ring, &stat, 1) == 0) lost++;
+
+            // from taking the frame to the decision on it
+            vdso_clock_gettime(&end);
+            int64 latency = (end.tv_sec - start.tv_sec) * 1000000 +
+                            (end.tv_nsec - start.tv_nsec) / 1000;
+            if (latency > max_latency) max_latency = latency;
         }
+        timer_close_u(tick);
+        printu("Vision loop: %d frames, max latency %d us, %d stats lost\n", frames,
+               (int)max_latency, lost);
 
-        for (char *i = img_data; i - img_data < length; i += 4096)
-            naive_free(i);
         r = ioctl_u(f, VIDIOC_STREAMOFF, &type);
         printu("Close stream: %d\n", r);
-        munmap_u(img, length);
+        for (int i = 0; i < nbuffers; i++)
+            munmap_u(img[i], length);
         close(f);
         exit(0);
     } else {
+        // motor control must never wait behind image processing
+        set_priority(SCHED_PRIO_RT);
         yield();
-        while(1)
-        {
-            char temp = (char)uartgetchar();
-            *info = temp;
-	    printu("Accept the Instructions '%c'\n",temp);
-            if(temp == 'q')
-                break;
-            car_control(temp);
+        char cmds[NCMDS];
+        int quit = 0, frames = 0, stops = 0;
+        while (!quit) {
+            // wake up for the statistics even while no command comes
+            int n = uart_read(cmds, NCMDS, STAT_DRAIN_TICKS);
+            if (n > 0) {
+                // hand the whole batch to the vision process, then wake it if it sleeps
+                if (ring_push(cmd_ring, cmds, n) < n) printu("Command ring full!\n");
+                futex_wake((int *)&cmd_ring->tail, 1);
+            }
+            for (int i = 0; i < n && !quit; i++) {
+                printu("Accept the Instructions '%c'\n", cmds[i]);
+                if (cmds[i] == 'q') quit = 1;
+                else car_control(cmds[i]);
+            }
+
+            struct frame_stat stat;
+            while (ring_pop(stat_ring, &stat, 1)) {
+                frames++;
+                stops += stat.stop;
+            }
         }
+        printu("Vision processed %d frames, stopped the car %d times\n", frames, stops);
     }
     return 0;
 }
@@ -0,0 +1,185 @@
+/*
+ * user-level memory allocator, on top of the sbrk heap.
+ *
+ * requests up to 1 KiB are served from per-size-class free lists: a class takes a
+ * chunk from the large-block allocator and cuts it into equal objects, so small
+ * allocations and frees normally make no syscall. larger requests get a block of the
+ * heap, found first-fit in a free list. a freed block is merged with its free
+ * neighbours (boundary tags), and the heap grows in one sbrk call for any size.
+ */
+
+#include "user_lib.h"
+#include "util/types.h"
+#include "util/functions.h"
+
+#define ALIGN 16
+#define HDR_SIZE 16        // a block header keeps the payload ALIGN-aligned
+#define MIN_BLOCK 48       // header, free list links and footer
+#define HEAP_GROW 16384    // the heap grows at least by this much
+#define INUSE 1            // flags in the low bits of block->size
+#define PREV_INUSE 2
+#define SIZE_MASK (~(size_t)(ALIGN - 1))
+
+// small objects: 16, 32, ..., 1024 bytes
+#define SMALL_MIN_SHIFT 4
+#define SMALL_MAX_SHIFT 10
+#define SMALL_NCLASSES (SMALL_MAX_SHIFT - SMALL_MIN_SHIFT + 1)
+#define SMALL_CHUNK 4096
+
+typedef struct block {
+  size_t size;         // size of the block including the header, plus INUSE/PREV_INUSE
+  size_t cls;          // size class + 1 of a small object, 0 for a large block
+  struct block *next;  // free list links (overlap the payload)
+  struct block *prev;
+} block;
+
+#define BLOCK_SIZE(b) ((b)->size & SIZE_MASK)
+#define NEXT_BLOCK(b) ((block *)((char *)(b) + BLOCK_SIZE(b)))
+#define FOOTER(b, sz) (*(size_t *)((char *)(b) + (sz) - sizeof(size_t)))
+
+static block *free_list;                    // free large blocks
+static block *small_free[SMALL_NCLASSES];   // free small objects of each class
+static block *epilogue;                     // in-use, empty block ending the heap
+static char *heap_end;                      // end of the memory got from sbrk
+
+static void list_insert(block *b) {
+  b->prev = NULL;
+  b->next = free_list;
+  if (free_list) free_list->prev = b;
+  free_list = b;
+}
+
+static void list_remove(block *b) {
+  if (b->prev) b->prev->next = b->next;
+  else free_list = b->next;
+  if (b->next) b->next->prev = b->prev;
+}
+
+//
+// make b a free block of "size" bytes: write its footer and tell the next block
+//
+static void set_free(block *b, size_t size) {
+  b->size = size | (b->size & PREV_INUSE);
+  b->cls = 0;
+  FOOTER(b, size) = size;
+  NEXT_BLOCK(b)->size &= ~PREV_INUSE;
+}
+
+//
+// merge the free block b with its free neighbours, and put it on the free list
+//
+static block *coalesce(block *b) {
+  size_t size = BLOCK_SIZE(b);
+  block *next = NEXT_BLOCK(b);
+  if (!(next->size & INUSE)) {
+    list_remove(next);
+    size += BLOCK_SIZE(next);
+  }
+  if (!(b->size & PREV_INUSE)) {
+    size_t prev_size = *(size_t *)((char *)b - sizeof(size_t));
+    block *prev = (block *)((char *)b - prev_size);
+    list_remove(prev);
+    size += prev_size;
+    b = prev;
+  }
+  set_free(b, size);
+  list_insert(b);
+  return b;
+}
+
+//
+// grow the heap by at least "need" bytes, in a single sbrk call
+//
+static block *heap_grow(size_t need) {
+  size_t bytes = ROUNDUP(MAX(need + HDR_SIZE + ALIGN, HEAP_GROW), 4096);
+  char *p = sbrk(bytes);
+  if (p == (char *)-1) return NULL;
+
+  block *b;
+  size_t prev_flag;
+  if (epilogue && p == heap_end) {
+    // the heap continues: the old epilogue becomes the header of the new block
+    b = epilogue;
+    prev_flag = epilogue->size & PREV_INUSE;
+  } else {
+    // a new segment, e.g., naive_malloc took the pages in between
+    b = (block *)ROUNDUP((uint64)p, ALIGN);
+    prev_flag = PREV_INUSE;
+  }
+  heap_end = p + bytes;
+
+  b->size = ROUNDDOWN((uint64)(heap_end - (char *)b - HDR_SIZE), ALIGN) | prev_flag;
+  epilogue = NEXT_BLOCK(b);
+  epilogue->size = INUSE;
+  epilogue->cls = 0;
+  return coalesce(b);
+}
+
+static void *large_alloc(size_t size) {
+  size_t need = MAX(ROUNDUP(size + HDR_SIZE, ALIGN), MIN_BLOCK);
+
+  block *b = free_list;
+  while (b && BLOCK_SIZE(b) < need) b = b->next;
+  if (b == NULL && (b = heap_grow(need)) == NULL) return NULL;
+  list_remove(b);
+
+  size_t bsize = BLOCK_SIZE(b);
+  if (bsize - need >= MIN_BLOCK) {
+    // split, the rest stays free
+    block *rest = (block *)((char *)b + need);
+    b->size = need | INUSE | (b->size & PREV_INUSE);
+    rest->size = PREV_INUSE;
+    set_free(rest, bsize - need);
+    list_insert(rest);
+  } else {
+    b->size |= INUSE;
+    NEXT_BLOCK(b)->size |= PREV_INUSE;
+  }
+  b->cls = 0;
+  return (char *)b + HDR_SIZE;
+}
+
+static void *small_alloc(int cls) {
+  if (small_free[cls] == NULL) {
+    size_t osize = HDR_SIZE + (1UL << (cls + SMALL_MIN_SHIFT));
+    char *chunk = large_alloc(SMALL_CHUNK);
+    if (chunk == NULL) return NULL;
+    for (size_t off = 0; off + osize <= SMALL_CHUNK; off += osize) {
+      block *o = (block *)(chunk + off);
+      o->size = osize;
+      o->cls = cls + 1;
+      o->next = small_free[cls];
+      small_free[cls] = o;
+    }
+  }
+
+  block *o = small_free[cls];
+  small_free[cls] = o->next;
+  return (char *)o + HDR_SIZE;
+}
+
+//
+// allocate "size" bytes, aligned to 16 bytes. returns NULL if the heap cannot grow.
+//
+void *malloc(size_t size) {
+  if (size == 0) return NULL;
+  for (int cls = 0; cls < SMALL_NCLASSES; cls++)
+    if (size <= (1UL << (cls + SMALL_MIN_SHIFT))) return small_alloc(cls);
+  return large_alloc(size);
+}
+
+//
+// free memory obtained from malloc
+//
+void free(void *ptr) {
+  if (ptr == NULL) return;
+
+  block *b = (block *)((char *)ptr - HDR_SIZE);
+  if (b->cls) {
+    b->next = small_free[b->cls - 1];
+    small_free[b->cls - 1] = b;
+    return;
+  }
+  b->size &= ~INUSE;
+  coalesce(b);
+}
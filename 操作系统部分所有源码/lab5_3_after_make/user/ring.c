@@ -0,0 +1,102 @@
+/*
+ * lock-free single-producer/single-consumer rings for processes that share memory.
+ *
+ * the producer copies elements into the free slots and then publishes them by storing
+ * the new tail; the consumer copies them out and then releases the slots by storing
+ * the new head. the fences order the copies against those stores, so neither side
+ * sees a slot before its data, and no syscall is needed on either side.
+ */
+
+#include "ring.h"
+#include "util/functions.h"
+#include "util/string.h"
+#include "spike_interface/atomic.h"
+
+// loads before the fence complete before the later accesses
+#define ring_acquire() asm volatile("fence r, rw" ::: "memory")
+// accesses before the fence complete before the later stores
+#define ring_release() asm volatile("fence rw, w" ::: "memory")
+
+//
+// build an empty ring in the mem_size bytes at mem, with as many slots of elem_size
+// bytes as fit (rounded down to a power of two). only one of the processes calls it,
+// before the other one uses the ring.
+// return: the ring, or NULL if mem cannot hold two elements.
+//
+spsc_ring *ring_init(void *mem, uint64 mem_size, uint32 elem_size) {
+  spsc_ring *ring = mem;
+  if (elem_size == 0 || mem_size < sizeof(spsc_ring) + 2 * elem_size) return NULL;
+
+  uint64 slots = (mem_size - sizeof(spsc_ring)) / elem_size;
+  uint32 size = 1;
+  while (size * 2 <= slots) size *= 2;
+
+  ring->head = ring->tail = 0;
+  ring->size = size;
+  ring->elem_size = elem_size;
+  mb();
+  return ring;
+}
+
+//
+// copy n elements between "elems" and the slots starting at counter "pos", wrapping
+// around the end of the ring
+//
+static void ring_copy(spsc_ring *ring, uint32 pos, void *elems, uint32 n, int to_ring) {
+  uint32 first = pos & (ring->size - 1);
+  uint32 part = MIN(n, ring->size - first);
+  char *slot = ring->data + (uint64)first * ring->elem_size;
+  uint64 part_bytes = (uint64)part * ring->elem_size;
+  uint64 rest_bytes = (uint64)(n - part) * ring->elem_size;
+
+  if (to_ring) {
+    memcpy(slot, elems, part_bytes);
+    memcpy(ring->data, (char *)elems + part_bytes, rest_bytes);
+  } else {
+    memcpy(elems, slot, part_bytes);
+    memcpy((char *)elems + part_bytes, ring->data, rest_bytes);
+  }
+}
+
+//
+// append up to n elements, producer side only.
+// return: the number of elements pushed, less than n if the ring filled up.
+//
+uint32 ring_push(spsc_ring *ring, const void *elems, uint32 n) {
+  uint32 tail = ring->tail;
+  uint32 head = atomic_read(&ring->head);
+  ring_acquire();  // the consumer is done with the slots before we overwrite them
+
+  n = MIN(n, ring->size - (tail - head));
+  if (n == 0) return 0;
+  ring_copy(ring, tail, (void *)elems, n, 1);
+
+  ring_release();  // the data is visible before the new tail
+  atomic_set(&ring->tail, tail + n);
+  return n;
+}
+
+//
+// remove up to n of the oldest elements into "elems", consumer side only.
+// return: the number of elements popped, 0 if the ring is empty.
+//
+uint32 ring_pop(spsc_ring *ring, void *elems, uint32 n) {
+  uint32 head = ring->head;
+  uint32 tail = atomic_read(&ring->tail);
+  ring_acquire();  // the data of the published slots is read after the tail
+
+  n = MIN(n, tail - head);
+  if (n == 0) return 0;
+  ring_copy(ring, head, elems, n, 0);
+
+  ring_release();  // the slots are copied out before they are handed back
+  atomic_set(&ring->head, head + n);
+  return n;
+}
+
+//
+// the number of elements waiting in the ring
+//
+uint32 ring_count(spsc_ring *ring) {
+  return atomic_read(&ring->tail) - atomic_read(&ring->head);
+}
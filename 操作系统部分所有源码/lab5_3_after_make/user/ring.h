@@ -0,0 +1,25 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+#include "util/types.h"
+
+// a single-producer/single-consumer ring of fixed-size elements, placed in memory that
+// both processes map (e.g., a page from allocate_share_page()). head and tail are
+// free-running counters, each written by one side only, on separate cache lines.
+typedef struct spsc_ring {
+  uint32 head;       // next element to pop, written by the consumer
+  uint32 pad0[15];
+  uint32 tail;       // next free slot, written by the producer
+  uint32 pad1[15];
+  uint32 size;       // number of slots, a power of two
+  uint32 elem_size;  // bytes per element
+  uint32 pad2[14];
+  char data[];
+} spsc_ring;
+
+spsc_ring *ring_init(void *mem, uint64 mem_size, uint32 elem_size);
+uint32 ring_push(spsc_ring *ring, const void *elems, uint32 n);
+uint32 ring_pop(spsc_ring *ring, void *elems, uint32 n);
+uint32 ring_count(spsc_ring *ring);
+
+#endif
@@ -65,6 +65,22 @@ void naive_free(void* va) {
   do_user_call(SYS_user_free_page, (uint64)va, 0, 0, 0, 0, 0, 0);
 }
 
+//
+// lib call to sbrk, moves the end of the heap by "increment" bytes.
+// return: the previous end of the heap, or (void *)-1.
+//
+void *sbrk(long increment) {
+  return (void *)do_user_call(SYS_user_sbrk, increment, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// set the end of the heap to "addr"
+//
+int brk(void *addr) {
+  uint64 cur = (uint64)sbrk(0);
+  return sbrk((long)((uint64)addr - cur)) == (void *)-1 ? -1 : 0;
+}
+
 //
 // lib call to naive_fork
 int fork() {
@@ -78,6 +94,13 @@ void yield() {
   do_user_call(SYS_user_yield, 0, 0, 0, 0, 0, 0, 0);
 }
 
+//
+// lib call to set_priority, moves the calling process into another priority class
+//
+int set_priority(int prio) {
+  return do_user_call(SYS_user_set_priority, prio, 0, 0, 0, 0, 0, 0);
+}
+
 //
 // lib call to open
 //
@@ -106,6 +129,13 @@ int lseek_u(int fd, int offset, int whence) {
   return do_user_call(SYS_user_lseek, fd, offset, whence, 0, 0, 0, 0);
 }
 
+//
+// lib call to fsync
+//
+int fsync_u(int fd) {
+  return do_user_call(SYS_user_fsync, fd, 0, 0, 0, 0, 0, 0);
+}
+
 //
 // lib call to read file information
 //
@@ -184,11 +214,145 @@ int uartgetchar() {
   return do_user_call(SYS_user_uart_getchar, 0, 0, 0, 0, 0, 0, 0);
 }
 
+//
+// read up to n bytes from the Bluetooth uart. waits at most "timeout" ticks for the
+// first byte (forever if negative, not at all if 0) and returns the number read.
+//
+int uart_read(char *buf, uint64 n, int64 timeout) {
+  return do_user_call(SYS_user_uart_read, (uint64)buf, n, timeout, 0, 0, 0, 0);
+}
+
+//
+// sleep while the word at addr holds "expected", for at most "timeout" ticks (forever
+// if negative). returns 0 when woken up by futex_wake, 1 if the word had changed or
+// the timeout expired.
+//
+int futex_wait(int *addr, int expected, int64 timeout) {
+  return do_user_call(SYS_user_futex_wait, (uint64)addr, expected, timeout, 0, 0, 0, 0);
+}
+
+//
+// wake up at most n processes sleeping in futex_wait on addr, returns how many woke up
+//
+int futex_wake(int *addr, int n) {
+  return do_user_call(SYS_user_futex_wake, (uint64)addr, n, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to show the kernel log messages not shown yet
+//
+int klog_flush_u(void) {
+  return do_user_call(SYS_user_klog, KLOG_CMD_FLUSH, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to write the kernel log ring to the file at path
+//
+int klog_dump_u(const char *path) {
+  return do_user_call(SYS_user_klog, KLOG_CMD_DUMP, (uint64)path, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to keep the kernel log messages of subsys (KLOG_SCHED, ...) up to level
+//
+int klog_level_u(int subsys, int level) {
+  return do_user_call(SYS_user_klog, KLOG_CMD_SET_LEVEL, subsys, level, 0, 0, 0, 0);
+}
+
+//
+// lib call to read the monotonic clock, the time since boot
+//
+int clock_gettime_u(struct ktimespec *ts) {
+  return do_user_call(SYS_user_clock_gettime, (uint64)ts, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to sleep for the duration in req
+//
+int nanosleep_u(const struct ktimespec *req) {
+  return do_user_call(SYS_user_nanosleep, (uint64)req, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to start a timer that expires every period. returns its descriptor.
+//
+int timer_create_u(const struct ktimespec *period) {
+  return do_user_call(SYS_user_timer_create, (uint64)period, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to wait for the next expiry of timer td. returns the number of expirations
+// since the last call, which is more than one if the caller fell behind.
+//
+long timer_wait_u(int td) {
+  return do_user_call(SYS_user_timer_wait, td, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// lib call to stop timer td
+//
+int timer_close_u(int td) {
+  return do_user_call(SYS_user_timer_close, td, 0, 0, 0, 0, 0, 0);
+}
+
+//
+// take a consistent copy of the kernel status page. plain loads, no syscall.
+//
+void vdso_read(struct vdso_data *snap) {
+  const volatile struct vdso_data *page = (const volatile struct vdso_data *)USER_VDSO_VA;
+  uint32 seq;
+  do {
+    seq = page->seq;
+    asm volatile("fence r,r" ::: "memory");
+    snap->mtime_freq = page->mtime_freq;
+    snap->ticks = page->ticks;
+    snap->tick_mtime = page->tick_mtime;
+    snap->frame_seq = page->frame_seq;
+    for (int i = 0; i < VDSO_NUARTS; i++) snap->uart_rx_avail[i] = page->uart_rx_avail[i];
+    asm volatile("fence r,r" ::: "memory");
+  } while ((seq & 1) || seq != page->seq);
+  snap->seq = seq;
+}
+
+//
+// the current mtime, from the time CSR. no syscall.
+//
+uint64 vdso_mtime(void) {
+  uint64 t;
+  asm volatile("rdtime %0" : "=r"(t));
+  return t;
+}
+
+//
+// the clock of clock_gettime_u, read without a syscall
+//
+void vdso_clock_gettime(struct ktimespec *ts) {
+  const volatile struct vdso_data *page = (const volatile struct vdso_data *)USER_VDSO_VA;
+  uint64 freq = page->mtime_freq, t = vdso_mtime();
+  ts->tv_sec = t / freq;
+  ts->tv_nsec = t % freq * (1000000000 / freq);
+}
+
+//
+// lib call to control the kernel trace (TRACE_CMD_*). path names the file of
+// TRACE_CMD_DUMP, see tools/trace2chrome.py for reading it.
+//
+int trace_u(int cmd, const char *path) {
+  return do_user_call(SYS_user_trace, cmd, (uint64)path, 0, 0, 0, 0, 0);
+}
+
 // car
 int uart2putchar(char ch) {
   return do_user_call(SYS_user_uart2_putchar, ch, 0, 0, 0, 0, 0, 0);
 }
 
+//
+// queue n bytes for the car in a single syscall
+//
+int uart2_write(const char *buf, uint64 n) {
+  return do_user_call(SYS_user_uart2_write, (uint64)buf, n, 0, 0, 0, 0, 0);
+}
+
 void car_control(char val) {
   char cmd[80];
   if(val == '1') //front
@@ -204,9 +368,7 @@ void car_control(char val) {
   else
 	  strcpy(cmd, "");
 
-  int i;
-  for(i = 0; i < strlen(cmd); i++)
-	  uart2putchar(cmd[i]);
+  uart2_write(cmd, strlen(cmd));
 }
 
 char *allocate_share_page() {
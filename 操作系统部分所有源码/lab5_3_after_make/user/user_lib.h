@@ -6,6 +6,9 @@
 #define _USER_LIB_H_
 #include "util/types.h"
 #include "kernel/proc_file.h"
+#include "kernel/klog.h"
+#include "kernel/vdso.h"
+#include "kernel/trace.h"
 
 #include "unistd.h"
 #include "fcntl.h"
@@ -15,14 +18,26 @@ int printu(const char *s, ...);
 int exit(int code);
 void* naive_malloc();
 void naive_free(void* va);
+void *sbrk(long increment);
+int brk(void *addr);
+void *malloc(size_t size);
+void free(void *ptr);
 int fork();
 void yield();
 
+// priority classes, see kernel/sched.h
+#define SCHED_PRIO_RT     0
+#define SCHED_PRIO_HIGH   1
+#define SCHED_PRIO_NORMAL 2
+#define SCHED_PRIO_LOW    3
+int set_priority(int prio);
+
 // added @ lab4_1
 int open_u(const char *pathname, int flags);
 int read_u(int fd, void *buf, uint64 count);
 int write_u(int fd, void *buf, uint64 count);
 int lseek_u(int fd, int offset, int whence);
+int fsync_u(int fd);
 int stat_u(int fd, struct istat *istat);
 int disk_stat_u(int fd, struct istat *istat);
 int close(int fd);
@@ -41,7 +56,23 @@ int unlink_u(const char *fn);
 int uartputchar(char ch);
 int uartgetchar();
 int uart2putchar(char ch);
+int uart2_write(const char *buf, uint64 n);
+int uart_read(char *buf, uint64 n, int64 timeout);
 void car_control(char val);
+int futex_wait(int *addr, int expected, int64 timeout);
+int futex_wake(int *addr, int n);
+int klog_flush_u(void);
+int klog_dump_u(const char *path);
+int klog_level_u(int subsys, int level);
+int clock_gettime_u(struct ktimespec *ts);
+int nanosleep_u(const struct ktimespec *req);
+int timer_create_u(const struct ktimespec *period);
+long timer_wait_u(int td);
+int timer_close_u(int td);
+void vdso_read(struct vdso_data *snap);
+uint64 vdso_mtime(void);
+void vdso_clock_gettime(struct ktimespec *ts);
+int trace_u(int cmd, const char *path);
 
 // added @lab5_3
 #define PROT_READ  0x1     // Page can be read.
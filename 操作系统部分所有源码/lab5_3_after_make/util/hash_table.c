@@ -1,60 +1,213 @@
 #include "util/hash_table.h"
 #include "util/types.h"
-#include "kernel/pmm.h"
+#include "util/string.h"
+#include "kernel/slab.h"
 
-static int default_equal(void *key1, void *key2) { return key1 == key2; }
+// a slot of the table, the key follows the value inline
+struct hash_slot {
+  uint32 hash;  // hash of the key with the top bit set, 0 marks an empty slot
+  uint32 pad;
+  void *value;  // NULL in an old table once the entry was moved or erased
+  char key[];
+};
 
-static int default_put(struct hash_table *hash_table, void *key, void *value) {
-  struct hash_node *node = (struct hash_node *)alloc_page();
-  if (hash_table->virtual_hash_get(hash_table, key) != NULL) return -1;
-  node->key = key;
-  node->value = value;
+#define HASH_USED 0x80000000u
 
-  size_t index = hash_table->virtual_hash_func(key);
-  struct hash_node *head = hash_table->head + index;
+static struct hash_slot *slot_at(char *slots, uint32 slot_size, uint32 i) {
+  return (struct hash_slot *)(slots + (uint64)i * slot_size);
+}
 
-  node->next = head->next;
-  head->next = node;
-  return 0;
+// how far slot i is from the home slot of "hash"
+static uint32 probe_dist(uint32 hash, uint32 i, uint32 nslots) {
+  return (i - hash) & (nslots - 1);
 }
 
-static void *defalut_get(struct hash_table *hash_table, void *key) {
-  size_t index = hash_table->virtual_hash_func(key);
-  struct hash_node *head = hash_table->head + index;
-  struct hash_node *node = head->next;
-  while (node) {
-    if (hash_table->virtual_hash_equal(node->key, key)) return node->value;
-    node = node->next;
+static void slot_swap(struct hash_slot *a, struct hash_slot *b, uint32 slot_size) {
+  uint64 *x = (uint64 *)a, *y = (uint64 *)b;
+  for (uint32 i = 0; i < slot_size / sizeof(uint64); i++) {
+    uint64 t = x[i];
+    x[i] = y[i];
+    y[i] = t;
   }
-  return NULL;
 }
 
-static int default_erase(struct hash_table *hash_table, void *key) {
-  size_t index = hash_table->virtual_hash_func(key);
-  struct hash_node *head = hash_table->head + index;
-  while (head->next && !hash_table->virtual_hash_equal(head->next->key, key))
-    head = head->next;
-  if (head->next) {
-    struct hash_node *node = head->next;
-    head->next = node->next;
-    free_page(node);
-    return 0;
-  } else
+//
+// find the slot holding "key" in an array of nslots slots. the probe stops at the
+// first slot closer to its home than the key would be: Robin Hood insertion
+// never leaves the key behind such a slot.
+//
+static struct hash_slot *slots_find(struct hash_table *table, char *slots, uint32 nslots,
+                                    uint32 hash, const void *key) {
+  uint32 i = hash & (nslots - 1);
+  for (uint32 dist = 0;; dist++, i = (i + 1) & (nslots - 1)) {
+    struct hash_slot *s = slot_at(slots, table->slot_size, i);
+    if (s->hash == 0 || probe_dist(s->hash, i, nslots) < dist) return NULL;
+    if (s->hash == hash && s->value && table->hash_equal(s->key, key)) return s;
+  }
+}
+
+//
+// insert a new entry into the current slots. on the way to a free slot, the entry
+// takes the place of any entry closer to its home, which then moves on instead.
+//
+static void slots_insert(struct hash_table *table, uint32 hash, const void *key,
+                         void *value) {
+  uint32 mask = table->nslots - 1;
+  struct hash_slot *carry = slot_at(table->slots, table->slot_size, table->nslots);
+  carry->hash = hash;
+  carry->value = value;
+  memcpy(carry->key, key, table->key_size);
+
+  uint32 i = hash & mask;
+  for (uint32 dist = 0;; dist++, i = (i + 1) & mask) {
+    struct hash_slot *s = slot_at(table->slots, table->slot_size, i);
+    if (s->hash == 0) {
+      memcpy(s, carry, table->slot_size);
+      return;
+    }
+    uint32 d = probe_dist(s->hash, i, table->nslots);
+    if (d < dist) {
+      slot_swap(s, carry, table->slot_size);
+      dist = d;
+    }
+  }
+}
+
+//
+// remove the entry in slot "s" of the current slots, and shift the entries after
+// it back by one until an empty slot or an entry in its home slot.
+//
+static void slots_remove(struct hash_table *table, struct hash_slot *s) {
+  uint32 mask = table->nslots - 1;
+  uint32 i = ((char *)s - table->slots) / table->slot_size;
+  for (;;) {
+    uint32 next = (i + 1) & mask;
+    struct hash_slot *n = slot_at(table->slots, table->slot_size, next);
+    if (n->hash == 0 || probe_dist(n->hash, next, table->nslots) == 0) break;
+    memcpy(slot_at(table->slots, table->slot_size, i), n, table->slot_size);
+    i = next;
+  }
+  s = slot_at(table->slots, table->slot_size, i);
+  s->hash = 0;
+  s->value = NULL;
+}
+
+//
+// move up to n slots of the old table into the current one, and free the old
+// table once it is empty.
+//
+static void hash_migrate(struct hash_table *table, uint32 n) {
+  while (table->old_slots && table->old_count > 0 && n-- > 0) {
+    struct hash_slot *s = slot_at(table->old_slots, table->slot_size, table->old_pos++);
+    if (s->hash && s->value) {
+      slots_insert(table, s->hash, s->key, s->value);
+      s->value = NULL;
+      table->count++;
+      table->old_count--;
+    }
+  }
+  if (table->old_slots && table->old_count == 0) {
+    kfree(table->old_slots);
+    table->old_slots = NULL;
+  }
+}
+
+//
+// start moving the entries into a table of twice the size.
+// return: 0 on success, -1 if there is no memory for the larger table.
+//
+static int hash_grow(struct hash_table *table) {
+  // an earlier move that is still going on is finished first
+  hash_migrate(table, table->old_nslots);
+
+  uint32 nslots = table->nslots * 2;
+  char *slots = kmalloc((uint64)(nslots + 1) * table->slot_size);
+  if (slots == NULL) return -1;
+  memset(slots, 0, (uint64)(nslots + 1) * table->slot_size);
+
+  table->old_slots = table->slots;
+  table->old_nslots = table->nslots;
+  table->old_count = table->count;
+  table->old_pos = 0;
+  table->slots = slots;
+  table->nslots = nslots;
+  table->count = 0;
+  return 0;
+}
+
+static struct hash_slot *hash_find(struct hash_table *table, uint32 hash, const void *key) {
+  struct hash_slot *s = slots_find(table, table->slots, table->nslots, hash, key);
+  if (s == NULL && table->old_slots)
+    s = slots_find(table, table->old_slots, table->old_nslots, hash, key);
+  return s;
+}
+
+//
+// put "value" under a copy of "key".
+// return: 0 on success, -1 if the key is already in the table or it is full.
+//
+int hash_table_put(struct hash_table *table, const void *key, void *value) {
+  uint32 hash = (uint32)table->hash_func(key) | HASH_USED;
+  hash_migrate(table, HASH_TABLE_MIGRATE);
+  if (hash_find(table, hash, key) != NULL) return -1;
+
+  // keep the load below 3/4, a table that cannot grow takes entries until it is full
+  if ((table->count + table->old_count + 1) * 4 > table->nslots * 3 &&
+      hash_grow(table) != 0 && table->count + 1 >= table->nslots)
     return -1;
+
+  slots_insert(table, hash, key, value);
+  table->count++;
+  return 0;
+}
+
+//
+// return: the value put under "key", NULL if there is none.
+//
+void *hash_table_get(struct hash_table *table, const void *key) {
+  struct hash_slot *s = hash_find(table, (uint32)table->hash_func(key) | HASH_USED, key);
+  return s ? s->value : NULL;
 }
 
-int hash_table_init(struct hash_table *list,
-                   int (*equal)(void *key1, void *key2),
-                   size_t (*func)(void *key),
-                   int (*put)(struct hash_table *hash_table, void *key, void *value),
-                   void *(*get)(struct hash_table *hash_table, void *key),
-                   int (*erase)(struct hash_table *hash_table, void *key)) {
-  for (int i = 0; i < HASH_TABLE_SIZE; i++) list->head[i].next = NULL;
-  if (func == NULL) return -1;
-  list->virtual_hash_func = func;
-  list->virtual_hash_equal = equal ? equal : default_equal;
-  list->virtual_hash_put = put ? put : default_put;
-  list->virtual_hash_get = get ? get : defalut_get;
-  list->virtual_hash_erase = erase ? erase : default_erase;
+//
+// remove "key" from the table.
+// return: 0 on success, -1 if the key is not in the table.
+//
+int hash_table_erase(struct hash_table *table, const void *key) {
+  uint32 hash = (uint32)table->hash_func(key) | HASH_USED;
+  hash_migrate(table, HASH_TABLE_MIGRATE);
+
+  struct hash_slot *s = slots_find(table, table->slots, table->nslots, hash, key);
+  if (s) {
+    slots_remove(table, s);
+    table->count--;
+    return 0;
+  }
+  if (table->old_slots &&
+      (s = slots_find(table, table->old_slots, table->old_nslots, hash, key)) != NULL) {
+    // the old table is only read from now on, so the slot just stays as a marker
+    s->value = NULL;
+    table->old_count--;
+    return 0;
+  }
+  return -1;
+}
+
+int hash_table_init(struct hash_table *table, uint32 key_size,
+                    int (*hash_equal)(const void *key1, const void *key2),
+                    size_t (*hash_func)(const void *key)) {
+  if (hash_equal == NULL || hash_func == NULL) return -1;
+  table->hash_equal = hash_equal;
+  table->hash_func = hash_func;
+  table->key_size = key_size;
+  table->slot_size = sizeof(struct hash_slot) + (key_size + 7) / 8 * 8;
+  table->nslots = HASH_TABLE_INIT_SLOTS;
+  table->count = 0;
+  table->old_slots = NULL;
+  table->old_nslots = table->old_count = table->old_pos = 0;
+
+  table->slots = kmalloc((uint64)(table->nslots + 1) * table->slot_size);
+  if (table->slots == NULL) return -1;
+  memset(table->slots, 0, (uint64)(table->nslots + 1) * table->slot_size);
   return 0;
-}
\ No newline at end of file
+}
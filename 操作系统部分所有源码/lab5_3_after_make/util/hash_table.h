@@ -2,28 +2,33 @@
 #define _HASH_TABLE_H
 #include "util/types.h"
 
-#define HASH_TABLE_SIZE 128
+#define HASH_TABLE_INIT_SLOTS 16  // slots of a new table, a power of two
+#define HASH_TABLE_MIGRATE 8      // old slots moved over by each put or erase
 
-struct hash_node {
-  struct hash_node *next;
-  void *key;
-  void *value;
-};
-
-// this is a generic hash linked table for KERNEL SPACE
+// this is a generic open-addressing hash table (Robin Hood hashing) for KERNEL SPACE.
+// a key of key_size bytes is copied into its slot, next to the value, so a put
+// allocates nothing. values must not be NULL.
+// when the table gets 3/4 full, a table of twice the size takes over, and the
+// entries of the old one move over a few at a time on later puts and erases.
 struct hash_table {
-  struct hash_node head[HASH_TABLE_SIZE];
-  int (*virtual_hash_equal)(void *key1, void *key2);
-  size_t (*virtual_hash_func)(void *key);
-  int (*virtual_hash_put)(struct hash_table *hash_table, void *key, void *value);
-  void *(*virtual_hash_get)(struct hash_table *hash_table, void *key);
-  int (*virtual_hash_erase)(struct hash_table *hash_table, void *key);
+  int (*hash_equal)(const void *key1, const void *key2);
+  size_t (*hash_func)(const void *key);
+  uint32 key_size;
+  uint32 slot_size;
+  char *slots;       // nslots slots, followed by one scratch slot
+  uint32 nslots;     // a power of two
+  uint32 count;      // entries in slots
+  char *old_slots;   // the table being moved into slots, NULL if none
+  uint32 old_nslots;
+  uint32 old_count;  // entries still in old_slots
+  uint32 old_pos;    // old slots before it have been moved
 };
 
-int hash_table_init(struct hash_table *list, int (*virtual_hash_equal)(void *key1, void *key2),
-                   size_t (*virtual_hash_func)(void *key),
-                   int (*virtual_hash_put)(struct hash_table *hash_table, void *key, void *value),
-                   void *(*virtual_hash_get)(struct hash_table *hash_table, void *key),
-                   int (*virtual_hash_erase)(struct hash_table *hash_table, void *key));
+int hash_table_init(struct hash_table *table, uint32 key_size,
+                    int (*hash_equal)(const void *key1, const void *key2),
+                    size_t (*hash_func)(const void *key));
+int hash_table_put(struct hash_table *table, const void *key, void *value);
+void *hash_table_get(struct hash_table *table, const void *key);
+int hash_table_erase(struct hash_table *table, const void *key);
 
-#endif
\ No newline at end of file
+#endif
@@ -38,6 +38,13 @@ void* memset(void* dest, int byte, size_t len) {
   return dest;
 }
 
+int memcmp(const void* s1, const void* s2, size_t len) {
+  const unsigned char *a = s1, *b = s2;
+  for (size_t i = 0; i < len; i++)
+    if (a[i] != b[i]) return a[i] - b[i];
+  return 0;
+}
+
 size_t strlen(const char* s) {
   const char* p = s;
   while (*p) p++;
@@ -5,6 +5,7 @@
 
 void *memcpy(void* dest, const void* src, size_t len);
 void *memset(void* dest, int byte, size_t len);
+int memcmp(const void* s1, const void* s2, size_t len);
 size_t strlen(const char* s);
 int strcmp(const char* s1, const char* s2);
 char *strcpy(char* dest, const char* src);
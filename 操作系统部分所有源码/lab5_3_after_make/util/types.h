@@ -55,4 +55,11 @@ struct istat {
   int st_blocks;
 };
 
+// a point in time or a duration, as taken by the clock syscalls. it is named apart
+// from the struct timespec of the C library, which apps may also see.
+struct ktimespec {
+  int64 tv_sec;
+  int64 tv_nsec;
+};
+
 #endif